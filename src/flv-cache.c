@@ -0,0 +1,255 @@
+/*
+ * @file flv-cache.c
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "flv-cache.h"
+
+#define FLV_CACHE_VERSION (1)
+#define FLV_CACHE_DEFAULT_MAX_BYTES (64 * 1024 * 1024)
+#define FLV_CACHE_SUFFIX ".idx"
+
+static const char flv_cache_magic[4] = {'F', 'L', 'V', 'C'};
+
+/*
+ * @brief entry file header, then the keyframes and the onMetaData records
+ */
+struct flv_cache_entry {
+    char magic[4];
+    uint32_t version;
+    flv_cache_key_t key;
+    flv_summary_t summary;
+    uint64_t keyframe_count;
+    uint64_t metadata_size;
+};
+
+struct cache_file {
+    int64_t mtime; // ns
+    off_t size;
+    char *name;
+};
+
+/*
+ * @brief FNV-1a, 64 bits
+ */
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t size) {
+    const uint8_t *p = data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= p[i];
+        hash *= UINT64_C(0x100000001b3);
+    }
+    return hash;
+}
+
+#define FNV1A_INIT (UINT64_C(0xcbf29ce484222325))
+
+static uint64_t hash_range(int fd, off_t offset, size_t size) {
+    uint8_t buf[FLV_CACHE_EDGE_SIZE];
+    ssize_t n = pread(fd, buf, size, offset);
+    return fnv1a(FNV1A_INIT, buf, n > 0 ? (size_t) n : 0);
+}
+
+/*
+ * @brief identity of the file at path
+ * @return 0, or -1 if it cannot be opened
+ */
+int flv_cache_key(const char *path, flv_cache_key_t *key) {
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    memset(key, 0, sizeof(*key));
+    key->dev = st.st_dev;
+    key->ino = st.st_ino;
+    key->size = st.st_size;
+    key->mtime_sec = st.st_mtim.tv_sec;
+    key->mtime_nsec = st.st_mtim.tv_nsec;
+
+    // same size and mtime but rewritten in place: the edges usually differ
+    size_t edge = st.st_size < FLV_CACHE_EDGE_SIZE ? (size_t) st.st_size : FLV_CACHE_EDGE_SIZE;
+    key->head_hash = hash_range(fd, 0, edge);
+    key->tail_hash = hash_range(fd, st.st_size - edge, edge);
+
+    close(fd);
+    return 0;
+}
+
+static void entry_path(const flv_cache_t *cache, const flv_cache_key_t *key, char *path, size_t size) {
+    snprintf(path, size, "%s/%016llx" FLV_CACHE_SUFFIX, cache->dir,
+             (unsigned long long) fnv1a(FNV1A_INIT, key, sizeof(*key)));
+}
+
+/*
+ * @brief fill index from the entry of key
+ * @return 1 on a hit, 0 on a miss
+ */
+int flv_cache_load(const flv_cache_t *cache, const flv_cache_key_t *key, flv_index_t *index) {
+    struct flv_cache_entry entry;
+    char path[4096];
+    uint8_t *metadata = NULL;
+    int hit = 0;
+
+    entry_path(cache, key, path, sizeof(path));
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return 0;
+    }
+
+    if (fread(&entry, sizeof(entry), 1, f) != 1 ||
+        memcmp(entry.magic, flv_cache_magic, sizeof(entry.magic)) != 0 ||
+        entry.version != FLV_CACHE_VERSION ||
+        memcmp(&entry.key, key, sizeof(*key)) != 0) {
+        goto out;
+    }
+
+    flv_index_free(index);
+    index->summary = entry.summary;
+    for (uint64_t i = 0; i < entry.keyframe_count; i++) {
+        flv_keyframe_t keyframe;
+        if (fread(&keyframe, sizeof(keyframe), 1, f) != 1 ||
+            flv_index_add_keyframe(index, keyframe.offset, keyframe.time) < 0) {
+            goto out;
+        }
+    }
+    metadata = malloc(entry.metadata_size ? entry.metadata_size : 1);
+    if (!metadata ||
+        fread(metadata, 1, entry.metadata_size, f) != entry.metadata_size ||
+        flv_index_set_metadata(index, metadata, entry.metadata_size) < 0) {
+        goto out;
+    }
+    hit = 1;
+
+    // mark it recently used for the eviction
+    utimensat(AT_FDCWD, path, NULL, 0);
+
+out:
+    if (!hit) {
+        flv_index_free(index);
+    }
+    free(metadata);
+    fclose(f);
+    return hit;
+}
+
+static int by_mtime(const void *a, const void *b) {
+    const struct cache_file *fa = a;
+    const struct cache_file *fb = b;
+    return (fa->mtime > fb->mtime) - (fa->mtime < fb->mtime);
+}
+
+/*
+ * @brief drop the least recently used entries until the cache fits its bound
+ */
+static void evict(const flv_cache_t *cache) {
+    uint64_t max_bytes = cache->max_bytes ? cache->max_bytes : FLV_CACHE_DEFAULT_MAX_BYTES;
+    struct cache_file *files = NULL;
+    size_t count = 0;
+    size_t cap = 0;
+    uint64_t total = 0;
+    struct dirent *ent;
+    char path[4096];
+
+    DIR *dir = opendir(cache->dir);
+    if (!dir) {
+        return;
+    }
+    while ((ent = readdir(dir)) != NULL) {
+        size_t len = strlen(ent->d_name);
+        struct stat st;
+        if (len < sizeof(FLV_CACHE_SUFFIX) ||
+            strcmp(ent->d_name + len - (sizeof(FLV_CACHE_SUFFIX) - 1), FLV_CACHE_SUFFIX) != 0) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", cache->dir, ent->d_name);
+        if (stat(path, &st) < 0) {
+            continue;
+        }
+        if (count == cap) {
+            cap = cap ? cap * 2 : 64;
+            struct cache_file *grown = realloc(files, cap * sizeof(struct cache_file));
+            if (!grown) {
+                break;
+            }
+            files = grown;
+        }
+        files[count].mtime = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+        files[count].size = st.st_size;
+        files[count].name = strdup(ent->d_name);
+        if (files[count].name) {
+            total += st.st_size;
+            count++;
+        }
+    }
+    closedir(dir);
+
+    if (total > max_bytes) {
+        qsort(files, count, sizeof(struct cache_file), by_mtime);
+        for (size_t i = 0; i < count && total > max_bytes; i++) {
+            snprintf(path, sizeof(path), "%s/%s", cache->dir, files[i].name);
+            if (unlink(path) == 0) {
+                total -= files[i].size;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        free(files[i].name);
+    }
+    free(files);
+}
+
+/*
+ * @brief save index as the entry of key, replacing the entry atomically
+ * @return 0, or -1 if the entry could not be written
+ */
+int flv_cache_store(const flv_cache_t *cache, const flv_cache_key_t *key, const flv_index_t *index) {
+    struct flv_cache_entry entry;
+    char path[4096];
+    char tmp[4096 + 32];
+
+    if (mkdir(cache->dir, 0755) < 0 && errno != EEXIST) {
+        return -1;
+    }
+    entry_path(cache, key, path, sizeof(path));
+    snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", path, (long) getpid());
+
+    FILE *f = fopen(tmp, "wb");
+    if (!f) {
+        return -1;
+    }
+
+    memset(&entry, 0, sizeof(entry));
+    memcpy(entry.magic, flv_cache_magic, sizeof(entry.magic));
+    entry.version = FLV_CACHE_VERSION;
+    entry.key = *key;
+    entry.summary = index->summary;
+    entry.keyframe_count = index->keyframe_count;
+    entry.metadata_size = index->metadata_size;
+
+    int failed = fwrite(&entry, sizeof(entry), 1, f) != 1 ||
+                 fwrite(index->keyframes, sizeof(flv_keyframe_t), index->keyframe_count, f) != index->keyframe_count ||
+                 fwrite(index->metadata, 1, index->metadata_size, f) != index->metadata_size;
+    if (fclose(f) != 0 || failed || rename(tmp, path) < 0) {
+        unlink(tmp);
+        return -1;
+    }
+
+    evict(cache);
+    return 0;
+}
@@ -0,0 +1,40 @@
+/*
+ * @file flv-cache.h
+ *
+ * On-disk cache of file indexes (flv-index.h), one small file per entry,
+ * keyed by file identity: device, inode, size, mtime and a hash of the
+ * first and last 4 KiB. The least recently used entries go first once the
+ * cache outgrows its size bound.
+ */
+
+#ifndef FLV_CACHE_H_
+#define FLV_CACHE_H_ (1)
+
+#include <stdint.h>
+
+#include "flv-index.h"
+
+#define FLV_CACHE_EDGE_SIZE (4096)
+
+typedef struct flv_cache_key {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t head_hash; // first FLV_CACHE_EDGE_SIZE bytes
+    uint64_t tail_hash; // last FLV_CACHE_EDGE_SIZE bytes
+} flv_cache_key_t;
+
+typedef struct flv_cache {
+    const char *dir;
+    uint64_t max_bytes; // 0 for the default, 64 MiB
+} flv_cache_t;
+
+int flv_cache_key(const char *path, flv_cache_key_t *key);
+
+int flv_cache_load(const flv_cache_t *cache, const flv_cache_key_t *key, flv_index_t *index);
+
+int flv_cache_store(const flv_cache_t *cache, const flv_cache_key_t *key, const flv_index_t *index);
+
+#endif // FLV_CACHE_H_
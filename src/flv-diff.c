@@ -0,0 +1,291 @@
+/*
+ * @file flv-diff.c
+ */
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "flv-diff.h"
+#include "flv-hash.h"
+#include "flv-parser.h"
+
+#define DIFF_CHUNK_SIZE (64 * 1024)
+
+/*
+ * @brief what one side knows about its current tag
+ */
+struct diff_tag {
+    flv_tag_t tag;
+    uint8_t sound_format;
+    uint8_t sound_rate;
+    uint8_t sound_size;
+    uint8_t sound_type;
+    uint8_t aac_packet_type;
+    uint8_t frame_type;
+    uint8_t codec_id;
+    uint32_t fourcc;
+    uint8_t packet_type;
+    uint8_t avc_packet_type;
+    int32_t composition_time;
+    int have_cts; // composition_time is set, it may be 0
+    flv_hash_t payload;
+};
+
+struct diff_side {
+    const char *path;
+    FILE *in;
+    flv_parser_t parser;
+    flv_header_t header;
+    struct diff_tag cur;
+};
+
+static int diff_header(void *opaque, const flv_header_t *header) {
+    struct diff_side *side = opaque;
+
+    side->header = *header;
+    return 0;
+}
+
+static int diff_tag_header(void *opaque, const flv_tag_t *tag) {
+    struct diff_side *side = opaque;
+
+    memset(&side->cur, 0, sizeof(side->cur));
+    side->cur.tag = *tag;
+    flv_hash_init(&side->cur.payload, 0);
+    return 0;
+}
+
+static int diff_audio(void *opaque, const flv_tag_t *tag, const audio_tag_t *audio) {
+    struct diff_side *side = opaque;
+    (void) tag;
+
+    side->cur.sound_format = audio->sound_format;
+    side->cur.sound_rate = audio->sound_rate;
+    side->cur.sound_size = audio->sound_size;
+    side->cur.sound_type = audio->sound_type;
+    side->cur.aac_packet_type = audio->aac_packet_type;
+    return 0;
+}
+
+static int diff_video(void *opaque, const flv_tag_t *tag, const video_tag_t *video) {
+    struct diff_side *side = opaque;
+    (void) tag;
+
+    side->cur.frame_type = video->frame_type;
+    side->cur.codec_id = video->codec_id;
+    side->cur.fourcc = video->fourcc;
+    side->cur.packet_type = video->packet_type;
+    return 0;
+}
+
+static int diff_avc(void *opaque, const flv_tag_t *tag, const video_tag_t *video, const avc_video_tag_t *avc) {
+    struct diff_side *side = opaque;
+    (void) tag;
+    (void) video;
+
+    side->cur.avc_packet_type = avc->avc_packet_type;
+    side->cur.composition_time = avc->composition_time;
+    side->cur.have_cts = 1;
+    return 0;
+}
+
+static int diff_video_packet(void *opaque, const flv_tag_t *tag, const video_tag_t *video, const flv_video_packet_t *packet) {
+    struct diff_side *side = opaque;
+    (void) tag;
+    (void) video;
+
+    // the composition time of the first track is compared, the payload hash covers the other tracks
+    if (!side->cur.have_cts) {
+        side->cur.composition_time = packet->composition_time;
+        side->cur.have_cts = 1;
+    }
+    return 0;
+}
+
+static int diff_payload(void *opaque, const flv_tag_t *tag, const uint8_t *data, size_t size, uint32_t offset) {
+    struct diff_side *side = opaque;
+    (void) tag;
+    (void) offset;
+
+    flv_hash_update(&side->cur.payload, data, size);
+    return 0;
+}
+
+static const flv_visitor_t diff_visitor = {
+    .on_header = diff_header,
+    .on_tag_header = diff_tag_header,
+    .on_audio = diff_audio,
+    .on_video = diff_video,
+    .on_avc = diff_avc,
+    .on_video_packet = diff_video_packet,
+    .on_payload = diff_payload,
+};
+
+struct diff_field {
+    const char *name;
+    int64_t a;
+    int64_t b;
+};
+
+/*
+ * @brief print a line per field that differs
+ * @return fields that differ
+ */
+static int report_fields(FILE *out, const char *what, const struct diff_field *fields, size_t count,
+                         uint64_t offset_a, uint64_t offset_b) {
+    int differs = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        if (fields[i].a != fields[i].b) {
+            fprintf(out, "%s: %s %" PRId64 " != %" PRId64 " (offsets %" PRIu64 ", %" PRIu64 ")\n",
+                    what, fields[i].name, fields[i].a, fields[i].b, offset_a, offset_b);
+            differs++;
+        }
+    }
+    return differs;
+}
+
+static int compare_headers(FILE *out, const flv_header_t *a, const flv_header_t *b) {
+    struct diff_field fields[] = {
+        {"version", a->version, b->version},
+        {"type flags", a->type_flags, b->type_flags},
+        {"data offset", a->data_offset, b->data_offset},
+    };
+
+    return report_fields(out, "header", fields, sizeof(fields) / sizeof(fields[0]), 0, 0);
+}
+
+static int compare_tags(FILE *out, uint64_t index, const struct diff_tag *a, const struct diff_tag *b) {
+    char what[32];
+    struct diff_field fields[] = {
+        {"PreviousTagSize", a->tag.prev_tag_size, b->tag.prev_tag_size},
+        {"tag type", a->tag.tag_type, b->tag.tag_type},
+        {"data size", a->tag.data_size, b->tag.data_size},
+        {"timestamp", (int64_t) a->tag.time, (int64_t) b->tag.time},
+        {"stream id", a->tag.stream_id, b->tag.stream_id},
+        // codec fields, only meaningful when the tag types agree
+        {"sound format", a->sound_format, b->sound_format},
+        {"sound rate", a->sound_rate, b->sound_rate},
+        {"sound size", a->sound_size, b->sound_size},
+        {"sound type", a->sound_type, b->sound_type},
+        {"AAC packet type", a->aac_packet_type, b->aac_packet_type},
+        {"frame type", a->frame_type, b->frame_type},
+        {"codec id", a->codec_id, b->codec_id},
+        {"FourCC", a->fourcc, b->fourcc},
+        {"packet type", a->packet_type, b->packet_type},
+        {"AVC packet type", a->avc_packet_type, b->avc_packet_type},
+        {"composition time", a->composition_time, b->composition_time},
+    };
+    size_t count = sizeof(fields) / sizeof(fields[0]);
+
+    snprintf(what, sizeof(what), "tag %" PRIu64, index);
+    if (a->tag.tag_type != b->tag.tag_type) {
+        count = 5;
+    }
+    int differs = report_fields(out, what, fields, count, a->tag.offset, b->tag.offset);
+
+    uint64_t hash_a = flv_hash_digest(&a->payload);
+    uint64_t hash_b = flv_hash_digest(&b->payload);
+    if (hash_a != hash_b) {
+        fprintf(out, "%s: payload hash %016" PRIx64 " != %016" PRIx64 " (offsets %" PRIu64 ", %" PRIu64 ")\n",
+                what, hash_a, hash_b, a->tag.offset, b->tag.offset);
+        differs++;
+    }
+    return differs;
+}
+
+static int open_side(struct diff_side *side, const char *path) {
+    memset(side, 0, sizeof(*side));
+    side->path = path;
+    side->in = fopen(path, "rb");
+    if (!side->in) {
+        return -1;
+    }
+    flv_parser_init(&side->parser, side->in, &diff_visitor, side);
+    flv_parser_set_chunk_size(&side->parser, DIFF_CHUNK_SIZE);
+    return 0;
+}
+
+static void close_side(struct diff_side *side) {
+    if (side->in) {
+        flv_parser_close(&side->parser);
+        fclose(side->in);
+    }
+}
+
+/*
+ * @brief compare two files tag by tag, a line per difference to out
+ * @return 0 if they match, 1 if they differ, -1 if one cannot be read
+ */
+int flv_diff(const char *path_a, const char *path_b, const flv_diff_opts_t *opts, FILE *out) {
+    struct diff_side a;
+    struct diff_side b;
+    uint64_t tags = 0;
+    int differs = 0;
+    int ret = -1;
+
+    if (open_side(&a, path_a) < 0) {
+        fprintf(out, "%s: cannot open\n", path_a);
+        close_side(&a);
+        return -1;
+    }
+    if (open_side(&b, path_b) < 0) {
+        fprintf(out, "%s: cannot open\n", path_b);
+        close_side(&a);
+        close_side(&b);
+        return -1;
+    }
+
+    int ra = flv_read_header(&a.parser);
+    int rb = flv_read_header(&b.parser);
+    if (ra != FLV_OK || rb != FLV_OK) {
+        fprintf(out, "%s: not an FLV file\n", ra != FLV_OK ? path_a : path_b);
+        goto out;
+    }
+    differs = compare_headers(out, &a.header, &b.header);
+
+    while (!(differs && opts->first_only)) {
+        ra = flv_read_tag(&a.parser);
+        rb = flv_read_tag(&b.parser);
+
+        if (ra == FLV_ERROR || rb == FLV_ERROR) {
+            if (ra == FLV_ERROR) {
+                fprintf(out, "%s: error at offset %" PRIu64 "\n", path_a, flv_parser_offset(&a.parser));
+            }
+            if (rb == FLV_ERROR) {
+                fprintf(out, "%s: error at offset %" PRIu64 "\n", path_b, flv_parser_offset(&b.parser));
+            }
+            if (ra == rb) {
+                goto out;
+            }
+            // one side damaged and the other intact is a difference
+            differs++;
+            break;
+        }
+        if (ra == FLV_END || rb == FLV_END) {
+            if (ra != rb) {
+                fprintf(out, "tag count: %s ends after %" PRIu64 " tags, %s has more\n",
+                        ra == FLV_END ? path_a : path_b, tags, ra == FLV_END ? path_b : path_a);
+                differs++;
+            } else if (flv_parser_offset(&a.parser) != flv_parser_offset(&b.parser)) {
+                // the final PreviousTagSize, or bytes after it
+                fprintf(out, "end: %s has %" PRIu64 " bytes, %s %" PRIu64 "\n",
+                        path_a, flv_parser_offset(&a.parser), path_b, flv_parser_offset(&b.parser));
+                differs++;
+            }
+            break;
+        }
+
+        differs += compare_tags(out, tags, &a.cur, &b.cur);
+        tags++;
+    }
+
+    fprintf(out, "%" PRIu64 " tags compared, %s\n", tags, differs ? "files differ" : "identical");
+    ret = differs ? 1 : 0;
+
+out:
+    close_side(&a);
+    close_side(&b);
+    return ret;
+}
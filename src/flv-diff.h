@@ -0,0 +1,21 @@
+/*
+ * @file flv-diff.h
+ *
+ * Tag-level comparison of two FLV files: both are parsed a tag at a time in
+ * lockstep and the file header, then each tag's header fields, codec fields
+ * and payload hash are compared. Payloads arrive in bounded chunks and are
+ * hashed as they stream past, so memory does not depend on the files.
+ */
+
+#ifndef FLV_DIFF_H_
+#define FLV_DIFF_H_ (1)
+
+#include <stdio.h>
+
+typedef struct flv_diff_opts {
+    int first_only; // stop at the first tag that differs
+} flv_diff_opts_t;
+
+int flv_diff(const char *path_a, const char *path_b, const flv_diff_opts_t *opts, FILE *out);
+
+#endif // FLV_DIFF_H_
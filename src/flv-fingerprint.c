@@ -0,0 +1,370 @@
+/*
+ * @file flv-fingerprint.c
+ */
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "flv-fingerprint.h"
+
+#define FLV_FINGERPRINT_VERSION (1)
+#define FLV_FINGERPRINT_BOM (0x01020304)
+#define FLV_FINGERPRINT_READ_GOPS (4096)
+
+// a GOP found in more places than this (a still picture, a slate) is no evidence of overlap
+#define OVERLAP_MAX_GROUP (64)
+
+static const char flv_fingerprint_magic[4] = {'F', 'L', 'V', 'F'};
+
+struct flv_fingerprint_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t bom;
+    uint32_t reserved;
+};
+
+/*
+ * @brief write the GOP being built, end is the time it runs to
+ */
+static void end_gop(flv_fingerprint_t *fp, uint64_t end) {
+    if (!fp->in_gop) {
+        return;
+    }
+    fp->gop.fingerprint = flv_hash_digest(&fp->hash);
+    fp->gop.duration = (uint32_t) (end - fp->gop.time);
+    if (fwrite(&fp->gop, sizeof(fp->gop), 1, fp->out) != 1) {
+        fp->error = 1;
+    }
+    fp->gops++;
+    fp->in_gop = 0;
+}
+
+static int fingerprint_tag_header(void *opaque, const flv_tag_t *tag) {
+    flv_fingerprint_t *fp = opaque;
+    (void) tag;
+
+    fp->keyframe = 0;
+    fp->skip = 0;
+    fp->crc = 0;
+    return 0;
+}
+
+static int fingerprint_video(void *opaque, const flv_tag_t *tag, const video_tag_t *video) {
+    flv_fingerprint_t *fp = opaque;
+    (void) tag;
+
+    fp->keyframe = video->frame_type == 1;
+    fp->skip = video->frame_type == FLV_VIDEO_FRAME_COMMAND;
+    // Enhanced FLV: configuration records and metadata, as AVC sequence headers below
+    if (video->ex_header && video->packet_type != FLV_PACKET_CODED_FRAMES &&
+        video->packet_type != FLV_PACKET_CODED_FRAMES_X) {
+        fp->keyframe = 0;
+        fp->skip = 1;
+    }
+    return 0;
+}
+
+static int fingerprint_avc(void *opaque, const flv_tag_t *tag, const video_tag_t *video, const avc_video_tag_t *avc) {
+    flv_fingerprint_t *fp = opaque;
+    (void) tag;
+    (void) video;
+
+    // sequence headers are keyframes by flag only, and recorders repeat them at will
+    if (avc->avc_packet_type != 1) {
+        fp->keyframe = 0;
+        fp->skip = 1;
+    }
+    return 0;
+}
+
+static int fingerprint_payload(void *opaque, const flv_tag_t *tag, const uint8_t *data, size_t size, uint32_t offset) {
+    flv_fingerprint_t *fp = opaque;
+
+    if (tag->tag_type != TAGTYPE_VIDEODATA || fp->skip) {
+        return 0;
+    }
+    if (offset == 0 && fp->keyframe) {
+        end_gop(fp, tag->time);
+        memset(&fp->gop, 0, sizeof(fp->gop));
+        fp->gop.offset = tag->offset;
+        fp->gop.time = tag->time;
+        flv_hash_init(&fp->hash, 0);
+        fp->in_gop = 1;
+    }
+    if (!fp->in_gop) {
+        return 0; // frames before the first keyframe
+    }
+
+    fp->crc = flv_crc32c(fp->crc, data, size);
+    if (offset + size == tag->data_size) {
+        // CRC and size of the frame, little-endian so fingerprints agree across hosts
+        uint8_t frame[8];
+        for (int i = 0; i < 4; i++) {
+            frame[i] = (uint8_t) (fp->crc >> (8 * i));
+            frame[4 + i] = (uint8_t) (tag->data_size >> (8 * i));
+        }
+        flv_hash_update(&fp->hash, frame, sizeof(frame));
+        fp->gop.frames++;
+        fp->last_time = tag->time;
+    }
+    return fp->error ? -1 : 0;
+}
+
+const flv_visitor_t flv_fingerprint_visitor = {
+    .on_tag_header = fingerprint_tag_header,
+    .on_video = fingerprint_video,
+    .on_avc = fingerprint_avc,
+    .on_payload = fingerprint_payload,
+};
+
+/*
+ * @return 0, or -1 if path cannot be created
+ */
+int flv_fingerprint_open(flv_fingerprint_t *fp, const char *path) {
+    struct flv_fingerprint_header header;
+
+    memset(fp, 0, sizeof(*fp));
+    fp->out = fopen(path, "wb");
+    if (!fp->out) {
+        return -1;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, flv_fingerprint_magic, sizeof(header.magic));
+    header.version = FLV_FINGERPRINT_VERSION;
+    header.bom = FLV_FINGERPRINT_BOM;
+    if (fwrite(&header, sizeof(header), 1, fp->out) != 1) {
+        fp->error = 1;
+    }
+    return 0;
+}
+
+/*
+ * @brief write the last GOP and close
+ * @return 0, or -1 if any write failed
+ */
+int flv_fingerprint_close(flv_fingerprint_t *fp) {
+    end_gop(fp, fp->last_time);
+    if (fclose(fp->out) != 0) {
+        fp->error = 1;
+    }
+    fp->out = NULL;
+    return fp->error ? -1 : 0;
+}
+
+/*
+ * @brief read the GOPs of a fingerprint file, free *gops when done
+ * @return 0, or -1 if path is not a fingerprint file or is damaged
+ */
+int flv_fingerprint_load(const char *path, flv_gop_t **gops, size_t *count) {
+    struct flv_fingerprint_header header;
+    flv_gop_t *list = NULL;
+    size_t n = 0;
+    size_t cap = 0;
+    int ret = -1;
+
+    FILE *in = fopen(path, "rb");
+    if (!in) {
+        return -1;
+    }
+    if (fread(&header, sizeof(header), 1, in) != 1 ||
+        memcmp(header.magic, flv_fingerprint_magic, sizeof(header.magic)) != 0 ||
+        header.version != FLV_FINGERPRINT_VERSION ||
+        header.bom != FLV_FINGERPRINT_BOM) {
+        goto out;
+    }
+
+    for (;;) {
+        if (cap - n < FLV_FINGERPRINT_READ_GOPS) {
+            size_t cap2 = cap ? cap * 2 : FLV_FINGERPRINT_READ_GOPS;
+            flv_gop_t *grown = realloc(list, cap2 * sizeof(flv_gop_t));
+            if (!grown) {
+                goto out;
+            }
+            list = grown;
+            cap = cap2;
+        }
+        size_t bytes = fread(list + n, 1, FLV_FINGERPRINT_READ_GOPS * sizeof(flv_gop_t), in);
+        if (bytes % sizeof(flv_gop_t) != 0) {
+            goto out; // a partial record
+        }
+        n += bytes / sizeof(flv_gop_t);
+        if (bytes < FLV_FINGERPRINT_READ_GOPS * sizeof(flv_gop_t)) {
+            break;
+        }
+    }
+    if (ferror(in)) {
+        goto out;
+    }
+    ret = 0;
+
+out:
+    fclose(in);
+    if (ret < 0) {
+        free(list);
+        list = NULL;
+        n = 0;
+    }
+    *gops = list;
+    *count = n;
+    return ret;
+}
+
+struct overlap_entry {
+    uint64_t fingerprint;
+    uint32_t file;
+    uint32_t gop;
+};
+
+struct overlap_match {
+    uint32_t file_a;
+    uint32_t file_b;
+    uint32_t gop_a;
+    uint32_t gop_b;
+};
+
+static int by_fingerprint(const void *pa, const void *pb) {
+    const struct overlap_entry *a = pa;
+    const struct overlap_entry *b = pb;
+
+    if (a->fingerprint != b->fingerprint) {
+        return a->fingerprint < b->fingerprint ? -1 : 1;
+    }
+    if (a->file != b->file) {
+        return a->file < b->file ? -1 : 1;
+    }
+    return (a->gop > b->gop) - (a->gop < b->gop);
+}
+
+/*
+ * @brief order matches so that runs of consecutive GOPs on both sides are adjacent
+ */
+static int by_diagonal(const void *pa, const void *pb) {
+    const struct overlap_match *a = pa;
+    const struct overlap_match *b = pb;
+    int64_t diag_a = (int64_t) a->gop_b - a->gop_a;
+    int64_t diag_b = (int64_t) b->gop_b - b->gop_a;
+
+    if (a->file_a != b->file_a) {
+        return a->file_a < b->file_a ? -1 : 1;
+    }
+    if (a->file_b != b->file_b) {
+        return a->file_b < b->file_b ? -1 : 1;
+    }
+    if (diag_a != diag_b) {
+        return diag_a < diag_b ? -1 : 1;
+    }
+    return (a->gop_a > b->gop_a) - (a->gop_a < b->gop_a);
+}
+
+static void print_side(FILE *out, const char *path, const flv_gop_t *gops, uint32_t first, uint32_t last) {
+    fprintf(out, "%s GOPs %" PRIu32 "-%" PRIu32 " (%" PRIu64 "-%" PRIu64 " ms)", path, first, last,
+            gops[first].time, gops[last].time + gops[last].duration);
+}
+
+/*
+ * @brief report the runs of GOPs that fingerprint files have in common
+ *
+ * The GOPs of all files are sorted by fingerprint; equal fingerprints in
+ * different files are matches, and matches that continue GOP after GOP on
+ * both sides merge into one run.
+ */
+int flv_overlap(int count, char **paths, FILE *out) {
+    flv_gop_t **gops = calloc(count, sizeof(flv_gop_t *));
+    size_t *gop_counts = calloc(count, sizeof(size_t));
+    struct overlap_entry *entries = NULL;
+    struct overlap_match *matches = NULL;
+    size_t total = 0;
+    size_t match_count = 0;
+    size_t match_cap = 0;
+    size_t common = 0;
+    size_t runs = 0;
+    int failed = 0;
+
+    if (!gops || !gop_counts) {
+        failed = 1;
+        goto out;
+    }
+    for (int i = 0; i < count; i++) {
+        if (flv_fingerprint_load(paths[i], &gops[i], &gop_counts[i]) < 0) {
+            fprintf(out, "%s: not a fingerprint file\n", paths[i]);
+            failed++;
+        }
+        total += gop_counts[i];
+    }
+
+    entries = malloc((total ? total : 1) * sizeof(struct overlap_entry));
+    if (!entries) {
+        failed++;
+        goto out;
+    }
+    size_t k = 0;
+    for (int i = 0; i < count; i++) {
+        for (size_t g = 0; g < gop_counts[i]; g++) {
+            entries[k].fingerprint = gops[i][g].fingerprint;
+            entries[k].file = (uint32_t) i;
+            entries[k].gop = (uint32_t) g;
+            k++;
+        }
+    }
+    qsort(entries, total, sizeof(struct overlap_entry), by_fingerprint);
+
+    for (size_t i = 0, j; i < total; i = j) {
+        for (j = i + 1; j < total && entries[j].fingerprint == entries[i].fingerprint; j++) {
+        }
+        if (j - i > OVERLAP_MAX_GROUP) {
+            common++;
+            continue;
+        }
+        for (size_t a = i; a < j; a++) {
+            for (size_t b = a + 1; b < j; b++) {
+                if (entries[a].file == entries[b].file) {
+                    continue;
+                }
+                if (match_count == match_cap) {
+                    match_cap = match_cap ? match_cap * 2 : 1024;
+                    struct overlap_match *grown = realloc(matches, match_cap * sizeof(struct overlap_match));
+                    if (!grown) {
+                        failed++;
+                        goto out;
+                    }
+                    matches = grown;
+                }
+                matches[match_count].file_a = entries[a].file;
+                matches[match_count].file_b = entries[b].file;
+                matches[match_count].gop_a = entries[a].gop;
+                matches[match_count].gop_b = entries[b].gop;
+                match_count++;
+            }
+        }
+    }
+    qsort(matches, match_count, sizeof(struct overlap_match), by_diagonal);
+
+    for (size_t i = 0, j; i < match_count; i = j) {
+        const struct overlap_match *m = &matches[i];
+        for (j = i + 1; j < match_count &&
+                        matches[j].file_a == m->file_a && matches[j].file_b == m->file_b &&
+                        matches[j].gop_a == matches[j - 1].gop_a + 1 &&
+                        matches[j].gop_b == matches[j - 1].gop_b + 1; j++) {
+        }
+        uint32_t len = (uint32_t) (j - i);
+        print_side(out, paths[m->file_a], gops[m->file_a], m->gop_a, m->gop_a + len - 1);
+        fprintf(out, " = ");
+        print_side(out, paths[m->file_b], gops[m->file_b], m->gop_b, m->gop_b + len - 1);
+        fprintf(out, ": %" PRIu32 " GOPs\n", len);
+        runs++;
+    }
+    fprintf(out, "%zu GOPs in %d files, %zu runs in common, %zu fingerprints too common to count\n",
+            total, count, runs, common);
+
+out:
+    for (int i = 0; gops && i < count; i++) {
+        free(gops[i]);
+    }
+    free(gops);
+    free(gop_counts);
+    free(entries);
+    free(matches);
+    return failed ? -1 : 0;
+}
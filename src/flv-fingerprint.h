@@ -0,0 +1,65 @@
+/*
+ * @file flv-fingerprint.h
+ *
+ * GOP fingerprints for finding the same content in different recordings
+ * without decoding it. Every video payload gets a CRC32C; the CRCs and
+ * sizes of the frames from one keyframe up to the next fold into a 64-bit
+ * fingerprint of that GOP. Timestamps, audio and codec configuration stay
+ * out of it, so two captures of one stream that started at different times
+ * agree on every GOP they share.
+ *
+ * File layout (host byte order, checked on open):
+ *   header: "FLVF", version, byte order mark 0x01020304, 0
+ *   records: flv_gop_t, one per GOP in stream order
+ */
+
+#ifndef FLV_FINGERPRINT_H_
+#define FLV_FINGERPRINT_H_ (1)
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "flv-hash.h"
+#include "flv-parser.h"
+
+typedef struct flv_gop {
+    uint64_t fingerprint;
+    uint64_t offset;   // of the keyframe tag
+    uint64_t time;     // ms, DTS of the keyframe
+    uint32_t duration; // ms, to the next keyframe or the last frame
+    uint32_t frames;
+} flv_gop_t;
+
+/*
+ * @brief fingerprint writer, also the visitor state
+ */
+typedef struct flv_fingerprint {
+    FILE *out;
+    int error;
+    uint64_t gops;
+    // GOP being built
+    int in_gop;
+    flv_gop_t gop;
+    flv_hash_t hash;
+    uint64_t last_time;
+    // video tag being hashed
+    int keyframe;
+    int skip; // sequence headers and command frames stay out of the GOP
+    uint32_t crc;
+} flv_fingerprint_t;
+
+/*
+ * @brief visitor that fingerprints the GOPs, pass the flv_fingerprint_t as the opaque
+ */
+extern const flv_visitor_t flv_fingerprint_visitor;
+
+int flv_fingerprint_open(flv_fingerprint_t *fp, const char *path);
+
+int flv_fingerprint_close(flv_fingerprint_t *fp);
+
+int flv_fingerprint_load(const char *path, flv_gop_t **gops, size_t *count);
+
+int flv_overlap(int count, char **paths, FILE *out);
+
+#endif // FLV_FINGERPRINT_H_
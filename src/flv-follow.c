@@ -0,0 +1,173 @@
+/*
+ * @file flv-follow.c
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include "flv-follow.h"
+
+#define FOLLOW_EVENTS (IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF)
+
+static volatile sig_atomic_t g_follow_stop;
+
+void flv_follow_stop(void) {
+    g_follow_stop = 1;
+}
+
+static void follow_signal_handler(int signo) {
+    (void) signo;
+    g_follow_stop = 1;
+}
+
+/*
+ * @brief feed everything appended since the last call
+ * @return FLV_OK to keep following, otherwise how the parse ended
+ */
+static int drain(flv_parser_t *parser, int fd, uint8_t *buf, size_t buf_size, int *got_data) {
+    for (;;) {
+        ssize_t n = read(fd, buf, buf_size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return FLV_ERROR;
+        }
+        if (n == 0) {
+            return FLV_OK; // caught up with the writer
+        }
+        *got_data = 1;
+        FLV_STATS_ADD(&parser->stats, read_calls, 1);
+        FLV_STATS_ADD(&parser->stats, bytes_read, n);
+
+        int ret = flv_parser_feed(parser, buf, n);
+        if (ret != FLV_OK) {
+            return ret;
+        }
+    }
+}
+
+/*
+ * @brief parse path as it grows, until it is removed, idles out or a stop is requested
+ */
+int flv_follow(flv_parser_t *parser, const char *path, const flv_follow_opts_t *in_opts) {
+    flv_follow_opts_t opts = *in_opts;
+    int ret = FLV_ERROR;
+    int fd = -1;
+    int in_fd = -1;
+    uint8_t *buf = NULL;
+    int gone = 0;
+
+    if (!opts.buffer_size) {
+        opts.buffer_size = 64 * 1024;
+    }
+
+    // no SA_RESTART, poll() has to return to see the flag
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = follow_signal_handler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    buf = malloc(opts.buffer_size);
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    in_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (!buf || fd < 0 || in_fd < 0 || inotify_add_watch(in_fd, path, FOLLOW_EVENTS) < 0) {
+        goto out;
+    }
+
+    off_t offset = 0;
+    int idle_ms = 0;
+    ret = FLV_OK;
+
+    while (ret == FLV_OK && !g_follow_stop) {
+        int got_data = 0;
+        ret = drain(parser, fd, buf, opts.buffer_size, &got_data);
+        if (ret != FLV_OK) {
+            break;
+        }
+        offset = lseek(fd, 0, SEEK_CUR);
+        idle_ms = got_data ? 0 : idle_ms;
+
+        if (parser->stats_out && flv_stats_signaled()) {
+            flv_stats_print(&parser->stats, parser->stats_out);
+        }
+        if (gone) {
+            break; // removed or renamed away, and everything it held is parsed
+        }
+
+        // wait for the writer; the timeout only counts idle time
+        int timeout = -1;
+        if (opts.idle_timeout > 0) {
+            timeout = opts.idle_timeout * 1000 - idle_ms;
+            if (timeout <= 0) {
+                break;
+            }
+        }
+        struct pollfd pfd = {in_fd, POLLIN, 0};
+        int n = poll(&pfd, 1, timeout);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ret = FLV_ERROR;
+            break;
+        }
+        if (n == 0) {
+            idle_ms += timeout;
+            continue;
+        }
+
+        char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+        ssize_t len;
+        while ((len = read(in_fd, events, sizeof(events))) > 0) {
+            for (char *p = events; p < events + len; ) {
+                const struct inotify_event *ev = (const struct inotify_event *) p;
+                if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                    gone = 1;
+                }
+                p += sizeof(struct inotify_event) + ev->len;
+            }
+        }
+
+        // our open fd keeps an unlinked file alive, so deletion shows up as IN_ATTRIB
+        struct stat st;
+        if (fstat(fd, &st) == 0) {
+            if (st.st_nlink == 0) {
+                gone = 1;
+            }
+            // truncated underneath us: what we parsed no longer exists
+            if (st.st_size < offset) {
+                ret = FLV_ERROR;
+            }
+        }
+    }
+
+    if (ret == FLV_OK) {
+        ret = flv_parser_finish(parser);
+        // a tag still being written when we were told to stop is not an error
+        if (ret == FLV_ERROR && !gone) {
+            ret = FLV_STOP;
+        }
+    }
+
+out:
+    if (in_fd >= 0) {
+        close(in_fd);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    free(buf);
+    return ret;
+}
@@ -0,0 +1,25 @@
+/*
+ * @file flv-follow.h
+ *
+ * Tail-follow a recording that is still being written: wait on inotify,
+ * read only the bytes appended since the last wakeup and push them into the
+ * parser, which holds back a partial tag until the rest arrives.
+ */
+
+#ifndef FLV_FOLLOW_H_
+#define FLV_FOLLOW_H_ (1)
+
+#include <stddef.h>
+
+#include "flv-parser.h"
+
+typedef struct flv_follow_opts {
+    size_t buffer_size; // bytes per read, default 64 KiB
+    int idle_timeout;   // seconds without new data before giving up, 0 to wait forever
+} flv_follow_opts_t;
+
+int flv_follow(flv_parser_t *parser, const char *path, const flv_follow_opts_t *opts);
+
+void flv_follow_stop(void);
+
+#endif // FLV_FOLLOW_H_
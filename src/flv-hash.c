@@ -0,0 +1,229 @@
+/*
+ * @file flv-hash.c
+ */
+
+#include <pthread.h>
+#include <string.h>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#include "flv-hash.h"
+
+#define PRIME1 UINT64_C(0x9E3779B185EBCA87)
+#define PRIME2 UINT64_C(0xC2B2AE3D27D4EB4F)
+#define PRIME3 UINT64_C(0x165667B19E3779F9)
+#define PRIME4 UINT64_C(0x85EBCA77C2B2AE63)
+#define PRIME5 UINT64_C(0x27D4EB2F165667C5)
+
+static inline uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static inline uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+static inline uint64_t round64(uint64_t acc, uint64_t input) {
+    acc += input * PRIME2;
+    acc = rotl(acc, 31);
+    return acc * PRIME1;
+}
+
+static inline uint64_t merge_round(uint64_t acc, uint64_t val) {
+    acc ^= round64(0, val);
+    return acc * PRIME1 + PRIME4;
+}
+
+/*
+ * @brief fold whole 32-byte stripes into the accumulators
+ * @return bytes consumed
+ */
+static size_t stripes(uint64_t *v, const uint8_t *p, size_t size) {
+    uint64_t v1 = v[0], v2 = v[1], v3 = v[2], v4 = v[3];
+    size_t done = 0;
+
+    for (; size - done >= 32; done += 32) {
+        v1 = round64(v1, read64(p + done));
+        v2 = round64(v2, read64(p + done + 8));
+        v3 = round64(v3, read64(p + done + 16));
+        v4 = round64(v4, read64(p + done + 24));
+    }
+    v[0] = v1;
+    v[1] = v2;
+    v[2] = v3;
+    v[3] = v4;
+    return done;
+}
+
+void flv_hash_init(flv_hash_t *hash, uint64_t seed) {
+    memset(hash, 0, sizeof(*hash));
+    hash->seed = seed;
+    hash->v[0] = seed + PRIME1 + PRIME2;
+    hash->v[1] = seed + PRIME2;
+    hash->v[2] = seed;
+    hash->v[3] = seed - PRIME1;
+}
+
+void flv_hash_update(flv_hash_t *hash, const void *data, size_t size) {
+    const uint8_t *p = data;
+
+    hash->total += size;
+
+    // top up a partial stripe first
+    if (hash->mem_size) {
+        size_t n = sizeof(hash->mem) - hash->mem_size;
+        if (n > size) {
+            n = size;
+        }
+        memcpy(hash->mem + hash->mem_size, p, n);
+        hash->mem_size += n;
+        p += n;
+        size -= n;
+        if (hash->mem_size < sizeof(hash->mem)) {
+            return;
+        }
+        stripes(hash->v, hash->mem, sizeof(hash->mem));
+        hash->mem_size = 0;
+    }
+
+    size_t done = stripes(hash->v, p, size);
+    if (done < size) {
+        memcpy(hash->mem, p + done, size - done);
+        hash->mem_size = size - done;
+    }
+}
+
+uint64_t flv_hash_digest(const flv_hash_t *hash) {
+    const uint8_t *p = hash->mem;
+    const uint8_t *end = hash->mem + hash->mem_size;
+    uint64_t h;
+
+    if (hash->total >= 32) {
+        h = rotl(hash->v[0], 1) + rotl(hash->v[1], 7) + rotl(hash->v[2], 12) + rotl(hash->v[3], 18);
+        for (int i = 0; i < 4; i++) {
+            h = merge_round(h, hash->v[i]);
+        }
+    } else {
+        h = hash->seed + PRIME5;
+    }
+    h += hash->total;
+
+    for (; end - p >= 8; p += 8) {
+        h ^= round64(0, read64(p));
+        h = rotl(h, 27) * PRIME1 + PRIME4;
+    }
+    if (end - p >= 4) {
+        h ^= (uint64_t) read32(p) * PRIME1;
+        h = rotl(h, 23) * PRIME2 + PRIME3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h ^= *p * PRIME5;
+        h = rotl(h, 11) * PRIME1;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+/*
+ * @brief hash of one buffer
+ */
+uint64_t flv_hash(const void *data, size_t size, uint64_t seed) {
+    flv_hash_t hash;
+
+    flv_hash_init(&hash, seed);
+    flv_hash_update(&hash, data, size);
+    return flv_hash_digest(&hash);
+}
+
+#define CRC32C_POLY (0x82F63B78) // reflected
+
+static uint32_t crc32c_table[8][256];
+
+static uint32_t (*crc32c_impl)(uint32_t crc, const uint8_t *p, size_t size);
+
+/*
+ * @brief slicing-by-8: eight bytes per step through eight tables
+ */
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t *p, size_t size) {
+    for (; size >= 8; p += 8, size -= 8) {
+        uint32_t lo = crc ^ (p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24));
+        crc = crc32c_table[7][lo & 0xff] ^ crc32c_table[6][(lo >> 8) & 0xff] ^
+              crc32c_table[5][(lo >> 16) & 0xff] ^ crc32c_table[4][lo >> 24] ^
+              crc32c_table[3][p[4]] ^ crc32c_table[2][p[5]] ^
+              crc32c_table[1][p[6]] ^ crc32c_table[0][p[7]];
+    }
+    for (; size > 0; p++, size--) {
+        crc = crc32c_table[0][(crc ^ *p) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t *p, size_t size) {
+    uint64_t crc64 = crc;
+
+    for (; size > 0 && ((uintptr_t) p & 7); p++, size--) {
+        crc64 = _mm_crc32_u8((uint32_t) crc64, *p);
+    }
+    for (; size >= 8; p += 8, size -= 8) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    for (; size > 0; p++, size--) {
+        crc64 = _mm_crc32_u8((uint32_t) crc64, *p);
+    }
+    return (uint32_t) crc64;
+}
+#endif
+
+static void crc32c_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLY : 0);
+        }
+        crc32c_table[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        for (int t = 1; t < 8; t++) {
+            crc32c_table[t][i] = crc32c_table[0][crc32c_table[t - 1][i] & 0xff] ^ (crc32c_table[t - 1][i] >> 8);
+        }
+    }
+
+    crc32c_impl = crc32c_sw;
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2")) {
+        crc32c_impl = crc32c_sse42;
+    }
+#endif
+}
+
+uint32_t flv_crc32c(uint32_t crc, const void *data, size_t size) {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+    pthread_once(&once, crc32c_init);
+    return ~crc32c_impl(~crc, data, size);
+}
@@ -0,0 +1,37 @@
+/*
+ * @file flv-hash.h
+ *
+ * Streaming 64-bit hash (XXH64): data may arrive in pieces of any size and
+ * hashes the same as in one piece. Input is read as little-endian words, so
+ * digests agree across hosts.
+ *
+ * CRC32C (Castagnoli), with the SSE4.2 crc32 instruction when the CPU has
+ * it and a table-driven fallback otherwise. Pass the previous result to
+ * continue a CRC over the next piece, 0 to start one.
+ */
+
+#ifndef FLV_HASH_H_
+#define FLV_HASH_H_ (1)
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct flv_hash {
+    uint64_t v[4];
+    uint64_t total;
+    uint8_t mem[32]; // bytes short of a 32-byte stripe
+    uint32_t mem_size;
+    uint64_t seed;
+} flv_hash_t;
+
+void flv_hash_init(flv_hash_t *hash, uint64_t seed);
+
+void flv_hash_update(flv_hash_t *hash, const void *data, size_t size);
+
+uint64_t flv_hash_digest(const flv_hash_t *hash);
+
+uint64_t flv_hash(const void *data, size_t size, uint64_t seed);
+
+uint32_t flv_crc32c(uint32_t crc, const void *data, size_t size);
+
+#endif // FLV_HASH_H_
@@ -0,0 +1,241 @@
+/*
+ * @file flv-index.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "flv-index.h"
+
+/*
+ * onMetaData record layout, host byte order:
+ *   depth (u32), type (u8), name length (u16), name, then by type
+ *   Number: double; Date: double, offset (i16); Boolean: u8;
+ *   String, Long string: length (u32), bytes; ECMA array: items (u32), size (u32);
+ *   Strict array: items (u32); nothing for the others
+ */
+
+static const char on_metadata[] = "onMetaData";
+
+static int grow(void **ptr, size_t *cap, size_t need, size_t elem) {
+    if (need <= *cap) {
+        return 0;
+    }
+    size_t cap2 = *cap ? *cap * 2 : 64;
+    while (cap2 < need) {
+        cap2 *= 2;
+    }
+    void *p = realloc(*ptr, cap2 * elem);
+    if (!p) {
+        return -1;
+    }
+    *ptr = p;
+    *cap = cap2;
+    return 0;
+}
+
+static void put(uint8_t **p, const void *data, size_t size) {
+    if (size) {
+        memcpy(*p, data, size);
+        *p += size;
+    }
+}
+
+static int append_metadata(flv_index_t *index, const flv_script_value_t *value) {
+    size_t size = 4 + 1 + 2 + value->name_len + 8 + 2 + 4 + 4 + value->string_len;
+    if (grow((void **) &index->metadata, &index->metadata_cap, index->metadata_size + size, 1) < 0) {
+        return -1;
+    }
+
+    uint8_t *p = index->metadata + index->metadata_size;
+    put(&p, &value->depth, 4);
+    put(&p, &value->type, 1);
+    put(&p, &value->name_len, 2);
+    put(&p, value->name, value->name_len);
+    switch (value->type) {
+        case SCRIPTDATA_NUMBER:
+            put(&p, &value->number, 8);
+            break;
+        case SCRIPTDATA_DATE:
+            put(&p, &value->number, 8);
+            put(&p, &value->date_offset, 2);
+            break;
+        case SCRIPTDATA_BOOLEAN:
+            put(&p, &value->boolean, 1);
+            break;
+        case SCRIPTDATA_STRING:
+        case SCRIPTDATA_LONG_STRING:
+            put(&p, &value->string_len, 4);
+            put(&p, value->string, value->string_len);
+            break;
+        case SCRIPTDATA_ECMA_ARRAY:
+            put(&p, &value->items, 4);
+            put(&p, &value->size, 4);
+            break;
+        case SCRIPTDATA_STRICT_ARRAY:
+            put(&p, &value->items, 4);
+            break;
+    }
+    index->metadata_size = p - index->metadata;
+    return 0;
+}
+
+static int get(const uint8_t **p, const uint8_t *end, void *data, size_t size) {
+    if ((size_t) (end - *p) < size) {
+        return -1;
+    }
+    memcpy(data, *p, size);
+    *p += size;
+    return 0;
+}
+
+/*
+ * @brief decode the next onMetaData record, strings point into the index
+ * @return 1 with a value, 0 at the end, -1 on a damaged record
+ */
+int flv_index_metadata_next(const flv_index_t *index, size_t *pos, flv_script_value_t *value) {
+    const uint8_t *p = index->metadata + *pos;
+    const uint8_t *end = index->metadata + index->metadata_size;
+
+    if (p == end) {
+        return 0;
+    }
+    memset(value, 0, sizeof(*value));
+    if (get(&p, end, &value->depth, 4) < 0 ||
+        get(&p, end, &value->type, 1) < 0 ||
+        get(&p, end, &value->name_len, 2) < 0 ||
+        (size_t) (end - p) < value->name_len) {
+        return -1;
+    }
+    value->name = (const char *) p;
+    p += value->name_len;
+
+    int ret = 0;
+    switch (value->type) {
+        case SCRIPTDATA_NUMBER:
+            ret = get(&p, end, &value->number, 8);
+            break;
+        case SCRIPTDATA_DATE:
+            ret = get(&p, end, &value->number, 8) | get(&p, end, &value->date_offset, 2);
+            break;
+        case SCRIPTDATA_BOOLEAN:
+            ret = get(&p, end, &value->boolean, 1);
+            break;
+        case SCRIPTDATA_STRING:
+        case SCRIPTDATA_LONG_STRING:
+            ret = get(&p, end, &value->string_len, 4);
+            if (ret == 0 && (size_t) (end - p) < value->string_len) {
+                ret = -1;
+            }
+            value->string = (const char *) p;
+            p += ret == 0 ? value->string_len : 0;
+            break;
+        case SCRIPTDATA_ECMA_ARRAY:
+            ret = get(&p, end, &value->items, 4) | get(&p, end, &value->size, 4);
+            break;
+        case SCRIPTDATA_STRICT_ARRAY:
+            ret = get(&p, end, &value->items, 4);
+            break;
+    }
+    if (ret < 0) {
+        return -1;
+    }
+    *pos = p - index->metadata;
+    return 1;
+}
+
+static int index_tag_header(void *opaque, const flv_tag_t *tag) {
+    flv_index_t *index = opaque;
+
+    index->in_metadata = 0;
+    return flv_summary_visitor.on_tag_header(&index->summary, tag);
+}
+
+static int index_video(void *opaque, const flv_tag_t *tag, const video_tag_t *video) {
+    flv_index_t *index = opaque;
+
+    if (video->frame_type == 1 && flv_index_add_keyframe(index, tag->offset, tag->time) < 0) {
+        index->error = 1;
+        return -1;
+    }
+    return flv_summary_visitor.on_video(&index->summary, tag, video);
+}
+
+static int index_script_value(void *opaque, const flv_tag_t *tag, const flv_script_value_t *value) {
+    flv_index_t *index = opaque;
+    (void) tag;
+
+    if (value->depth == 0 && value->type == SCRIPTDATA_STRING) {
+        // a later onMetaData replaces an earlier one
+        index->in_metadata = value->string_len == sizeof(on_metadata) - 1 &&
+                             memcmp(value->string, on_metadata, value->string_len) == 0;
+        if (index->in_metadata) {
+            index->metadata_size = 0;
+        }
+        return 0;
+    }
+    if (index->in_metadata && append_metadata(index, value) < 0) {
+        index->error = 1;
+        return -1;
+    }
+    return 0;
+}
+
+const flv_visitor_t flv_index_visitor = {
+    .on_tag_header = index_tag_header,
+    .on_video = index_video,
+    .on_script_value = index_script_value,
+};
+
+void flv_index_init(flv_index_t *index) {
+    memset(index, 0, sizeof(*index));
+}
+
+void flv_index_free(flv_index_t *index) {
+    free(index->keyframes);
+    free(index->metadata);
+    memset(index, 0, sizeof(*index));
+}
+
+int flv_index_add_keyframe(flv_index_t *index, uint64_t offset, uint64_t time) {
+    if (grow((void **) &index->keyframes, &index->keyframe_cap, index->keyframe_count + 1, sizeof(flv_keyframe_t)) < 0) {
+        return -1;
+    }
+    index->keyframes[index->keyframe_count].offset = offset;
+    index->keyframes[index->keyframe_count].time = time;
+    index->keyframe_count++;
+    return 0;
+}
+
+/*
+ * @brief replace the onMetaData records, as read back from a cache entry
+ */
+int flv_index_set_metadata(flv_index_t *index, const uint8_t *records, size_t size) {
+    index->metadata_size = 0;
+    if (grow((void **) &index->metadata, &index->metadata_cap, size, 1) < 0) {
+        return -1;
+    }
+    if (size) {
+        memcpy(index->metadata, records, size);
+    }
+    index->metadata_size = size;
+    return 0;
+}
+
+/*
+ * @brief summary line, onMetaData in the format of the dump, then the keyframes
+ */
+void flv_print_index(const char *name, const flv_index_t *index) {
+    flv_script_value_t value;
+    size_t pos = 0;
+
+    flv_print_summary(name, &index->summary);
+    while (flv_index_metadata_next(index, &pos, &value) == 1) {
+        flv_print_script_value(&value);
+    }
+    for (size_t i = 0; i < index->keyframe_count; i++) {
+        printf("  keyframe: offset %" PRIu64 " time %" PRIu64 "\n", index->keyframes[i].offset, index->keyframes[i].time);
+    }
+}
@@ -0,0 +1,53 @@
+/*
+ * @file flv-index.h
+ *
+ * What the catalog jobs ask of a file: the summary, the keyframe index and
+ * the decoded onMetaData. Small enough to cache (flv-cache.h).
+ */
+
+#ifndef FLV_INDEX_H_
+#define FLV_INDEX_H_ (1)
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "flv-parser.h"
+#include "flv-print.h"
+
+typedef struct flv_keyframe {
+    uint64_t offset; // of the tag header
+    uint64_t time;   // ms
+} flv_keyframe_t;
+
+/*
+ * @brief index visitor state, pass it as the visitor opaque
+ *
+ * The onMetaData values are kept as packed records, see flv-index.c.
+ */
+typedef struct flv_index {
+    flv_summary_t summary;
+    flv_keyframe_t *keyframes;
+    size_t keyframe_count;
+    size_t keyframe_cap;
+    uint8_t *metadata;
+    size_t metadata_size;
+    size_t metadata_cap;
+    int in_metadata; // inside the onMetaData tag
+    int error;       // out of memory
+} flv_index_t;
+
+extern const flv_visitor_t flv_index_visitor;
+
+void flv_index_init(flv_index_t *index);
+
+void flv_index_free(flv_index_t *index);
+
+int flv_index_add_keyframe(flv_index_t *index, uint64_t offset, uint64_t time);
+
+int flv_index_set_metadata(flv_index_t *index, const uint8_t *records, size_t size);
+
+int flv_index_metadata_next(const flv_index_t *index, size_t *pos, flv_script_value_t *value);
+
+void flv_print_index(const char *name, const flv_index_t *index);
+
+#endif // FLV_INDEX_H_
@@ -0,0 +1,32 @@
+/*
+ * @file flv-log.h
+ *
+ * lwlog-style leveled output for the dump visitor.
+ * LOG_LEVEL is the compile-time ceiling: anything above it is dead code and
+ * its formatting (and argument evaluation) is stripped from the build.
+ * flv_log_level is the runtime level on top of it.
+ */
+
+#ifndef FLV_LOG_H_
+#define FLV_LOG_H_ (1)
+
+#include <stdio.h>
+
+#include "lwlog/lwlog.h"
+
+extern int flv_log_level; // set with flv_set_log_level()
+
+#define FLV_LOG_ENABLED(level) ((level) <= LOG_LEVEL && (level) <= flv_log_level)
+
+#define flv_log(level, M, ...) do { \
+    if (FLV_LOG_ENABLED(level)) { \
+        printf(M, ##__VA_ARGS__); \
+    } \
+} while (0)
+
+#define flv_log_err(M, ...)    flv_log(ERR, M, ##__VA_ARGS__)
+#define flv_log_notice(M, ...) flv_log(NOTICE, M, ##__VA_ARGS__)
+#define flv_log_info(M, ...)   flv_log(INFO, M, ##__VA_ARGS__)
+#define flv_log_debug(M, ...)  flv_log(DEBUG, M, ##__VA_ARGS__)
+
+#endif // FLV_LOG_H_
@@ -4,12 +4,12 @@
  * @date 2015/02/04
  */
 
-#define _POSIX_C_SOURCE 1
+#define _POSIX_C_SOURCE 200112L
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
-#include <time.h>
 #include <inttypes.h>
+#include <unistd.h>
 #include <arpa/inet.h>
 
 #include "flv-parser.h"
@@ -17,194 +17,183 @@
 // File-scope ("global") variables
 const char *flv_signature = "FLV";
 
-enum scriptdata_value_types {
-    SCRIPTDATA_NUMBER,
-    SCRIPTDATA_BOOLEAN,
-    SCRIPTDATA_STRING,
-    SCRIPTDATA_OBJECT,
-    SCRIPTDATA_MOVIE_CLIP,
-    SCRIPTDATA_NULL,
-    SCRIPTDATA_UNDEFINED,
-    SCRIPTDATA_REFERENCE,
-    SCRIPTDATA_ECMA_ARRAY,
-    SCRIPTDATA_OBJECT_END_MARKER,
-    SCRIPTDATA_STRICT_ARRAY,
-    SCRIPTDATA_DATE,
-    SCRIPTDATA_LONG_STRING,
-};
-const char *scriptdata_value_type_names[] = {
-    "Number",       // DOUBLE
-    "Boolean",      // UI8
-    "String",       // SCRIPTDATASTRING:      {Length UI16, Data STRING(no terminating NUL)}
-    "Object",       // SCRIPTDATAOBJECT       {Properties, List Terminator}
-    "MovieClip",    // (reserved, not supported)
-    "Null",
-    "Undefined",
-    "Reference",    // UI16
-    "ECMA array",   // SCRIPTDATAECMAARRAY    {Length UI32, Variables, List Terminator}
-    "Object end marker",
-    "Strict array", // SCRIPTDATASTRICTARRAY: {Length UI32, Value SCRIPTDATAVALUE[Length]}
-    "Date",         // SCRIPTDATADATE:        {DateTime DOUBLE, LocalDateTimeOffset SI16}
-    "Long string",  // SCRIPTDATALONGSTRING:  {Length UI32, Data STRING(no terminating NUL)}
-};
-
-const char *sound_formats[] = {
-        "Linear PCM, platform endian",
-        "ADPCM",
-        "MP3",
-        "Linear PCM, little endian",
-        "Nellymoser 16-kHz mono",
-        "Nellymoser 8-kHz mono",
-        "Nellymoser",
-        "G.711 A-law logarithmic PCM",
-        "G.711 mu-law logarithmic PCM",
-        "not defined by standard",
-        "AAC",
-        "Speex",
-        "not defined by standard",
-        "not defined by standard",
-        "MP3 8-Khz",
-        "Device-specific sound"
-};
-
-const char *sound_rates[] = {
-        "5.5-Khz",
-        "11-Khz",
-        "22-Khz",
-        "44-Khz"
-};
-
-const char *sound_sizes[] = {
-        "8 bit",
-        "16 bit"
-};
-
-const char *sound_types[] = {
-        "Mono",
-        "Stereo"
-};
-
-const char *frame_types[] = {
-        "not defined by standard",
-        "keyframe (for AVC, a seekable frame)",
-        "inter frame (for AVC, a non-seekable frame)",
-        "disposable inter frame (H.263 only)",
-        "generated keyframe (reserved for server use only)",
-        "video info/command frame"
-};
-
-const char *codec_ids[] = {
-        "not defined by standard",
-        "JPEG (currently unused)",
-        "Sorenson H.263",
-        "Screen video",
-        "On2 VP6",
-        "On2 VP6 with alpha channel",
-        "Screen video version 2",
-        "AVC"
-};
-
-const char *avc_packet_types[] = {
-        "AVC sequence header",
-        "AVC NALU",
-        "AVC end of sequence (lower level NALU sequence ender is not required or supported)"
-};
+/*
+ * @brief call a visitor callback if set, charging its time to the output stage
+ */
+#define FLV_VISIT(ret, parser, cb, ...) do { \
+    if ((parser)->visitor->cb) { \
+        int visit_stage_ = FLV_STATS_ENTER(&(parser)->stats, FLV_STAGE_OUTPUT); \
+        ret = (parser)->visitor->cb((parser)->opaque, __VA_ARGS__) ? FLV_STOP : FLV_OK; \
+        FLV_STATS_ENTER(&(parser)->stats, visit_stage_); \
+    } \
+} while (0)
 
-static FILE *g_infile;
-static int g_v_count;
-static int g_a_count;
-
-void die(void) {
-    if (g_infile) {
-        fpos_t pos;
-        fgetpos(g_infile, &pos);
-        printf("Error at ");
-        for (size_t i = 0; i < sizeof(pos); i++) {
-            printf("%02X", ((unsigned char *)&pos)[i]);
+/*
+ * @brief the memory behind the visitor's views is about to be reused
+ */
+static void flv_release_views(flv_parser_t *parser) {
+    if (parser->views_out) {
+        parser->views_out = 0;
+        if (parser->visitor->on_release) {
+            int stage = FLV_STATS_ENTER(&parser->stats, FLV_STAGE_OUTPUT);
+            parser->visitor->on_release(parser->opaque);
+            FLV_STATS_ENTER(&parser->stats, stage);
         }
-        printf("!\n");
-    } else {
-        printf("Error!\n");
     }
-
-    exit(-1);
 }
 
 /*
- * @brief read bits from 1 byte
- * @param[in] value: 1 byte to analysize
- * @param[in] start_bit: start from the low bit side
- * @param[in] count: number of bits
+ * @brief realloc() accounted in the parser stats
  */
-uint8_t flv_get_bits(uint8_t value, uint8_t start_bit, uint8_t count) {
-    uint8_t mask = 0;
+static void *flv_realloc(flv_parser_t *parser, void *ptr, size_t size) {
+    FLV_STATS_ADD(&parser->stats, allocs, 1);
+    FLV_STATS_ADD(&parser->stats, alloc_bytes, size);
+    return realloc(ptr, size);
+}
 
-    mask = (uint8_t) (((1 << count) - 1) << start_bit);
-    return (mask & value) >> start_bit;
+/*
+ * @brief move the reads the reader made into the parser stats
+ */
+static void flv_account_reads(flv_parser_t *parser) {
+    FLV_STATS_ADD(&parser->stats, read_calls, parser->reader.read_calls);
+    FLV_STATS_ADD(&parser->stats, bytes_read, parser->reader.bytes_read);
+    parser->reader.read_calls = 0;
+    parser->reader.bytes_read = 0;
+}
 
+/*
+ * @brief the reader over the input, built on the first read
+ *
+ * The descriptor starts where stdio says the FILE is, so a FILE that was
+ * positioned with fseek() is read on from there.
+ */
+static flv_reader_t *flv_input(flv_parser_t *parser) {
+    flv_reader_t *reader = &parser->reader;
+
+    if (!reader->buf) {
+        int fd = fileno(parser->in);
+        off_t pos = ftello(parser->in);
+        if (pos >= 0) {
+            lseek(fd, pos, SEEK_SET);
+        }
+        FLV_STATS_ADD(&parser->stats, allocs, 1);
+        FLV_STATS_ADD(&parser->stats, alloc_bytes, FLV_READER_SIZE);
+        if (flv_reader_init(reader, fd, FLV_READER_SIZE) != 0) {
+            return NULL;
+        }
+    }
+    return reader;
 }
 
-void flv_print_header(flv_header_t *flv_header) {
+/*
+ * @brief size bytes of input at the cursor, at most FLV_READER_SIZE
+ *
+ * The bytes stay put until flv_consume(); refills are charged to the I/O
+ * stage timer.
+ * @return a view valid until the next read, NULL if the input ends first
+ */
+static const uint8_t *flv_need(flv_parser_t *parser, size_t size) {
+    flv_reader_t *reader = &parser->reader;
 
-    printf("FLV file version %u\n", flv_header->version);
-    printf("  Contains audio tags: ");
-    if (flv_header->type_flags & (1 << FLV_HEADER_AUDIO_BIT)) {
-        printf("Yes\n");
-    } else {
-        printf("No\n");
+    if (flv_reader_avail(reader) >= size) {
+        return reader->buf + reader->pos;
     }
-    printf("  Contains video tags: ");
-    if (flv_header->type_flags & (1 << FLV_HEADER_VIDEO_BIT)) {
-        printf("Yes\n");
-    } else {
-        printf("No\n");
+    reader = flv_input(parser);
+    if (!reader) {
+        return NULL;
     }
-    printf("  Data offset: %lu\n", (unsigned long) flv_header->data_offset);
+    flv_release_views(parser);
+    int stage = FLV_STATS_ENTER(&parser->stats, FLV_STAGE_IO);
+    const uint8_t *bytes = flv_reader_need(reader, size);
+    FLV_STATS_ENTER(&parser->stats, stage);
+    flv_account_reads(parser);
+    return bytes;
+}
 
-    return;
+static void flv_consume(flv_parser_t *parser, size_t size) {
+    flv_reader_consume(&parser->reader, size);
+    parser->offset += size;
 }
 
-size_t fread_1(uint8_t *ptr) {
-    assert(NULL != ptr);
-    return fread(ptr, 1, 1, g_infile);
+/*
+ * @brief copy size bytes of input out, for payloads too large to view
+ * @return bytes copied, fewer than size at the end of the input
+ */
+static size_t flv_fread(flv_parser_t *parser, void *ptr, size_t size) {
+    flv_reader_t *reader = flv_input(parser);
+
+    if (!reader) {
+        return 0;
+    }
+    flv_release_views(parser);
+    int stage = FLV_STATS_ENTER(&parser->stats, FLV_STAGE_IO);
+    size_t count = flv_reader_read(reader, ptr, size);
+    FLV_STATS_ENTER(&parser->stats, stage);
+    flv_account_reads(parser);
+    parser->offset += count;
+    return count;
 }
 
-size_t fread_3(uint32_t *ptr) {
-    assert(NULL != ptr);
-    size_t count = 0;
-    uint8_t bytes[3] = {0};
-    *ptr = 0;
-    count = fread(bytes, 3, 1, g_infile);
-    *ptr = (bytes[0] << 16) | (bytes[1] << 8) | bytes[2];
-    return count * 3;
+/*
+ * @brief pass over size bytes of input, seeking where the input allows
+ */
+static int flv_skip(flv_parser_t *parser, uint32_t size) {
+    flv_reader_t *reader = &parser->reader;
+
+    FLV_STATS_ADD(&parser->stats, bytes_skipped, size);
+    if (flv_reader_avail(reader) >= size) {
+        flv_consume(parser, size);
+        return FLV_OK;
+    }
+    reader = flv_input(parser);
+    if (!reader) {
+        return FLV_ERROR;
+    }
+    flv_release_views(parser);
+    int stage = FLV_STATS_ENTER(&parser->stats, FLV_STAGE_IO);
+    uint64_t done = flv_reader_skip(reader, size);
+    FLV_STATS_ENTER(&parser->stats, stage);
+    flv_account_reads(parser);
+    parser->offset += done;
+    return done == size ? FLV_OK : FLV_ERROR;
 }
 
-size_t fread_4(uint32_t *ptr) {
-    assert(NULL != ptr);
-    size_t count = 0;
-    uint8_t bytes[4] = {0};
-    *ptr = 0;
-    count = fread(bytes, 4, 1, g_infile);
-    *ptr = (bytes[0] << 24) | (bytes[1] << 16) | (bytes[2] << 8) | bytes[3];
-    return count * 4;
+/*
+ * @brief make the payload buffer hold at least size bytes
+ */
+static int flv_reserve(flv_parser_t *parser, size_t size) {
+    if (size <= parser->buf_size) {
+        return FLV_OK;
+    }
+
+    flv_release_views(parser);
+    uint8_t *buf = flv_realloc(parser, parser->buf, size);
+    if (!buf) {
+        return FLV_ERROR;
+    }
+    parser->buf = buf;
+    parser->buf_size = size;
+    return FLV_OK;
 }
 
 /*
- * @brief skip 4 bytes in the file stream
+ * @brief read bits from 1 byte
+ * @param[in] value: 1 byte to analysize
+ * @param[in] start_bit: start from the low bit side
+ * @param[in] count: number of bits
  */
-size_t fread_4s(uint32_t *ptr) {
-    assert(NULL != ptr);
-    size_t count = 0;
-    uint8_t bytes[4] = {0};
-    *ptr = 0;
-    count = fread(bytes, 4, 1, g_infile);
-    return count * 4;
+uint8_t flv_get_bits(uint8_t value, uint8_t start_bit, uint8_t count) {
+    uint8_t mask = 0;
+
+    mask = (uint8_t) (((1 << count) - 1) << start_bit);
+    return (mask & value) >> start_bit;
+
 }
 
 /*
  * @brief read scriptdata tag
  */
-double hex2double(uint8_t *hex) {
+static double hex2double(const uint8_t *hex) {
     uint32_t bin_h = (hex[0] << 24) | (hex[1] << 16) | (hex[2] << 8) | hex[3];
     uint32_t bin_l = (hex[4] << 24) | (hex[5] << 16) | (hex[6] << 8) | hex[7];
     uint64_t bin = ((uint64_t)bin_h << 32) | (uint64_t)bin_l;
@@ -217,594 +206,1146 @@ double hex2double(uint8_t *hex) {
 
     return cnv.d; // *((double *)&bin);
 }
-double parse_scriptdata_number(uint8_t **data, size_t *len) {
-    if (!data || !*data || !len) {
-        return 0;
-    }
-
-    uint8_t *d = *data;
+static int parse_scriptdata_number(const uint8_t **data, size_t *len, double *num) {
+    const uint8_t *d = *data;
     size_t l = *len;
 
-    if (l < 1) {
-        return 0;
+    if (l < 1 + 8) {
+        return -1;
     }
-    uint8_t type = *d;
-    assert(SCRIPTDATA_NUMBER == type);
+    assert(SCRIPTDATA_NUMBER == *d);
     d += 1;
     l -= 1;
 
-    if (l < 8) {
-        return 0;
-    }
-    double num = hex2double(d);
+    *num = hex2double(d);
     d += 8;
     l -= 8;
 
     *data = d;
     *len = l;
-    return num;
+    return 0;
 }
-uint8_t parse_scriptdata_boolean(uint8_t **data, size_t *len) {
-    if (!data || !*data || !len) {
-        return 0;
-    }
-
-    uint8_t *d = *data;
+static int parse_scriptdata_boolean(const uint8_t **data, size_t *len, uint8_t *b) {
+    const uint8_t *d = *data;
     size_t l = *len;
 
-    if (l < 1) {
-        return 0;
+    if (l < 1 + 1) {
+        return -1;
     }
-    uint8_t type = *d;
-    assert(SCRIPTDATA_BOOLEAN == type);
+    assert(SCRIPTDATA_BOOLEAN == *d);
     d += 1;
     l -= 1;
 
-    if (l < 1) {
-        return 0;
-    }
-    uint8_t b = d[0];
+    *b = d[0];
     d += 1;
     l -= 1;
 
     *data = d;
     *len = l;
-    return b;
+    return 0;
 }
-char *parse_scriptdata_string_without_type(uint8_t **data, size_t *len) {
-    if (!data || !*data || !len) {
-        return NULL;
-    }
-
-    uint8_t *d = *data;
+static int parse_scriptdata_string_without_type(const uint8_t **data, size_t *len, const char **str, uint16_t *str_len) {
+    const uint8_t *d = *data;
     size_t l = *len;
 
     if (l < 2) {
-        return NULL;
+        return -1;
     }
     uint16_t length = (d[0] << 8) + d[1];
     d += 2;
     l -= 2;
 
-    // string: pascal to c
+    // string: pascal, handed out as a view
     if (l < length) {
-        return NULL;
-    }
-    uint8_t *src = d;
-    uint8_t *dst = src - 1;
-    if (length) {
-        memmove(dst, src, length);
+        return -1;
     }
-    dst[length] = '\0';
+    *str = (const char *) d;
+    *str_len = length;
     d += length;
     l -= length;
 
     *data = d;
     *len = l;
-    return (char *) dst;
+    return 0;
 }
-char *parse_scriptdata_string(uint8_t **data, size_t *len) {
-    if (!data || !*data || !len) {
-        return NULL;
-    }
-
-    uint8_t *d = *data;
+static int parse_scriptdata_string(const uint8_t **data, size_t *len, const char **str, uint16_t *str_len) {
+    const uint8_t *d = *data;
     size_t l = *len;
 
     if (l < 1) {
-        return NULL;
+        return -1;
     }
-    uint8_t type = *d;
-    assert(SCRIPTDATA_STRING == type);
+    assert(SCRIPTDATA_STRING == *d);
     d += 1;
     l -= 1;
 
+    if (parse_scriptdata_string_without_type(&d, &l, str, str_len) < 0) {
+        return -1;
+    }
+
     *data = d;
     *len = l;
-    return parse_scriptdata_string_without_type(data, len);
+    return 0;
 }
-uint8_t *parse_scriptdata_ECMA_array_raw(uint8_t **data, size_t *len, uint8_t *type, uint32_t *length) {
-    if (!data || !*data || !len || !type || !length) {
-        return NULL;
-    }
-
-    uint8_t *d = *data;
+static int parse_scriptdata_ECMA_array_raw(const uint8_t **data, size_t *len, uint32_t *length) {
+    const uint8_t *d = *data;
     size_t l = *len;
 
-    if (l < 1) {
-        return NULL;
+    if (l < 1 + 4) {
+        return -1;
     }
-    *type = *d;
-    assert(SCRIPTDATA_ECMA_ARRAY == *type);
+    assert(SCRIPTDATA_ECMA_ARRAY == *d);
     d += 1;
     l -= 1;
 
-    if (l < 4) {
-        return NULL;
-    }
     *length = (d[0] << 24) + (d[1] << 16) + (d[2] << 8) + d[3];
     d += 4;
     l -= 4;
 
     *data = d;
     *len = l;
-    return d;
+    return 0;
 }
-uint32_t parse_scriptdata_strict_array(uint8_t **data, size_t *len) {
-    if (!data || !*data || !len) {
-        return 0;
-    }
-
-    uint8_t *d = *data;
+static int parse_scriptdata_strict_array(const uint8_t **data, size_t *len, uint32_t *length) {
+    const uint8_t *d = *data;
     size_t l = *len;
 
-    if (l < 1) {
-        return 0;
+    if (l < 1 + 4) {
+        return -1;
     }
-    uint8_t type = *d;
-    assert(SCRIPTDATA_STRICT_ARRAY == type);
+    assert(SCRIPTDATA_STRICT_ARRAY == *d);
     d += 1;
     l -= 1;
 
-    if (l < 4) {
-        return 0;
-    }
-    uint32_t length = (d[0] << 24) + (d[1] << 16) + (d[2] << 8) + d[3];
+    *length = (d[0] << 24) + (d[1] << 16) + (d[2] << 8) + d[3];
     d += 4;
     l -= 4;
 
     // items
-    for (uint32_t i = 0; i < length; i++) {
+    for (uint32_t i = 0; i < *length; i++) {
         // TODO: support NUMBER only
-        parse_scriptdata_number(&d, &l);
+        double num;
+        if (parse_scriptdata_number(&d, &l, &num) < 0) {
+            return -1;
+        }
     }
 
     *data = d;
     *len = l;
-    return length;
+    return 0;
 }
-double parse_scriptdata_date(uint8_t **data, size_t *len) {
-    if (!data || !*data || !len) {
-        return 0;
-    }
-
-    uint8_t *d = *data;
+static int parse_scriptdata_date(const uint8_t **data, size_t *len, double *date_time_ms, int16_t *offset_min) {
+    const uint8_t *d = *data;
     size_t l = *len;
 
-    if (l < 1) {
-        return 0;
+    if (l < 1 + 8 + 2) {
+        return -1;
     }
-    uint8_t type = *d;
-    assert(SCRIPTDATA_DATE == type);
+    assert(SCRIPTDATA_DATE == *d);
     d += 1;
     l -= 1;
 
-    if (l < 8) {
-        return 0;
-    }
-    double date_time_ms = hex2double(d);
+    // date_time_ms: Number of milliseconds since Jan 1, 1970 UTC
+    *date_time_ms = hex2double(d);
     d += 8;
     l -= 8;
 
-    if (l < 2) {
-        return 0;
-    }
-    int16_t offset_min = (d[0] << 8) | d[1];
+    // offset_min: Local time offset in minutes from UTC
+    *offset_min = (d[0] << 8) | d[1];
     d += 2;
     l -= 2;
 
-    // date_time_ms: Number of milliseconds since Jan 1, 1970 UTC
-    // offset_min: Local time offset in minutes from UTC
-    (void)offset_min;
-
     *data = d;
     *len = l;
-    return date_time_ms;
+    return 0;
 }
-void print_scriptdata_object(uint8_t **ppvalue_data, size_t *pvalue_length) {
-    if (!ppvalue_data || !*ppvalue_data || !pvalue_length) {
-        return;
-    }
+static int visit_scriptdata_object(flv_parser_t *parser, const flv_tag_t *flv_tag, uint32_t depth,
+                                   const uint8_t **ppvalue_data, size_t *pvalue_length) {
+    int ret = FLV_OK;
 
     while (*pvalue_length > 0) {
-        char *property_name = parse_scriptdata_string_without_type(ppvalue_data, pvalue_length);
-        if (property_name == NULL) {
+        flv_script_value_t value;
+        memset(&value, 0, sizeof(value));
+        value.depth = depth;
+
+        if (parse_scriptdata_string_without_type(ppvalue_data, pvalue_length, &value.name, &value.name_len) < 0) {
             break;
         }
         if (*pvalue_length < 1) {
             break;
         }
-        uint8_t property_type = (*ppvalue_data)[0];
+        value.type = (*ppvalue_data)[0];
 
         // check terminator
-        if (property_name[0] == '\0' && property_type == SCRIPTDATA_OBJECT_END_MARKER) {
-            printf("      Property: %s\n", scriptdata_value_type_names[property_type]);
+        if (value.name_len == 0 && value.type == SCRIPTDATA_OBJECT_END_MARKER) {
             *ppvalue_data += 1;
             *pvalue_length -= 1;
+            FLV_VISIT(ret, parser, on_script_value, flv_tag, &value);
             break;
         }
 
-        switch (property_type) {
+        int err = 0;
+        switch (value.type) {
             case SCRIPTDATA_NUMBER:
-                printf("      Property: %s %s %f\n",
-                    property_name,
-                    scriptdata_value_type_names[property_type],
-                    parse_scriptdata_number(ppvalue_data, pvalue_length));
+                err = parse_scriptdata_number(ppvalue_data, pvalue_length, &value.number);
                 break;
             case SCRIPTDATA_BOOLEAN:
-                printf("      Property: %s %s %u\n",
-                    property_name,
-                    scriptdata_value_type_names[property_type],
-                    parse_scriptdata_boolean(ppvalue_data, pvalue_length));
+                err = parse_scriptdata_boolean(ppvalue_data, pvalue_length, &value.boolean);
                 break;
             case SCRIPTDATA_STRING:
-                printf("      Property: %s %s %s\n",
-                    property_name,
-                    scriptdata_value_type_names[property_type],
-                    parse_scriptdata_string(ppvalue_data, pvalue_length));
+                {
+                uint16_t string_len = 0;
+                err = parse_scriptdata_string(ppvalue_data, pvalue_length, &value.string, &string_len);
+                value.string_len = string_len;
+                }
                 break;
             case SCRIPTDATA_OBJECT:
-                printf("      Property: %s %s\n",
-                    property_name,
-                    scriptdata_value_type_names[property_type]);
                 *ppvalue_data += 1;
                 *pvalue_length -= 1;
-                printf("        ---- begin Object ----\n");
-                print_scriptdata_object(ppvalue_data, pvalue_length);
-                printf("        ---- end Object ----\n");
                 break;
             case SCRIPTDATA_STRICT_ARRAY:
-                printf("      property: %s %s %u[items]\n",
-                    property_name,
-                    scriptdata_value_type_names[property_type],
-                    parse_scriptdata_strict_array(ppvalue_data, pvalue_length));
+                err = parse_scriptdata_strict_array(ppvalue_data, pvalue_length, &value.items);
                 break;
             case SCRIPTDATA_DATE:
-                {
-                double date_time_ms = parse_scriptdata_date(ppvalue_data, pvalue_length);
-                /*
-                struct timespec ts;
-                ts.tv_sec = date_time_ms / 1000.0;
-                ts.tv_nsec = (date_time_ms - ts.tv_sec * 1000) * 1000 * 1000;
-                */
-                struct tm local_time = {0};
-                time_t date_time_sec = date_time_ms / 1000.0;
-                localtime_r(&date_time_sec, &local_time);
-
-                char date[256];
-                strftime(date, sizeof(date), "%F %T %z (%Z)", &local_time);
-
-                printf("      property: %s %s %f[msec] %ld[sec] %s\n",
-                    property_name,
-                    scriptdata_value_type_names[property_type],
-                    date_time_ms,
-                    date_time_sec,
-                    date
-                    );
-                }
+                err = parse_scriptdata_date(ppvalue_data, pvalue_length, &value.number, &value.date_offset);
                 break;
             default:
-                printf("      Unknown property: %s %u %s\n",
-                    property_name,
-                    property_type,
-                    scriptdata_value_type_names[property_type]);
-                return;
+                // unsupported, the rest of the value cannot be walked
+                err = -1;
+                FLV_VISIT(ret, parser, on_script_value, flv_tag, &value);
+                break;
+        }
+        if (err < 0 || ret != FLV_OK) {
+            break;
+        }
+
+        FLV_VISIT(ret, parser, on_script_value, flv_tag, &value);
+        if (ret != FLV_OK) {
+            break;
+        }
+        if (value.type == SCRIPTDATA_OBJECT) {
+            ret = visit_scriptdata_object(parser, flv_tag, depth + 1, ppvalue_data, pvalue_length);
+            if (ret != FLV_OK) {
+                break;
+            }
         }
     }
+
+    return ret;
 }
-scriptdata_tag_t *read_scriptdata_tag(flv_tag_t *flv_tag) {
+int read_scriptdata_tag(flv_parser_t *parser, const flv_tag_t *flv_tag, const uint8_t *data, size_t size) {
     assert(NULL != flv_tag);
-    if (flv_tag->data_size <= 0) {
-        return NULL;
-    }
-
-    scriptdata_tag_t *tag = malloc(sizeof(scriptdata_tag_t));
-    tag->data = malloc((size_t) flv_tag->data_size);
-    fread(tag->data, 1, (size_t) flv_tag->data_size, g_infile);
+    int ret = FLV_OK;
+    flv_script_value_t value;
 
-    uint8_t *data = tag->data;
-    size_t data_size = flv_tag->data_size;
+    if (size == 0 || !parser->visitor->on_script_value) {
+        return FLV_OK;
+    }
 
     // Name
-    char *name_str = parse_scriptdata_string(&data, &data_size);
-    if (name_str == NULL) {
-        return tag;
+    memset(&value, 0, sizeof(value));
+    uint16_t string_len = 0;
+    if (parse_scriptdata_string(&data, &size, &value.string, &string_len) < 0) {
+        return FLV_OK;
+    }
+    value.type = SCRIPTDATA_STRING;
+    value.string_len = string_len;
+    FLV_VISIT(ret, parser, on_script_value, flv_tag, &value);
+    if (ret != FLV_OK) {
+        return ret;
     }
 
     // Value
-    uint8_t value_type;
-    uint32_t value_num_of_items;
-    uint8_t *value_data = parse_scriptdata_ECMA_array_raw(&data, &data_size, &value_type, &value_num_of_items);
-    if (value_data == NULL) {
-        return tag;
+    memset(&value, 0, sizeof(value));
+    if (size < 1 || data[0] != SCRIPTDATA_ECMA_ARRAY) {
+        return FLV_OK;
+    }
+    if (parse_scriptdata_ECMA_array_raw(&data, &size, &value.items) < 0) {
+        return FLV_OK;
+    }
+    value.type = SCRIPTDATA_ECMA_ARRAY;
+    value.size = (uint32_t) size;
+    FLV_VISIT(ret, parser, on_script_value, flv_tag, &value);
+    if (ret != FLV_OK) {
+        return ret;
     }
-    size_t value_length = (tag->data + flv_tag->data_size) - value_data;
-
-    printf("  Scriptdata tag:\n");
-    printf("    Name:  %s\n", name_str);
-    printf("    Value: %s (%u items, %zu bytes)\n", scriptdata_value_type_names[value_type], value_num_of_items, value_length);
-    print_scriptdata_object(&value_data, &value_length);
-    assert(value_length == 0);
 
-    return tag;
+    return visit_scriptdata_object(parser, flv_tag, 1, &data, &size);
 }
 
 /*
  * @brief read audio tag
  */
-audio_tag_t *read_audio_tag(flv_tag_t *flv_tag) {
+int read_audio_tag(flv_parser_t *parser, const flv_tag_t *flv_tag, const uint8_t *data, size_t size) {
     assert(NULL != flv_tag);
+    int ret = FLV_OK;
     size_t count = 0;
     uint8_t byte = 0;
-    audio_tag_t *tag = NULL;
+    audio_tag_t tag;
 
-    if (flv_tag->data_size == 0) {
-        return NULL;
+    if (size == 0) {
+        return FLV_OK;
     }
 
-    tag = malloc(sizeof(audio_tag_t));
-    count = fread_1(&byte);
+    byte = data[count++];
 
-    tag->sound_format = flv_get_bits(byte, 4, 4);
-    tag->sound_rate = flv_get_bits(byte, 2, 2);
-    tag->sound_size = flv_get_bits(byte, 1, 1);
-    tag->sound_type = flv_get_bits(byte, 0, 1);
+    tag.sound_format = flv_get_bits(byte, 4, 4);
+    tag.sound_rate = flv_get_bits(byte, 2, 2);
+    tag.sound_size = flv_get_bits(byte, 1, 1);
+    tag.sound_type = flv_get_bits(byte, 0, 1);
 
-    printf("  Audio tag:\n");
-    printf("    Sound format: %u - %s\n", tag->sound_format, sound_formats[tag->sound_format]);
-    printf("    Sound rate: %u - %s\n", tag->sound_rate, sound_rates[tag->sound_rate]);
+    tag.aac_packet_type = 255; // dummy
+    if (tag.sound_format == FLV_SOUND_FORMAT_AAC && count < size) {
+        // AACPacketType
+        tag.aac_packet_type = data[count++];
+    }
 
-    printf("    Sound size: %u - %s\n", tag->sound_size, sound_sizes[tag->sound_size]);
-    printf("    Sound type: %u - %s\n", tag->sound_type, sound_types[tag->sound_type]);
+    // The AudioSpecificConfig is defined in ISO 14496-3.
+    // Note that this is not the same as the contents of the esds box from an MP4/F4V file.
+    tag.data = data + count;
+    tag.data_size = (uint32_t) (size - count);
 
-    uint8_t aac_packet_type = 255; // dummy
-    if (tag->sound_format == 10) {
-        // AACPacketType
-        count += fread_1(&byte);
-        printf("      AAC packet type: %u - %s\n", byte, (byte == 0) ? "AAC sequence header" : "AAC raw");
-        aac_packet_type = byte;
-    }
-    tag->data = malloc((size_t) flv_tag->data_size - count);
-    count = fread(tag->data, 1, (size_t) flv_tag->data_size - count, g_infile);
-
-    if (aac_packet_type == 0 && count > 0) {
-        // The AudioSpecificConfig is defined in ISO 14496-3.
-        // Note that this is not the same as the contents of the esds box from an MP4/F4V file.
-        uint8_t *p = tag->data;
-        uint8_t *p_end = p + count;
-
-        printf("      AAC AudioSpecificConfig:");
-        while (p < p_end) {
-            printf(" 0x%x", *p++);
+    FLV_VISIT(ret, parser, on_audio, flv_tag, &tag);
+    return ret;
+}
+
+/*
+ * @brief signed 24 bits, big-endian
+ */
+static int32_t read_si24(const uint8_t *p) {
+    int32_t v = (p[0] << 16) | (p[1] << 8) | p[2];
+    return (v ^ 0x800000) - 0x800000; // sign extend
+}
+
+typedef int (*video_reader_t)(flv_parser_t *parser, const flv_tag_t *flv_tag, const video_tag_t *video_tag, const uint8_t *data, size_t size);
+
+/*
+ * @brief readers of the legacy codec ids with a codec specific header
+ */
+static const video_reader_t legacy_video_readers[16] = {
+    [FLV_CODEC_ID_AVC] = read_avc_video_tag,
+};
+
+typedef void (*frames_reader_t)(flv_video_packet_t *packet, const uint8_t *data, size_t size);
+
+static void read_frames(flv_video_packet_t *packet, const uint8_t *data, size_t size) {
+    packet->data = data;
+    packet->data_size = (uint32_t) size;
+}
+
+/*
+ * @brief coded frames behind a composition time, as avc1 and hvc1 have them
+ */
+static void read_frames_cts(flv_video_packet_t *packet, const uint8_t *data, size_t size) {
+    if (size < 3) {
+        read_frames(packet, data + size, 0);
+        return;
+    }
+    packet->composition_time = read_si24(data);
+    read_frames(packet, data + 3, size - 3);
+}
+
+/*
+ * @brief Enhanced FLV codecs by FourCC, with the reader of their coded frames
+ */
+static const struct ex_video_codec {
+    uint32_t fourcc;
+    uint8_t codec_id;
+    frames_reader_t read_frames;
+} ex_video_codecs[] = {
+    {FLV_FOURCC('a', 'v', 'c', '1'), FLV_CODEC_ID_AVC, read_frames_cts},
+    {FLV_FOURCC('h', 'v', 'c', '1'), FLV_CODEC_ID_HEVC, read_frames_cts},
+    {FLV_FOURCC('a', 'v', '0', '1'), FLV_CODEC_ID_AV1, read_frames},
+    {FLV_FOURCC('v', 'p', '0', '9'), FLV_CODEC_ID_VP9, read_frames},
+};
+
+static const struct ex_video_codec *find_ex_video_codec(uint32_t fourcc) {
+    for (size_t i = 0; i < sizeof(ex_video_codecs) / sizeof(ex_video_codecs[0]); i++) {
+        if (ex_video_codecs[i].fourcc == fourcc) {
+            return &ex_video_codecs[i];
         }
-        printf("\n");
     }
+    return NULL;
+}
 
-    return tag;
+/*
+ * @brief FLV_CODEC_ID_* of an Enhanced FLV FourCC, 0 for an unknown one
+ */
+uint8_t flv_fourcc_codec_id(uint32_t fourcc) {
+    const struct ex_video_codec *codec = find_ex_video_codec(fourcc);
+
+    return codec ? codec->codec_id : 0;
+}
+
+static uint32_t read_fourcc(const uint8_t *p) {
+    return FLV_FOURCC(p[0], p[1], p[2], p[3]);
 }
 
 /*
- * @brief read video tag
+ * @brief decode the video tag header in front of the codec body
+ * @return bytes of it, or -1 if data ends inside it
  */
-video_tag_t *read_video_tag(flv_tag_t *flv_tag) {
+static int decode_video_header(const uint8_t *data, size_t size, video_tag_t *tag) {
     size_t count = 0;
-    uint8_t byte = 0;
-    video_tag_t *tag = NULL;
+    uint8_t byte;
 
-    if (flv_tag->data_size == 0) {
-        return NULL;
+    memset(tag, 0, sizeof(*tag));
+    if (size < 1) {
+        return -1;
+    }
+    byte = data[count++];
+    if (!(byte & 0x80)) {
+        tag->frame_type = flv_get_bits(byte, 4, 4);
+        tag->codec_id = flv_get_bits(byte, 0, 4);
+        return (int) count;
     }
 
-    tag = malloc(sizeof(video_tag_t));
+    // Enhanced FLV: IsExHeader, 3 bits of frame type and the packet type
+    tag->ex_header = 1;
+    tag->frame_type = flv_get_bits(byte, 4, 3);
+    tag->packet_type = flv_get_bits(byte, 0, 4);
+    while (tag->packet_type == FLV_PACKET_MOD_EX) {
+        if (size - count < 1) {
+            return -1;
+        }
+        size_t mod_size = data[count++] + 1;
+        if (mod_size == 256) {
+            if (size - count < 2) {
+                return -1;
+            }
+            mod_size = ((data[count] << 8) | data[count + 1]) + 1;
+            count += 2;
+        }
+        // the modifier and its type are passed over, the packet type follows
+        if (size - count < mod_size + 1) {
+            return -1;
+        }
+        count += mod_size;
+        tag->packet_type = flv_get_bits(data[count++], 0, 4);
+    }
 
-    count = fread_1(&byte);
+    if (tag->frame_type == FLV_VIDEO_FRAME_COMMAND && tag->packet_type != FLV_PACKET_METADATA) {
+        return (int) count; // a command byte follows, no FourCC
+    }
+    if (tag->packet_type == FLV_PACKET_MULTITRACK) {
+        if (size - count < 1) {
+            return -1;
+        }
+        byte = data[count++];
+        tag->multitrack = 1 + flv_get_bits(byte, 4, 4);
+        tag->packet_type = flv_get_bits(byte, 0, 4);
+        if (tag->multitrack - 1 == FLV_MULTITRACK_MANY_TRACKS_MANY_CODECS) {
+            // every track names its own codec, report the first
+            if (size - count < 4) {
+                return -1;
+            }
+            tag->fourcc = read_fourcc(data + count);
+            tag->codec_id = flv_fourcc_codec_id(tag->fourcc);
+            return (int) count;
+        }
+    }
+    if (size - count < 4) {
+        return -1;
+    }
+    tag->fourcc = read_fourcc(data + count);
+    tag->codec_id = flv_fourcc_codec_id(tag->fourcc);
+    count += 4;
+    return (int) count;
+}
 
-    tag->frame_type = flv_get_bits(byte, 4, 4);
-    tag->codec_id = flv_get_bits(byte, 0, 4);
+/*
+ * @brief read video tag
+ */
+int read_video_tag(flv_parser_t *parser, const flv_tag_t *flv_tag, const uint8_t *data, size_t size) {
+    int ret = FLV_OK;
+    video_tag_t tag;
+    video_reader_t reader;
 
-    printf("  Video tag:\n");
-    printf("    Frame type: %u - %s\n", tag->frame_type, frame_types[tag->frame_type]);
-    printf("    Codec ID: %u - %s\n", tag->codec_id, codec_ids[tag->codec_id]);
+    if (size == 0) {
+        return FLV_OK;
+    }
 
-    // AVC-specific stuff
-    if (tag->codec_id == FLV_CODEC_ID_AVC) {
-        tag->data = read_avc_video_tag(tag, flv_tag, (uint32_t) (flv_tag->data_size - count));
+    int count = decode_video_header(data, size, &tag);
+    if (count < 0) {
+        // a truncated Enhanced FLV header, only the first byte is known
+        count = (int) size;
+        reader = NULL;
+    } else if (tag.frame_type == FLV_VIDEO_FRAME_COMMAND && !(tag.ex_header && tag.packet_type == FLV_PACKET_METADATA)) {
+        reader = NULL; // a command byte, no codec data
     } else {
-        tag->data = malloc((size_t) flv_tag->data_size - count);
-        count = fread(tag->data, 1, (size_t) flv_tag->data_size - count, g_infile);
+        reader = tag.ex_header ? read_ex_video_tag : legacy_video_readers[tag.codec_id];
+    }
+    tag.data = data + count;
+    tag.data_size = (uint32_t) (size - count);
+
+    FLV_VISIT(ret, parser, on_video, flv_tag, &tag);
+    if (ret != FLV_OK) {
+        return ret;
     }
 
-    return tag;
+    if (reader) {
+        ret = reader(parser, flv_tag, &tag, tag.data, tag.data_size);
+    }
+    return ret;
 }
 
 /*
  * @brief read AVC video tag
  */
-avc_video_tag_t *read_avc_video_tag(video_tag_t *video_tag, flv_tag_t *flv_tag, uint32_t data_size) {
+int read_avc_video_tag(flv_parser_t *parser, const flv_tag_t *flv_tag, const video_tag_t *video_tag, const uint8_t *data, size_t size) {
+    int ret = FLV_OK;
     size_t count = 0;
-    avc_video_tag_t *tag = NULL;
-
-    tag = malloc(sizeof(avc_video_tag_t));
+    avc_video_tag_t tag;
 
-    count = fread_1(&(tag->avc_packet_type));
-    if (tag->avc_packet_type == 1) {
-        //count += fread_4s(&(tag->composition_time));
-        count += fread_3(&(tag->composition_time));
-    } else {
-        tag->composition_time = 0;
+    if (size == 0) {
+        return FLV_OK;
     }
 
-    assert(video_tag->frame_type != 5); // not implemented!
+    tag.avc_packet_type = data[count++];
+    tag.composition_time = 0;
+    if (tag.avc_packet_type == 1 && size >= count + 3) {
+        tag.composition_time = read_si24(data + count);
+        count += 3;
+    }
+    tag.pts = (int64_t) flv_tag->time + tag.composition_time;
 
     // AVCVIDEOPACKET
-    size_t data_len = data_size - count;
-    if (tag->avc_packet_type == 0) {
-        // AVCDecoderConfigurationRecord
-        tag->nalu_len = 0;
-    } else if (tag->avc_packet_type == 1) {
+    tag.data = data + count;
+    tag.data_size = (uint32_t) (size - count);
+    if (tag.avc_packet_type == 1 && tag.data_size >= 4) {
         // One or more NALUs (Full frames are required)
-        count += fread_4(&(tag->nalu_len));
+        tag.nalu_len = (tag.data[0] << 24) | (tag.data[1] << 16) | (tag.data[2] << 8) | tag.data[3];
     } else {
-        // do nothing
-        tag->nalu_len = 0;
+        // AVCDecoderConfigurationRecord or end of sequence
+        tag.nalu_len = 0;
     }
 
-    printf("    AVC video tag:\n");
-    printf("      AVC packet type: %u - %s\n", tag->avc_packet_type, avc_packet_types[tag->avc_packet_type]);
-    printf("      AVC composition time: %i\n", tag->composition_time);
-    printf("      AVC 1st nalu length: %i\n", tag->nalu_len);
-    printf("      AVC packet data length: %lu\n", data_len);
+    FLV_VISIT(ret, parser, on_avc, flv_tag, video_tag, &tag);
+    return ret;
+}
+
+/*
+ * @brief read the tracks of an Enhanced FLV video tag, data is the body behind its header
+ *
+ * A track that runs past the data, as in the first chunk of a chunked
+ * payload, is cut short and ends the tag.
+ */
+int read_ex_video_tag(flv_parser_t *parser, const flv_tag_t *flv_tag, const video_tag_t *video_tag, const uint8_t *data, size_t size) {
+    int ret = FLV_OK;
+    int multitrack = video_tag->multitrack ? video_tag->multitrack - 1 : -1;
+    flv_video_packet_t packet;
+
+    do {
+        memset(&packet, 0, sizeof(packet));
+        packet.packet_type = video_tag->packet_type;
+        packet.fourcc = video_tag->fourcc;
+
+        size_t track_size = size;
+        if (multitrack >= 0) {
+            size_t head = (multitrack == FLV_MULTITRACK_MANY_TRACKS_MANY_CODECS ? 4 : 0) + 1 +
+                          (multitrack == FLV_MULTITRACK_ONE_TRACK ? 0 : 3);
+            if (size < head) {
+                break;
+            }
+            if (multitrack == FLV_MULTITRACK_MANY_TRACKS_MANY_CODECS) {
+                packet.fourcc = read_fourcc(data);
+                data += 4;
+            }
+            packet.track_id = data[0];
+            data += 1;
+            size -= head;
+            if (multitrack != FLV_MULTITRACK_ONE_TRACK) {
+                track_size = (data[0] << 16) | (data[1] << 8) | data[2];
+                data += 3;
+                if (track_size > size) {
+                    track_size = size;
+                }
+            }
+        }
+
+        const struct ex_video_codec *codec = find_ex_video_codec(packet.fourcc);
+        packet.codec_id = codec ? codec->codec_id : 0;
+        if (packet.packet_type == FLV_PACKET_CODED_FRAMES && codec) {
+            codec->read_frames(&packet, data, track_size);
+        } else {
+            // configuration records, metadata, CodedFramesX and unknown codecs as they are
+            read_frames(&packet, data, track_size);
+        }
+        packet.pts = (int64_t) flv_tag->time + packet.composition_time;
 
-    tag->data = malloc((size_t) data_size - count);
-    count = fread(tag->data, 1, (size_t) data_size - count, g_infile);
+        FLV_VISIT(ret, parser, on_video_packet, flv_tag, video_tag, &packet);
+        data += track_size;
+        size -= track_size;
+    } while (ret == FLV_OK && multitrack > FLV_MULTITRACK_ONE_TRACK && size > 0);
 
-    return tag;
+    return ret;
 }
 
-void flv_parser_init(FILE *in_file) {
-    g_infile = in_file;
+void flv_parser_init(flv_parser_t *parser, FILE *in_file, const flv_visitor_t *visitor, void *opaque) {
+    memset(parser, 0, sizeof(*parser));
+    parser->in = in_file;
+    parser->visitor = visitor;
+    parser->opaque = opaque;
+    flv_stats_reset(&parser->stats);
 }
 
-int flv_parser_run() {
-    flv_tag_t *tag;
-    flv_read_header();
+void flv_parser_close(flv_parser_t *parser) {
+    if (parser->reader.buf) {
+        flv_reader_close(&parser->reader);
+    }
+    free(parser->buf);
+    parser->buf = NULL;
+    parser->buf_size = 0;
+}
 
-    for (; ;) {
-        tag = flv_read_tag(); // read the tag
-        if (!tag) {
-            return 0;
-        }
-        flv_free_tag(tag); // and free it
+/*
+ * @brief dump the stats to out when the run finishes and whenever signo arrives
+ * @param[in] out: NULL to disable the dump
+ * @param[in] signo: 0 for no signal
+ */
+int flv_parser_set_stats(flv_parser_t *parser, FILE *out, int signo) {
+    parser->stats_out = out;
+    if (out && signo > 0) {
+        return flv_stats_install_signal(signo);
     }
+    return 0;
+}
+
+flv_stats_t *flv_parser_stats(flv_parser_t *parser) {
+    return &parser->stats;
+}
 
+/*
+ * @brief bound the payload buffer, see flv_visitor_t for what changes
+ * @param[in] chunk_size: 0 for whole payloads, otherwise at least FLV_MIN_CHUNK_SIZE
+ */
+int flv_parser_set_chunk_size(flv_parser_t *parser, uint32_t chunk_size) {
+    if (chunk_size && chunk_size < FLV_MIN_CHUNK_SIZE) {
+        return FLV_ERROR;
+    }
+    parser->chunk_size = chunk_size;
+    return FLV_OK;
 }
 
-void flv_free_tag(flv_tag_t *tag) {
-    scriptdata_tag_t *scriptdata_tag;
-    audio_tag_t *audio_tag;
-    video_tag_t *video_tag;
-    avc_video_tag_t *avc_video_tag;
+/*
+ * @brief a filter that keeps every tag
+ */
+void flv_filter_init(flv_filter_t *filter) {
+    memset(filter, 0, sizeof(*filter));
+    filter->tag_types = FLV_FILTER_ALL;
+    filter->stream_id = -1;
+    filter->time_to = UINT64_MAX;
+    filter->max_size = UINT32_MAX;
+    filter->video_codecs = FLV_FILTER_ALL;
+    filter->sound_formats = FLV_FILTER_ALL;
+}
 
-    if (tag->data) {
-        if (tag->tag_type == TAGTYPE_SCRIPTDATAOBJECT) {
-            scriptdata_tag = (scriptdata_tag_t *) tag->data;
-            free(scriptdata_tag->data);
-        } else if (tag->tag_type == TAGTYPE_VIDEODATA) {
-            video_tag = (video_tag_t *) tag->data;
-            if (video_tag->codec_id == FLV_CODEC_ID_AVC) {
-                avc_video_tag = (avc_video_tag_t *) video_tag->data;
-                free(avc_video_tag->data);
-            }
-            free(video_tag->data);
-        } else if (tag->tag_type == TAGTYPE_AUDIODATA) {
-            audio_tag = (audio_tag_t *) tag->data;
-            free(audio_tag->data);
+/*
+ * @brief drop the tags filter rejects before their payloads are read
+ * @param[in] filter: NULL to keep every tag, must outlive the parse
+ */
+void flv_parser_set_filter(flv_parser_t *parser, const flv_filter_t *filter) {
+    parser->filter = filter;
+}
+
+/*
+ * @brief bytes of the stream consumed so far, where an error was found
+ */
+uint64_t flv_parser_offset(const flv_parser_t *parser) {
+    return parser->offset;
+}
+
+/*
+ * @brief parse the whole input, driving the visitor
+ * @return FLV_END, FLV_STOP or FLV_ERROR
+ */
+int flv_parser_run(flv_parser_t *parser) {
+    int ret = flv_read_header(parser);
+
+    while (ret == FLV_OK) {
+        ret = flv_read_tag(parser);
+
+        if (parser->stats_out && flv_stats_signaled()) {
+            flv_stats_print(&parser->stats, parser->stats_out);
         }
     }
 
-    free(tag->data);
-    free(tag);
+    flv_release_views(parser);
+    FLV_STATS_ENTER(&parser->stats, FLV_STAGE_NONE);
+    if (parser->stats_out) {
+        flv_stats_print(&parser->stats, parser->stats_out);
+    }
+    return ret;
 }
 
-int flv_read_header(void) {
-    int i = 0;
-    flv_header_t *flv_header = NULL;
+/*
+ * @brief check and visit the 9 bytes file header
+ */
+static int decode_header(flv_parser_t *parser, const uint8_t *bytes) {
+    int ret = FLV_OK;
+    flv_header_t flv_header;
 
-    flv_header = malloc(sizeof(flv_header_t));
-    fread(flv_header, 1, sizeof(flv_header_t), g_infile);
+    memcpy(&flv_header, bytes, sizeof(flv_header_t));
 
-    // XXX strncmp
-    for (i = 0; i < strlen(flv_signature); i++) {
-        assert(flv_header->signature[i] == flv_signature[i]);
+    if (memcmp(flv_header.signature, flv_signature, sizeof(flv_header.signature)) != 0) {
+        return FLV_ERROR;
     }
 
-    flv_header->data_offset = ntohl(flv_header->data_offset);
+    flv_header.data_offset = ntohl(flv_header.data_offset);
 
-    flv_print_header(flv_header);
+    FLV_VISIT(ret, parser, on_header, &flv_header);
+    return ret;
+}
 
-    return 0;
+/*
+ * @brief decode PreviousTagSize and the 11 bytes tag header
+ */
+static void decode_tag_header(const uint8_t *b, flv_tag_t *tag) {
+    tag->prev_tag_size = (b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+    tag->tag_type = b[4];
+    tag->data_size = (b[5] << 16) | (b[6] << 8) | b[7];
+    tag->timestamp = (b[8] << 16) | (b[9] << 8) | b[10];
+    tag->timestamp_ext = b[11];
+    tag->stream_id = (b[12] << 16) | (b[13] << 8) | b[14];
+}
+
+/*
+ * @brief extend the 32-bit timestamp to 64 bits
+ *
+ * The timestamp is placed in the epoch (of 2^24 ms while the stream never
+ * set timestamp_ext, of 2^32 ms after) that brings it closest to the time
+ * of the tag before: a backwards jump of more than 2^23 ms is a wraparound,
+ * and a forward jump of more than 2^23 ms right after one is a straggler
+ * from before the wrap, as interleaved audio and video produce.
+ */
+static uint64_t unwrap_timestamp(flv_parser_t *parser, uint32_t timestamp) {
+    const uint64_t half = UINT64_C(1) << 23;
+    uint64_t time = timestamp;
+
+    if (timestamp >= (UINT32_C(1) << 24)) {
+        parser->timestamp_wide = 1;
+    }
+    if (parser->have_timestamp) {
+        uint64_t epoch = parser->timestamp_wide ? UINT64_C(1) << 32 : UINT64_C(1) << 24;
+        uint64_t last = parser->last_time;
+
+        time += last & ~(epoch - 1);
+        if (time + half < last) {
+            time += epoch;
+        } else if (time > last + half && time >= epoch) {
+            time -= epoch;
+        }
+    }
+    parser->have_timestamp = 1;
+    parser->last_time = time;
 
+    return time;
 }
 
-void print_general_tag_info(flv_tag_t *tag) {
-    assert(NULL != tag);
-    printf("  Data size: %lu\n", (unsigned long) tag->data_size);
-    printf("  Timestamp: %lu\n", (unsigned long) tag->timestamp);
-    printf("  Timestamp extended: %u\n", tag->timestamp_ext);
-    printf("  StreamID: %lu\n", (unsigned long) tag->stream_id);
+/*
+ * @brief fill in the derived fields of a decoded tag header
+ */
+static int begin_tag(flv_parser_t *parser, flv_tag_t *tag) {
+    // both input paths have consumed exactly the tag header at this point
+    tag->offset = parser->offset - FLV_TAG_HEADER_SIZE;
+    tag->time = unwrap_timestamp(parser, ((uint32_t) tag->timestamp_ext << 24) | tag->timestamp);
+
+    if (parser->max_tag_size && tag->data_size > parser->max_tag_size) {
+        return FLV_ERROR;
+    }
 
-    return;
+    FLV_STATS_TAG(&parser->stats, tag->tag_type, tag->data_size);
+    return FLV_OK;
 }
 
-flv_tag_t *flv_read_tag(void) {
-    uint32_t prev_tag_size = 0;
-    flv_tag_t *tag = NULL;
+enum filter_verdicts {
+    FILTER_KEEP,
+    FILTER_SKIP,
+    FILTER_PEEK, // decided by the first FLV_FILTER_PEEK_SIZE payload bytes
+    FILTER_END, // past the time bound, the parse is over
+};
 
-    fread_4(&prev_tag_size);
-    printf("Prev tag size: %lu\n", (unsigned long) prev_tag_size);
-    printf("\n");
+/*
+ * @brief check a tag against the filter on its header alone
+ */
+static int filter_tag_header(flv_parser_t *parser, const flv_tag_t *tag) {
+    const flv_filter_t *filter = parser->filter;
+    int verdict = FILTER_KEEP;
 
-    // Start reading next tag
-    tag = malloc(sizeof(flv_tag_t));
-    fread_1(&(tag->tag_type));
-    if (feof(g_infile)) {
-        free(tag);
-        return NULL;
+    if (!filter) {
+        return FILTER_KEEP;
+    }
+    if (tag->time >= filter->time_to) {
+        return FILTER_END;
+    }
+
+    if (tag->tag_type >= 32 || !(filter->tag_types & FLV_FILTER_BIT(tag->tag_type)) ||
+        (filter->stream_id >= 0 && tag->stream_id != filter->stream_id) ||
+        tag->time < filter->time_from ||
+        tag->data_size < filter->min_size || tag->data_size > filter->max_size) {
+        verdict = FILTER_SKIP;
+    } else if ((tag->tag_type == TAGTYPE_VIDEODATA && (filter->keyframes || filter->video_codecs != FLV_FILTER_ALL)) ||
+               (tag->tag_type == TAGTYPE_AUDIODATA && filter->sound_formats != FLV_FILTER_ALL)) {
+        // an empty payload has no frame type or codec to match
+        verdict = tag->data_size ? FILTER_PEEK : FILTER_SKIP;
+    }
+
+    if (verdict == FILTER_SKIP) {
+        FLV_STATS_ADD(&parser->stats, tags_skipped, 1);
+    }
+    return verdict;
+}
+
+/*
+ * @brief settle a FILTER_PEEK with the first bytes of the payload, all of it when shorter
+ */
+static int filter_peek(flv_parser_t *parser, const flv_tag_t *tag, const uint8_t *data, uint32_t size) {
+    const flv_filter_t *filter = parser->filter;
+    video_tag_t video;
+    int keep;
+
+    if (tag->tag_type == TAGTYPE_VIDEODATA) {
+        if (decode_video_header(data, size, &video) < 0 && video.ex_header) {
+            // the FourCC is out of sight, behind a long ModEx or past a truncated payload
+            keep = !filter->keyframes || video.frame_type == 1;
+        } else {
+            keep = (!filter->keyframes || video.frame_type == 1) &&
+                   (filter->video_codecs & FLV_FILTER_BIT(video.codec_id));
+        }
+    } else {
+        keep = (filter->sound_formats & FLV_FILTER_BIT(flv_get_bits(data[0], 4, 4))) != 0;
+    }
+
+    if (!keep) {
+        FLV_STATS_ADD(&parser->stats, tags_skipped, 1);
     }
-    fread_3(&(tag->data_size));
-    fread_3(&(tag->timestamp));
-    fread_1(&(tag->timestamp_ext));
-    fread_3(&(tag->stream_id));
+    return keep ? FILTER_KEEP : FILTER_SKIP;
+}
 
-    printf("Tag type: %u - ", tag->tag_type);
+/*
+ * @brief hand a payload, or the first chunk of it, to the reader of its tag type
+ */
+static int dispatch_tag(flv_parser_t *parser, const flv_tag_t *tag, const uint8_t *data, uint32_t size) {
     switch (tag->tag_type) {
         case TAGTYPE_AUDIODATA:
-            printf("Audio data #%d\n", g_a_count++);
-            print_general_tag_info(tag);
-            tag->data = (void *) read_audio_tag(tag);
-            break;
+            return read_audio_tag(parser, tag, data, size);
         case TAGTYPE_VIDEODATA:
-            printf("Video data #%d\n", g_v_count++);
-            print_general_tag_info(tag);
-            tag->data = (void *) read_video_tag(tag);
-            break;
+            return read_video_tag(parser, tag, data, size);
         case TAGTYPE_SCRIPTDATAOBJECT:
-            printf("Script data object\n");
-            print_general_tag_info(tag);
-            tag->data = (void *) read_scriptdata_tag(tag);
-            break;
+            // values can reach to the end of the payload, decode only whole ones
+            return size == tag->data_size ? read_scriptdata_tag(parser, tag, data, size) : FLV_OK;
         default:
-            printf("Unknown tag type!\n");
-            free(tag);
-            die();
+            return FLV_ERROR;
     }
+}
 
-    #if 0
-    // Did we reach end of file?
-    if (feof(g_infile)) {
-        return NULL;
+/*
+ * @brief bytes of payload per delivery: the chunk size, or the whole payload
+ */
+static uint32_t payload_unit(const flv_parser_t *parser, const flv_tag_t *tag) {
+    if (parser->chunk_size && tag->data_size > parser->chunk_size) {
+        return parser->chunk_size;
+    }
+    return tag->data_size;
+}
+
+/*
+ * @brief visit the payload bytes at offset, decoding the tag with the first of them
+ */
+static int visit_payload(flv_parser_t *parser, const flv_tag_t *tag, const uint8_t *data, uint32_t size, uint32_t offset) {
+    int ret = FLV_OK;
+
+    if (offset == 0) {
+        ret = dispatch_tag(parser, tag, data, size);
+    }
+    if (ret == FLV_OK && size > 0) {
+        FLV_VISIT(ret, parser, on_payload, tag, data, size, offset);
+    }
+    parser->views_out = 1;
+    return ret;
+}
+
+int flv_read_header(flv_parser_t *parser) {
+    const uint8_t *bytes = flv_need(parser, FLV_HEADER_SIZE);
+
+    if (!bytes) {
+        // the offset of the error is where the input ended
+        flv_consume(parser, flv_reader_avail(&parser->reader));
+        return FLV_ERROR;
+    }
+    flv_consume(parser, FLV_HEADER_SIZE);
+    return decode_header(parser, bytes);
+}
+
+/*
+ * @brief read the next tag and hand it to the visitor
+ *
+ * Payloads up to FLV_READER_SIZE are handed out as views of the read
+ * buffer, larger ones are read into the payload buffer.
+ * @return FLV_OK, FLV_END at end of input or past the filter, FLV_STOP or FLV_ERROR
+ */
+int flv_read_tag(flv_parser_t *parser) {
+    int ret = FLV_OK;
+    flv_tag_t tag;
+    int stage = FLV_STATS_ENTER(&parser->stats, FLV_STAGE_HEADER);
+    const uint8_t *bytes = flv_need(parser, FLV_PREV_TAG_SIZE_SIZE + FLV_TAG_HEADER_SIZE);
+
+    if (!bytes) {
+        // the last PreviousTagSize, or part of it, ends the stream
+        size_t rest = flv_reader_avail(&parser->reader);
+        flv_consume(parser, rest);
+        FLV_STATS_ENTER(&parser->stats, stage);
+        return (rest > FLV_PREV_TAG_SIZE_SIZE || parser->reader.error) ? FLV_ERROR : FLV_END;
+    }
+    decode_tag_header(bytes, &tag);
+    flv_consume(parser, FLV_PREV_TAG_SIZE_SIZE + FLV_TAG_HEADER_SIZE);
+
+    ret = begin_tag(parser, &tag);
+    if (ret != FLV_OK) {
+        goto out;
+    }
+
+    uint32_t unit = payload_unit(parser, &tag);
+    int verdict = filter_tag_header(parser, &tag);
+    if (verdict == FILTER_PEEK) {
+        uint32_t have = tag.data_size < FLV_FILTER_PEEK_SIZE ? tag.data_size : FLV_FILTER_PEEK_SIZE;
+        const uint8_t *peek = flv_need(parser, have);
+        if (!peek) {
+            flv_consume(parser, flv_reader_avail(&parser->reader));
+            ret = FLV_ERROR;
+            goto out;
+        }
+        verdict = filter_peek(parser, &tag, peek, have);
+    }
+    if (verdict == FILTER_END) {
+        ret = FLV_END;
+        goto out;
+    }
+    if (verdict == FILTER_SKIP) {
+        ret = flv_skip(parser, tag.data_size);
+        goto out;
+    }
+    FLV_VISIT(ret, parser, on_tag_header, &tag);
+    if (ret != FLV_OK) {
+        goto out;
+    }
+
+    FLV_STATS_ENTER(&parser->stats, FLV_STAGE_PAYLOAD);
+    if (unit > FLV_READER_SIZE && flv_reserve(parser, unit) != FLV_OK) {
+        ret = FLV_ERROR;
+        goto out;
     }
-    #endif
+    if (tag.data_size == 0) {
+        ret = visit_payload(parser, &tag, parser->buf, 0, 0);
+    }
+    for (uint32_t offset = 0; ret == FLV_OK && offset < tag.data_size; offset += unit) {
+        uint32_t n = tag.data_size - offset < unit ? tag.data_size - offset : unit;
+        const uint8_t *data = parser->buf;
+        if (n <= FLV_READER_SIZE) {
+            data = flv_need(parser, n);
+            if (!data) {
+                flv_consume(parser, flv_reader_avail(&parser->reader));
+                ret = FLV_ERROR;
+                break;
+            }
+            flv_consume(parser, n); // the view lasts until the next read
+        } else if (flv_fread(parser, parser->buf, n) != n) {
+            ret = FLV_ERROR;
+            break;
+        }
+        ret = visit_payload(parser, &tag, data, n, offset);
+    }
+
+out:
+    FLV_STATS_ENTER(&parser->stats, stage);
+    return ret;
+}
+
+/*
+ * @brief push the next piece of the stream
+ *
+ * Pieces may split headers and payloads anywhere. A payload that arrives in
+ * one piece is handed to the visitor in place, otherwise it is collected in
+ * the parser buffer first. Payloads of filtered out tags are passed over.
+ * @return FLV_OK when more input is wanted, FLV_END past the filter, FLV_STOP or FLV_ERROR
+ */
+int flv_parser_feed(flv_parser_t *parser, const uint8_t *data, size_t size) {
+    int ret = parser->feed_status;
+    int stage = FLV_STATS_ENTER(&parser->stats, FLV_STAGE_HEADER);
+    flv_tag_t *tag = &parser->feed_tag;
+
+    while (ret == FLV_OK && size > 0) {
+        if (parser->feed_state == FLV_FEED_HEADER || parser->feed_state == FLV_FEED_TAG_HEADER) {
+            size_t want = (parser->feed_state == FLV_FEED_HEADER) ? FLV_HEADER_SIZE : sizeof(parser->feed_header);
+            size_t n = want - parser->feed_have;
+            if (n > size) {
+                n = size;
+            }
+            memcpy(parser->feed_header + parser->feed_have, data, n);
+            parser->feed_have += n;
+            parser->offset += n;
+            data += n;
+            size -= n;
+            if (parser->feed_have < want) {
+                break;
+            }
+            parser->feed_have = 0;
+
+            FLV_STATS_ENTER(&parser->stats, FLV_STAGE_HEADER);
+            if (parser->feed_state == FLV_FEED_HEADER) {
+                ret = decode_header(parser, parser->feed_header);
+                parser->feed_state = FLV_FEED_TAG_HEADER;
+            } else {
+                decode_tag_header(parser->feed_header, tag);
+                ret = begin_tag(parser, tag);
+                if (ret != FLV_OK) {
+                    break;
+                }
+                int verdict = filter_tag_header(parser, tag);
+                parser->feed_state = (verdict == FILTER_SKIP) ? FLV_FEED_SKIP : FLV_FEED_PAYLOAD;
+                parser->feed_peek = (verdict == FILTER_PEEK);
+                parser->feed_done = 0;
+                if (verdict == FILTER_END) {
+                    ret = FLV_END;
+                } else if (verdict == FILTER_KEEP) {
+                    FLV_VISIT(ret, parser, on_tag_header, tag);
+                }
+                if (ret == FLV_OK && tag->data_size == 0) {
+                    if (verdict == FILTER_KEEP) {
+                        ret = visit_payload(parser, tag, NULL, 0, 0);
+                    }
+                    parser->feed_state = FLV_FEED_TAG_HEADER;
+                }
+            }
+        } else if (parser->feed_state == FLV_FEED_PAYLOAD) {
+            FLV_STATS_ENTER(&parser->stats, FLV_STAGE_PAYLOAD);
+            uint32_t unit = payload_unit(parser, tag);
+            if (parser->feed_peek) {
+                // collect the bytes the filter looks at, they stay as the start of the first unit
+                uint32_t peek = tag->data_size < FLV_FILTER_PEEK_SIZE ? tag->data_size : FLV_FILTER_PEEK_SIZE;
+                if (flv_reserve(parser, unit) != FLV_OK) {
+                    ret = FLV_ERROR;
+                    break;
+                }
+                if (parser->feed_have == 0) {
+                    flv_release_views(parser);
+                }
+                size_t n = peek - parser->feed_have;
+                if (n > size) {
+                    n = size;
+                }
+                memcpy(parser->buf + parser->feed_have, data, n);
+                parser->feed_have += n;
+                parser->offset += n;
+                data += n;
+                size -= n;
+                if (parser->feed_have < peek) {
+                    break;
+                }
+                parser->feed_peek = 0;
+                if (filter_peek(parser, tag, parser->buf, peek) == FILTER_SKIP) {
+                    parser->feed_have = 0;
+                    parser->feed_done = peek;
+                    parser->feed_state = (peek == tag->data_size) ? FLV_FEED_TAG_HEADER : FLV_FEED_SKIP;
+                    continue;
+                }
+                FLV_VISIT(ret, parser, on_tag_header, tag);
+                if (ret != FLV_OK) {
+                    break;
+                }
+            }
+            uint32_t want = tag->data_size - parser->feed_done;
+            if (want > unit) {
+                want = unit;
+            }
+
+            const uint8_t *chunk = NULL;
+            if (parser->feed_have == 0 && size >= want) {
+                // the whole payload or chunk is here, no copy
+                chunk = data;
+                parser->offset += want;
+                data += want;
+                size -= want;
+            } else {
+                if (flv_reserve(parser, unit) != FLV_OK) {
+                    ret = FLV_ERROR;
+                    break;
+                }
+                if (parser->feed_have == 0) {
+                    flv_release_views(parser);
+                }
+                size_t n = want - parser->feed_have;
+                if (n > size) {
+                    n = size;
+                }
+                memcpy(parser->buf + parser->feed_have, data, n);
+                parser->feed_have += n;
+                parser->offset += n;
+                data += n;
+                size -= n;
+                if (parser->feed_have == want) {
+                    parser->feed_have = 0;
+                    chunk = parser->buf;
+                }
+            }
+
+            if (chunk) {
+                ret = visit_payload(parser, tag, chunk, want, parser->feed_done);
+                parser->feed_done += want;
+                if (parser->feed_done == tag->data_size) {
+                    parser->feed_state = FLV_FEED_TAG_HEADER;
+                }
+            }
+        } else if (parser->feed_state == FLV_FEED_SKIP) {
+            uint32_t n = tag->data_size - parser->feed_done;
+            if (n > size) {
+                n = size;
+            }
+            FLV_STATS_ADD(&parser->stats, bytes_skipped, n);
+            parser->feed_done += n;
+            parser->offset += n;
+            data += n;
+            size -= n;
+            if (parser->feed_done == tag->data_size) {
+                parser->feed_state = FLV_FEED_TAG_HEADER;
+            }
+        } else {
+            ret = FLV_ERROR;
+        }
+    }
+
+    if (ret != FLV_OK) {
+        parser->feed_state = FLV_FEED_DONE;
+        parser->feed_status = ret;
+    }
+    // the views into data end here
+    flv_release_views(parser);
+    FLV_STATS_ENTER(&parser->stats, stage);
+    return ret;
+}
 
-    return tag;
+/*
+ * @brief the pushed stream has ended
+ * @return FLV_END if it ended on a tag boundary, FLV_STOP or FLV_ERROR
+ */
+int flv_parser_finish(flv_parser_t *parser) {
+    int ret = parser->feed_status;
+
+    if (ret == FLV_OK) {
+        // only the final PreviousTagSize may follow the last tag
+        if (parser->feed_state == FLV_FEED_TAG_HEADER &&
+            (parser->feed_have == 0 || parser->feed_have == FLV_PREV_TAG_SIZE_SIZE)) {
+            ret = FLV_END;
+        } else {
+            ret = FLV_ERROR;
+        }
+        parser->feed_state = FLV_FEED_DONE;
+        parser->feed_status = ret;
+    }
+
+    FLV_STATS_ENTER(&parser->stats, FLV_STAGE_NONE);
+    if (parser->stats_out) {
+        flv_stats_print(&parser->stats, parser->stats_out);
+    }
+    return ret;
 }
@@ -10,10 +10,23 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#include "flv-reader.h"
+#include "flv-stats.h"
+
 #define FLV_HEADER_AUDIO_BIT (2)
 #define FLV_HEADER_VIDEO_BIT (0)
 
 #define FLV_CODEC_ID_AVC (7)
+// Enhanced FLV codecs, named by FourCC in the stream; HEVC keeps its de facto legacy id
+#define FLV_CODEC_ID_HEVC (12)
+#define FLV_CODEC_ID_AV1 (13)
+#define FLV_CODEC_ID_VP9 (14)
+
+#define FLV_FOURCC(a, b, c, d) (((uint32_t) (a) << 24) | ((uint32_t) (b) << 16) | ((uint32_t) (c) << 8) | (uint32_t) (d))
+
+#define FLV_VIDEO_FRAME_COMMAND (5) // a command byte instead of codec data
+
+#define FLV_SOUND_FORMAT_AAC (10)
 
 enum tag_types {
     TAGTYPE_AUDIODATA = 8,
@@ -21,6 +34,59 @@ enum tag_types {
     TAGTYPE_SCRIPTDATAOBJECT = 18
 };
 
+/*
+ * @brief Enhanced FLV video packet types, the low 4 bits of the first byte
+ */
+enum flv_video_packet_types {
+    FLV_PACKET_SEQUENCE_START = 0, // codec configuration record
+    FLV_PACKET_CODED_FRAMES = 1,
+    FLV_PACKET_SEQUENCE_END = 2,
+    FLV_PACKET_CODED_FRAMES_X = 3, // coded frames, composition time 0
+    FLV_PACKET_METADATA = 4, // AMF encoded, colorInfo
+    FLV_PACKET_MPEG2TS_SEQUENCE_START = 5, // AV1 MPEG-2 TS descriptor
+    FLV_PACKET_MULTITRACK = 6,
+    FLV_PACKET_MOD_EX = 7, // modifier extension in front of the real packet type
+};
+
+enum flv_multitrack_types {
+    FLV_MULTITRACK_ONE_TRACK = 0,
+    FLV_MULTITRACK_MANY_TRACKS = 1,
+    FLV_MULTITRACK_MANY_TRACKS_MANY_CODECS = 2,
+};
+
+enum scriptdata_value_types {
+    SCRIPTDATA_NUMBER,
+    SCRIPTDATA_BOOLEAN,
+    SCRIPTDATA_STRING,
+    SCRIPTDATA_OBJECT,
+    SCRIPTDATA_MOVIE_CLIP,
+    SCRIPTDATA_NULL,
+    SCRIPTDATA_UNDEFINED,
+    SCRIPTDATA_REFERENCE,
+    SCRIPTDATA_ECMA_ARRAY,
+    SCRIPTDATA_OBJECT_END_MARKER,
+    SCRIPTDATA_STRICT_ARRAY,
+    SCRIPTDATA_DATE,
+    SCRIPTDATA_LONG_STRING,
+};
+
+/*
+ * @brief return values of the parser, visitors return 0 to go on
+ */
+enum flv_status {
+    FLV_ERROR = -1,
+    FLV_OK = 0,
+    FLV_END = 1,  // clean end of stream
+    FLV_STOP = 2, // a visitor callback returned nonzero
+};
+
+#define FLV_HEADER_SIZE (9)
+#define FLV_TAG_HEADER_SIZE (11)
+#define FLV_PREV_TAG_SIZE_SIZE (4)
+
+#define FLV_MIN_CHUNK_SIZE (64) // room for every codec header in the first chunk
+#define FLV_FILTER_PEEK_SIZE (16) // payload bytes a filter may look at, up to the Enhanced FLV FourCC
+
 /*
  * @brief flv file header 9 bytes
  */
@@ -37,69 +103,239 @@ typedef struct flv_header flv_header_t;
  * @brief flv tag general header 11 bytes
  */
 struct flv_tag {
+    uint32_t prev_tag_size; // PreviousTagSize in front of this tag
     uint8_t tag_type;
     uint32_t data_size;
-    uint32_t timestamp;
-    uint8_t timestamp_ext;
+    uint32_t timestamp; // lower 24 bits
+    uint8_t timestamp_ext; // upper 8 bits
     uint32_t stream_id;
-    void *data; // will point to an audio_tag or video_tag
+    uint64_t offset; // of the tag header, bytes from the start of the stream
+    uint64_t time; // full timestamp in ms, unwrapped past 2^24 and 2^32
 };
 
 typedef struct flv_tag flv_tag_t;
 
-typedef struct scriptdata_tag {
-    uint8_t *data;
-} scriptdata_tag_t;
-
+/*
+ * Payload pointers in the structs below are borrowed views into the parser
+ * buffer or the fed input, valid until the visitor's on_release.
+ */
 typedef struct audio_tag {
     uint8_t sound_format; // 0 - raw, 1 - ADPCM, 2 - MP3, 4 - Nellymoser 16 KHz mono, 5 - Nellymoser 8 KHz mono, 10 - AAC, 11 - Speex
     uint8_t sound_rate; // 0 - 5.5 KHz, 1 - 11 KHz, 2 - 22 KHz, 3 - 44 KHz
     uint8_t sound_size; // 0 - 8 bit, 1 - 16 bit
     uint8_t sound_type; // 0 - mono, 1 - stereo
-    void *data;
+    uint8_t aac_packet_type; // 0 - AAC sequence header, 1 - AAC raw, 255 - not AAC
+    const uint8_t *data; // AudioSpecificConfig or raw audio
+    uint32_t data_size;
 } audio_tag_t;
 
 typedef struct video_tag {
-    uint8_t frame_type;
-    uint8_t codec_id;
-    void *data;
+    uint8_t frame_type; // 1 - keyframe, 2 - inter frame, 3 - disposable inter frame, 4 - generated keyframe, 5 - command frame
+    uint8_t codec_id; // legacy codec id, or FLV_CODEC_ID_* of the FourCC, 0 for an unknown one
+    uint8_t ex_header; // Enhanced FLV, the fields below are set
+    uint8_t packet_type; // enum flv_video_packet_types, the one of the tracks when multitrack
+    uint8_t multitrack; // 0, or 1 + enum flv_multitrack_types
+    uint32_t fourcc; // of the first track, 0 for legacy video
+    const uint8_t *data; // codec specific body
+    uint32_t data_size;
 } video_tag_t;
 
 typedef struct avc_video_tag {
     uint8_t avc_packet_type; // 0x00 - AVC sequence header, 0x01 - AVC NALU
-    uint32_t composition_time;
-    uint32_t nalu_len;
-    void *data;
+    int32_t composition_time; // signed 24 bits, PTS - DTS in ms
+    int64_t pts; // presentation time in ms, the tag time is the DTS
+    uint32_t nalu_len; // length of the first NALU
+    const uint8_t *data; // AVCDecoderConfigurationRecord or length-prefixed NALUs
+    uint32_t data_size;
 } avc_video_tag_t;
 
-int flv_read_header(void);
+/*
+ * @brief one track of an Enhanced FLV video tag, a tag has one unless multitrack
+ */
+typedef struct flv_video_packet {
+    uint8_t packet_type; // enum flv_video_packet_types, never multitrack or ModEx
+    uint32_t fourcc;
+    uint8_t codec_id; // FLV_CODEC_ID_* of the FourCC, 0 for an unknown one
+    uint8_t track_id; // 0 unless multitrack
+    int32_t composition_time; // signed 24 bits, coded frames of avc1 and hvc1, 0 otherwise
+    int64_t pts; // presentation time in ms, the tag time is the DTS
+    const uint8_t *data; // configuration record, frames or metadata, by packet type
+    uint32_t data_size;
+} flv_video_packet_t;
+
+/*
+ * @brief one decoded SCRIPTDATAVALUE
+ *
+ * Depth 0 carries the tag name (a String) and its top level value, object
+ * properties come at depth 1 and deeper. Every object ends with an
+ * SCRIPTDATA_OBJECT_END_MARKER value at the depth of its properties.
+ */
+typedef struct flv_script_value {
+    uint32_t depth;
+    const char *name; // property name, not NUL terminated, NULL at depth 0
+    uint16_t name_len;
+    uint8_t type; // enum scriptdata_value_types
+    double number; // Number, Date (msec since epoch)
+    int16_t date_offset; // Date: local time offset in minutes
+    uint8_t boolean;
+    const char *string; // String, not NUL terminated
+    uint32_t string_len;
+    uint32_t items; // ECMA array, strict array
+    uint32_t size; // ECMA array: bytes of its properties
+} flv_script_value_t;
 
-flv_tag_t *flv_read_tag(void);
+/*
+ * @brief callbacks the parser drives, NULL entries are skipped
+ *
+ * A nonzero return stops the parser with FLV_STOP. For AVC video on_video
+ * is called before on_avc. Enhanced FLV video (the IsExHeader bit) gets
+ * on_video and then on_video_packet once per track; command frames get
+ * neither on_avc nor on_video_packet.
+ *
+ * on_payload gets the raw payload after the decoded callbacks of its tag,
+ * whole or, with flv_parser_set_chunk_size(), as consecutive chunks of the
+ * chunk size (the last one shorter) at the given offset into the payload.
+ * When a payload is chunked the audio and video callbacks still run on the
+ * first chunk, so their data views cover only its bytes, and script data
+ * is not decoded.
+ *
+ * The views a visitor is handed stay valid until on_release, which the
+ * parser calls before it refills or reuses the memory behind them and before
+ * flv_parser_run() or flv_parser_feed() returns. A visitor that keeps views
+ * past its callbacks, as the writer does to batch its writes, lets go of
+ * them there; on_release cannot stop the parse.
+ */
+typedef struct flv_visitor {
+    int (*on_header)(void *opaque, const flv_header_t *header);
+    int (*on_tag_header)(void *opaque, const flv_tag_t *tag);
+    int (*on_audio)(void *opaque, const flv_tag_t *tag, const audio_tag_t *audio);
+    int (*on_video)(void *opaque, const flv_tag_t *tag, const video_tag_t *video);
+    int (*on_avc)(void *opaque, const flv_tag_t *tag, const video_tag_t *video, const avc_video_tag_t *avc);
+    int (*on_video_packet)(void *opaque, const flv_tag_t *tag, const video_tag_t *video, const flv_video_packet_t *packet);
+    int (*on_script_value)(void *opaque, const flv_tag_t *tag, const flv_script_value_t *value);
+    int (*on_payload)(void *opaque, const flv_tag_t *tag, const uint8_t *data, size_t size, uint32_t offset);
+    void (*on_release)(void *opaque);
+} flv_visitor_t;
 
-void flv_print_header(flv_header_t *flv_header);
+#define FLV_FILTER_BIT(n) (UINT32_C(1) << (n))
+#define FLV_FILTER_ALL (0xffffffff)
 
-scriptdata_tag_t *read_scriptdata_tag(flv_tag_t *flv_tag);
+/*
+ * @brief tags to hand to the visitor, see flv_parser_set_filter()
+ *
+ * A tag is kept when it passes every field, flv_filter_init() sets them all
+ * to pass. Keyframes and codecs only constrain the tags they describe:
+ * keyframes drops the other video frames and leaves audio alone. Enhanced
+ * FLV video matches video_codecs by the FLV_CODEC_ID_* of its (first
+ * track's) FourCC.
+ */
+typedef struct flv_filter {
+    uint32_t tag_types; // FLV_FILTER_BIT(tag type) of the wanted types
+    int64_t stream_id; // -1 for any
+    uint64_t time_from; // ms, wanted tags have time_from <= time < time_to
+    uint64_t time_to; // the parse ends at the first tag past it
+    uint32_t min_size; // payload bytes, min_size <= data_size <= max_size
+    uint32_t max_size;
+    uint8_t keyframes; // video: keyframes only
+    uint32_t video_codecs; // FLV_FILTER_BIT(codec id) of the wanted video, see FLV_CODEC_ID_*
+    uint32_t sound_formats; // FLV_FILTER_BIT(sound format) of the wanted audio
+} flv_filter_t;
+
+enum flv_feed_states {
+    FLV_FEED_HEADER,
+    FLV_FEED_TAG_HEADER, // PreviousTagSize + tag header
+    FLV_FEED_PAYLOAD,
+    FLV_FEED_SKIP, // payload of a filtered out tag
+    FLV_FEED_DONE
+};
+
+/*
+ * @brief parser context, owned by the caller
+ *
+ * The parser allocates the read buffer of the pull path, and a payload
+ * buffer for payloads larger than that, which grows to the largest tag seen
+ * and is reused; flv_parser_close() releases both. With a chunk size the
+ * payload buffer never grows past that size.
+ *
+ * With a filter, tags it drops are skipped right after their header, by
+ * seeking where the input allows, and never reach the visitor.
+ *
+ * The input either comes from a FILE (flv_parser_run) or is pushed in
+ * arbitrary pieces with flv_parser_feed(), which keeps the partial header or
+ * tag between calls. A FILE is read through its descriptor from the offset
+ * stdio reports, so bytes already read into the stdio buffer of a pipe are
+ * lost to the parser.
+ */
+struct flv_parser {
+    FILE *in;
+    flv_reader_t reader; // over fileno(in), built on the first read
+    const flv_visitor_t *visitor;
+    void *opaque;
+    uint8_t *buf;
+    size_t buf_size;
+    flv_stats_t stats;
+    FILE *stats_out;
+    uint32_t max_tag_size; // larger tags are an error, 0 for no limit
+    uint32_t chunk_size; // larger payloads are delivered in chunks, 0 for whole payloads
+    uint64_t offset; // stream bytes consumed so far
+    const flv_filter_t *filter; // NULL to keep every tag
+    int views_out; // the visitor was handed views since the last on_release
 
-audio_tag_t *read_audio_tag(flv_tag_t *flv_tag);
+    // timestamp unwrapping
+    int have_timestamp;
+    int timestamp_wide; // timestamp_ext was set, the wrap is at 2^32
+    uint64_t last_time; // unwrapped time of the tag before
 
-video_tag_t *read_video_tag(flv_tag_t *flv_tag);
+    // flv_parser_feed() state
+    int feed_state;
+    int feed_status;
+    uint8_t feed_header[FLV_PREV_TAG_SIZE_SIZE + FLV_TAG_HEADER_SIZE];
+    size_t feed_have; // bytes of the current header or payload chunk collected
+    uint32_t feed_done; // payload bytes already delivered or skipped
+    int feed_peek; // the filter waits for the first payload bytes
+    flv_tag_t feed_tag;
+};
 
-avc_video_tag_t *read_avc_video_tag(video_tag_t *video_tag, flv_tag_t *flv_tag, uint32_t data_size);
+typedef struct flv_parser flv_parser_t;
 
 uint8_t flv_get_bits(uint8_t value, uint8_t start_bit, uint8_t count);
 
-size_t fread_1(uint8_t *ptr);
+int flv_read_header(flv_parser_t *parser);
+
+int flv_read_tag(flv_parser_t *parser);
+
+int read_scriptdata_tag(flv_parser_t *parser, const flv_tag_t *flv_tag, const uint8_t *data, size_t size);
+
+int read_audio_tag(flv_parser_t *parser, const flv_tag_t *flv_tag, const uint8_t *data, size_t size);
+
+int read_video_tag(flv_parser_t *parser, const flv_tag_t *flv_tag, const uint8_t *data, size_t size);
+
+int read_avc_video_tag(flv_parser_t *parser, const flv_tag_t *flv_tag, const video_tag_t *video_tag, const uint8_t *data, size_t size);
+
+int read_ex_video_tag(flv_parser_t *parser, const flv_tag_t *flv_tag, const video_tag_t *video_tag, const uint8_t *data, size_t size);
+
+uint8_t flv_fourcc_codec_id(uint32_t fourcc);
+
+void flv_parser_init(flv_parser_t *parser, FILE *in_file, const flv_visitor_t *visitor, void *opaque);
+
+void flv_parser_close(flv_parser_t *parser);
+
+int flv_parser_set_stats(flv_parser_t *parser, FILE *out, int signo);
+
+flv_stats_t *flv_parser_stats(flv_parser_t *parser);
+
+int flv_parser_set_chunk_size(flv_parser_t *parser, uint32_t chunk_size);
 
-size_t fread_3(uint32_t *ptr);
+uint64_t flv_parser_offset(const flv_parser_t *parser);
 
-size_t fread_4(uint32_t *ptr);
+void flv_filter_init(flv_filter_t *filter);
 
-size_t fread_4s(uint32_t *ptr);
+void flv_parser_set_filter(flv_parser_t *parser, const flv_filter_t *filter);
 
-void flv_free_tag(flv_tag_t *tag);
+int flv_parser_run(flv_parser_t *parser);
 
-void flv_parser_init(FILE *in_file);
+int flv_parser_feed(flv_parser_t *parser, const uint8_t *data, size_t size);
 
-int flv_parser_run(void);
+int flv_parser_finish(flv_parser_t *parser);
 
-#endif // FLV_PARSER_H_
\ No newline at end of file
+#endif // FLV_PARSER_H_
@@ -0,0 +1,664 @@
+/*
+ * @file flv-pipeline.c
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "flv-pipeline.h"
+#include "flv-ring.h"
+
+#define PIPELINE_DEFAULT_BLOCK_SIZE (512 * 1024)
+#define PIPELINE_DEFAULT_BLOCKS (8)
+#define PIPELINE_DEFAULT_BATCH_SIZE (1024 * 1024)
+#define PIPELINE_DEFAULT_BATCHES (4)
+#define PIPELINE_NO_VIEW (SIZE_MAX)
+
+/*
+ * @brief a read block, passed from the reader to the parse thread and back by pointer
+ */
+struct pipe_block {
+    uint8_t *data;
+    size_t size;
+    size_t len;
+    int eof; // the last block of the stream
+};
+
+enum pipe_event_kinds {
+    EVENT_HEADER,
+    EVENT_TAG_HEADER,
+    EVENT_AUDIO,
+    EVENT_VIDEO,
+    EVENT_AVC,
+    EVENT_VIDEO_PACKET,
+    EVENT_SCRIPT_VALUE,
+    EVENT_PAYLOAD
+};
+
+/*
+ * @brief one visitor call, recorded on the parse thread and replayed on the output thread
+ *
+ * view[] are the payload views among the arguments, in the order of their
+ * structs. Until the tag is flushed they point into the parser's buffers,
+ * then view_at[] locates their bytes in the data of the batch.
+ */
+struct pipe_event {
+    int kind;
+    flv_tag_t tag;
+    union {
+        flv_header_t header;
+        audio_tag_t audio;
+        struct {
+            video_tag_t video;
+            avc_video_tag_t avc;
+            flv_video_packet_t packet;
+        } video;
+        flv_script_value_t value;
+        uint32_t payload_offset;
+    } u;
+    const uint8_t *view[2];
+    size_t view_len[2];
+    size_t view_at[2];
+};
+
+/*
+ * @brief the visitor calls of one or more blocks, with copies of their payload views
+ */
+struct pipe_batch {
+    struct pipe_event *events;
+    size_t count;
+    size_t cap;
+    uint8_t *data;
+    size_t len;
+    size_t size;
+    int eof; // the last batch, status holds how the parse ended
+    int status;
+};
+
+struct pipeline {
+    int fd;
+    int wake_fd; // eventfd that stops a reader waiting for input
+    int poll_input; // reads can block, so they wait on wake_fd too
+    flv_parser_t *parser;
+    const flv_visitor_t *visitor; // the caller's, run on the output thread
+    void *opaque;
+    flv_visitor_t recorder; // the parser's, on the parse thread
+    flv_ring_t blocks_full; // reader -> parse
+    flv_ring_t blocks_free; // parse -> reader
+    flv_ring_t batches_full; // parse -> output
+    flv_ring_t batches_free; // output -> parse
+    struct pipe_block *blocks;
+    struct pipe_batch *batches;
+    unsigned block_count;
+    unsigned batch_count;
+    struct pipe_batch *batch; // being recorded
+    size_t pending; // first event of the batch whose views are not copied yet
+    int stop; // set by the output thread to wind the others down
+    int read_failed; // published with the eof block
+    int record_failed; // out of memory
+    uint64_t read_calls;
+    uint64_t bytes_read;
+    flv_stats_t output_stats; // the visitor's time on the output thread
+};
+
+static int stopped(struct pipeline *pl) {
+    return __atomic_load_n(&pl->stop, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * @brief stop the threads wherever they wait: on a ring, or for input
+ */
+static void stop_pipeline(struct pipeline *pl) {
+    uint64_t one = 1;
+
+    __atomic_store_n(&pl->stop, 1, __ATOMIC_RELEASE);
+    flv_ring_kick(&pl->blocks_full);
+    flv_ring_kick(&pl->blocks_free);
+    flv_ring_kick(&pl->batches_full);
+    flv_ring_kick(&pl->batches_free);
+    // one write cannot overflow the counter
+    (void) !write(pl->wake_fd, &one, sizeof(one));
+}
+
+/*
+ * @brief read() into the block, waiting for input only as long as the pipeline runs
+ * @return bytes read, 0 at the end of the input, -1 on error or if stopped
+ */
+static ssize_t read_block(struct pipeline *pl, struct pipe_block *block) {
+    for (;;) {
+        if (pl->poll_input) {
+            struct pollfd fds[2] = {{pl->fd, POLLIN, 0}, {pl->wake_fd, POLLIN, 0}};
+            if (poll(fds, 2, -1) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return -1;
+            }
+            if (fds[1].revents) {
+                return -1;
+            }
+        }
+        ssize_t n = read(pl->fd, block->data, block->size);
+        if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+            continue;
+        }
+        return n;
+    }
+}
+
+static void *reader_main(void *arg) {
+    struct pipeline *pl = arg;
+
+    for (;;) {
+        struct pipe_block *block = flv_ring_pop_wait(&pl->blocks_free, &pl->stop);
+        if (!block) {
+            return NULL;
+        }
+
+        ssize_t n = read_block(pl, block);
+        if (n < 0 && stopped(pl)) {
+            return NULL;
+        }
+        if (n < 0) {
+            pl->read_failed = 1;
+        } else if (n > 0) {
+            pl->read_calls++;
+            pl->bytes_read += n;
+        }
+        block->len = n > 0 ? (size_t) n : 0;
+        block->eof = n <= 0;
+
+        if (flv_ring_push_wait(&pl->blocks_full, block, &pl->stop) < 0 || block->eof) {
+            return NULL;
+        }
+    }
+}
+
+/*
+ * @brief room for need units in *buf, doubling its capacity
+ */
+static int reserve(void **buf, size_t *cap, size_t need, size_t unit) {
+    size_t cap2 = *cap ? *cap : 64;
+
+    if (need <= *cap) {
+        return 0;
+    }
+    while (cap2 < need) {
+        cap2 *= 2;
+    }
+    void *p = realloc(*buf, cap2 * unit);
+    if (!p) {
+        return -1;
+    }
+    *buf = p;
+    *cap = cap2;
+    return 0;
+}
+
+/*
+ * @brief copy the views of the events from pl->pending on into the batch
+ *
+ * The views of a tag lie in its payload, so the bytes from the lowest to the
+ * end of the highest are copied once and the views become offsets into them.
+ * Views that do not share a payload are copied one by one.
+ * @return 0, or -1 if out of memory
+ */
+static int flush_views(struct pipeline *pl) {
+    struct pipe_batch *batch = pl->batch;
+    const uint8_t *lo = NULL;
+    const uint8_t *hi = NULL;
+    size_t span_size = 0;
+
+    for (size_t i = pl->pending; i < batch->count; i++) {
+        struct pipe_event *ev = &batch->events[i];
+        for (int k = 0; k < 2; k++) {
+            if (!ev->view[k]) {
+                continue;
+            }
+            if (!lo || ev->view[k] < lo) {
+                lo = ev->view[k];
+            }
+            if (!hi || ev->view[k] + ev->view_len[k] > hi) {
+                hi = ev->view[k] + ev->view_len[k];
+            }
+            if (ev->tag.data_size > span_size) {
+                span_size = ev->tag.data_size;
+            }
+        }
+    }
+    int shared = lo && (size_t) (hi - lo) <= span_size;
+    if (shared) {
+        if (reserve((void **) &batch->data, &batch->size, batch->len + (size_t) (hi - lo), 1) < 0) {
+            goto fail;
+        }
+        memcpy(batch->data + batch->len, lo, (size_t) (hi - lo));
+    }
+
+    for (size_t i = pl->pending; i < batch->count; i++) {
+        struct pipe_event *ev = &batch->events[i];
+        for (int k = 0; k < 2; k++) {
+            if (!ev->view[k]) {
+                ev->view_at[k] = PIPELINE_NO_VIEW;
+            } else if (shared) {
+                ev->view_at[k] = batch->len + (size_t) (ev->view[k] - lo);
+            } else {
+                size_t at = batch->len;
+                if (reserve((void **) &batch->data, &batch->size, at + ev->view_len[k], 1) < 0) {
+                    goto fail;
+                }
+                memcpy(batch->data + at, ev->view[k], ev->view_len[k]);
+                ev->view_at[k] = at;
+                batch->len += ev->view_len[k];
+            }
+            ev->view[k] = NULL;
+        }
+    }
+    if (shared) {
+        batch->len += (size_t) (hi - lo);
+    }
+    pl->pending = batch->count;
+    return 0;
+
+fail:
+    // the events without their views are dropped
+    batch->count = pl->pending;
+    pl->record_failed = 1;
+    return -1;
+}
+
+/*
+ * @brief append an event to the batch
+ * @return the event, or NULL if the parse is to stop
+ */
+static struct pipe_event *record(struct pipeline *pl, int kind, const flv_tag_t *tag) {
+    struct pipe_batch *batch = pl->batch;
+
+    if (stopped(pl)) {
+        return NULL;
+    }
+    if (reserve((void **) &batch->events, &batch->cap, batch->count + 1, sizeof(struct pipe_event)) < 0) {
+        pl->record_failed = 1;
+        return NULL;
+    }
+    struct pipe_event *ev = &batch->events[batch->count++];
+    ev->kind = kind;
+    if (tag) {
+        ev->tag = *tag;
+    }
+    ev->view[0] = ev->view[1] = NULL;
+    ev->view_len[0] = ev->view_len[1] = 0;
+    return ev;
+}
+
+static void set_view(struct pipe_event *ev, int k, const void *data, size_t size) {
+    ev->view[k] = data;
+    ev->view_len[k] = size;
+}
+
+static int record_header(void *opaque, const flv_header_t *header) {
+    struct pipe_event *ev = record(opaque, EVENT_HEADER, NULL);
+
+    if (!ev) {
+        return 1;
+    }
+    ev->u.header = *header;
+    return 0;
+}
+
+static int record_tag_header(void *opaque, const flv_tag_t *tag) {
+    struct pipeline *pl = opaque;
+
+    // the payload buffer of the tag before is about to be refilled
+    if (flush_views(pl) < 0) {
+        return 1;
+    }
+    if (pl->visitor->on_tag_header && !record(pl, EVENT_TAG_HEADER, tag)) {
+        return 1;
+    }
+    return 0;
+}
+
+static int record_audio(void *opaque, const flv_tag_t *tag, const audio_tag_t *audio) {
+    struct pipe_event *ev = record(opaque, EVENT_AUDIO, tag);
+
+    if (!ev) {
+        return 1;
+    }
+    ev->u.audio = *audio;
+    set_view(ev, 0, audio->data, audio->data_size);
+    return 0;
+}
+
+static int record_video(void *opaque, const flv_tag_t *tag, const video_tag_t *video) {
+    struct pipe_event *ev = record(opaque, EVENT_VIDEO, tag);
+
+    if (!ev) {
+        return 1;
+    }
+    ev->u.video.video = *video;
+    set_view(ev, 0, video->data, video->data_size);
+    return 0;
+}
+
+static int record_avc(void *opaque, const flv_tag_t *tag, const video_tag_t *video, const avc_video_tag_t *avc) {
+    struct pipe_event *ev = record(opaque, EVENT_AVC, tag);
+
+    if (!ev) {
+        return 1;
+    }
+    ev->u.video.video = *video;
+    ev->u.video.avc = *avc;
+    set_view(ev, 0, video->data, video->data_size);
+    set_view(ev, 1, avc->data, avc->data_size);
+    return 0;
+}
+
+static int record_video_packet(void *opaque, const flv_tag_t *tag, const video_tag_t *video, const flv_video_packet_t *packet) {
+    struct pipe_event *ev = record(opaque, EVENT_VIDEO_PACKET, tag);
+
+    if (!ev) {
+        return 1;
+    }
+    ev->u.video.video = *video;
+    ev->u.video.packet = *packet;
+    set_view(ev, 0, video->data, video->data_size);
+    set_view(ev, 1, packet->data, packet->data_size);
+    return 0;
+}
+
+static int record_script_value(void *opaque, const flv_tag_t *tag, const flv_script_value_t *value) {
+    struct pipe_event *ev = record(opaque, EVENT_SCRIPT_VALUE, tag);
+
+    if (!ev) {
+        return 1;
+    }
+    ev->u.value = *value;
+    set_view(ev, 0, value->name, value->name_len);
+    set_view(ev, 1, value->string, value->string_len);
+    return 0;
+}
+
+static int record_payload(void *opaque, const flv_tag_t *tag, const uint8_t *data, size_t size, uint32_t offset) {
+    struct pipeline *pl = opaque;
+
+    if (pl->visitor->on_payload) {
+        struct pipe_event *ev = record(pl, EVENT_PAYLOAD, tag);
+        if (!ev) {
+            return 1;
+        }
+        ev->u.payload_offset = offset;
+        set_view(ev, 0, data, size);
+    }
+    // the next chunk of the payload reuses its buffer
+    return flush_views(pl) < 0;
+}
+
+/*
+ * @brief run the batch's visitor calls on the caller's visitor
+ * @return 0, or nonzero if the visitor stopped the parse
+ */
+static int replay(struct pipeline *pl, struct pipe_batch *batch) {
+    const flv_visitor_t *visitor = pl->visitor;
+    void *opaque = pl->opaque;
+    int ret = 0;
+
+    for (size_t i = 0; ret == 0 && i < batch->count; i++) {
+        struct pipe_event *ev = &batch->events[i];
+        const uint8_t *view[2];
+
+        for (int k = 0; k < 2; k++) {
+            view[k] = ev->view_at[k] == PIPELINE_NO_VIEW ? NULL : batch->data + ev->view_at[k];
+        }
+        switch (ev->kind) {
+            case EVENT_HEADER:
+                ret = visitor->on_header(opaque, &ev->u.header);
+                break;
+            case EVENT_TAG_HEADER:
+                ret = visitor->on_tag_header(opaque, &ev->tag);
+                break;
+            case EVENT_AUDIO:
+                ev->u.audio.data = view[0];
+                ret = visitor->on_audio(opaque, &ev->tag, &ev->u.audio);
+                break;
+            case EVENT_VIDEO:
+                ev->u.video.video.data = view[0];
+                ret = visitor->on_video(opaque, &ev->tag, &ev->u.video.video);
+                break;
+            case EVENT_AVC:
+                ev->u.video.video.data = view[0];
+                ev->u.video.avc.data = view[1];
+                ret = visitor->on_avc(opaque, &ev->tag, &ev->u.video.video, &ev->u.video.avc);
+                break;
+            case EVENT_VIDEO_PACKET:
+                ev->u.video.video.data = view[0];
+                ev->u.video.packet.data = view[1];
+                ret = visitor->on_video_packet(opaque, &ev->tag, &ev->u.video.video, &ev->u.video.packet);
+                break;
+            case EVENT_SCRIPT_VALUE:
+                ev->u.value.name = (const char *) view[0];
+                ev->u.value.string = (const char *) view[1];
+                ret = visitor->on_script_value(opaque, &ev->tag, &ev->u.value);
+                break;
+            case EVENT_PAYLOAD:
+                ret = visitor->on_payload(opaque, &ev->tag, view[0], ev->view_len[0], ev->u.payload_offset);
+                break;
+        }
+    }
+    return ret;
+}
+
+/*
+ * @brief feed the blocks to the parser, handing the recorded calls on per block
+ */
+static void *parse_main(void *arg) {
+    struct pipeline *pl = arg;
+    flv_parser_t *parser = pl->parser;
+    int ret = FLV_OK;
+
+    pl->batch = flv_ring_pop_wait(&pl->batches_free, &pl->stop);
+    if (!pl->batch) {
+        return NULL;
+    }
+    pl->pending = 0;
+
+    for (;;) {
+        struct pipe_block *block = flv_ring_pop_wait(&pl->blocks_full, &pl->stop);
+        if (!block) {
+            return NULL;
+        }
+        if (block->len) {
+            ret = flv_parser_feed(parser, block->data, block->len);
+        }
+        // views into the block, before the reader refills it
+        if (flush_views(pl) < 0) {
+            ret = FLV_ERROR;
+        }
+        int eof = block->eof || ret != FLV_OK;
+        if (flv_ring_push_wait(&pl->blocks_free, block, &pl->stop) < 0) {
+            return NULL;
+        }
+
+        if (parser->stats_out && flv_stats_signaled()) {
+            flv_stats_print(&parser->stats, parser->stats_out);
+        }
+        if (!eof && pl->batch->count == 0) {
+            continue;
+        }
+        pl->batch->eof = eof;
+        pl->batch->status = ret;
+        if (flv_ring_push_wait(&pl->batches_full, pl->batch, &pl->stop) < 0 || eof) {
+            return NULL;
+        }
+        pl->batch = flv_ring_pop_wait(&pl->batches_free, &pl->stop);
+        if (!pl->batch) {
+            return NULL;
+        }
+        pl->pending = 0;
+    }
+}
+
+static int init_ring(flv_ring_t *ring, unsigned count) {
+    uint32_t capacity = 1;
+
+    while (capacity < count) {
+        capacity *= 2;
+    }
+    return flv_ring_init(ring, capacity);
+}
+
+/*
+ * @brief the recorder calls what the caller's visitor has, plus on_tag_header
+ *        and on_payload, where the views of a tag are copied
+ */
+static void init_recorder(flv_visitor_t *recorder, const flv_visitor_t *visitor) {
+    memset(recorder, 0, sizeof(*recorder));
+    recorder->on_header = visitor->on_header ? record_header : NULL;
+    recorder->on_tag_header = record_tag_header;
+    recorder->on_audio = visitor->on_audio ? record_audio : NULL;
+    recorder->on_video = visitor->on_video ? record_video : NULL;
+    recorder->on_avc = visitor->on_avc ? record_avc : NULL;
+    recorder->on_video_packet = visitor->on_video_packet ? record_video_packet : NULL;
+    recorder->on_script_value = visitor->on_script_value ? record_script_value : NULL;
+    recorder->on_payload = record_payload;
+}
+
+/*
+ * @brief parse the stream on fd, with the visitor running on the calling thread
+ * @return FLV_END, FLV_STOP or FLV_ERROR, as flv_parser_run()
+ */
+int flv_pipeline_run(flv_parser_t *parser, int fd, const flv_pipeline_opts_t *in_opts) {
+    flv_pipeline_opts_t opts = *in_opts;
+    struct pipeline pl;
+    struct stat st;
+    pthread_t reader;
+    pthread_t parse;
+    int visitor_stopped = 0;
+    int ret = FLV_ERROR;
+
+    if (opts.block_size == 0) {
+        opts.block_size = PIPELINE_DEFAULT_BLOCK_SIZE;
+    }
+    if (opts.blocks == 0) {
+        opts.blocks = PIPELINE_DEFAULT_BLOCKS;
+    }
+    if (opts.batch_size == 0) {
+        opts.batch_size = PIPELINE_DEFAULT_BATCH_SIZE;
+    }
+    if (opts.batches < 2) {
+        opts.batches = PIPELINE_DEFAULT_BATCHES;
+    }
+
+    memset(&pl, 0, sizeof(pl));
+    pl.fd = fd;
+    pl.poll_input = fstat(fd, &st) < 0 || !S_ISREG(st.st_mode);
+    pl.parser = parser;
+    pl.visitor = parser->visitor;
+    pl.opaque = parser->opaque;
+    init_recorder(&pl.recorder, parser->visitor);
+    flv_stats_reset(&pl.output_stats);
+    pl.wake_fd = eventfd(0, EFD_CLOEXEC);
+    pl.blocks = calloc(opts.blocks, sizeof(struct pipe_block));
+    pl.batches = calloc(opts.batches, sizeof(struct pipe_batch));
+    if (pl.wake_fd < 0 || !pl.blocks || !pl.batches ||
+        init_ring(&pl.blocks_full, opts.blocks) < 0 || init_ring(&pl.blocks_free, opts.blocks) < 0 ||
+        init_ring(&pl.batches_full, opts.batches) < 0 || init_ring(&pl.batches_free, opts.batches) < 0) {
+        goto out;
+    }
+    for (; pl.block_count < opts.blocks; pl.block_count++) {
+        struct pipe_block *block = &pl.blocks[pl.block_count];
+        block->data = malloc(opts.block_size);
+        if (!block->data) {
+            goto out;
+        }
+        block->size = opts.block_size;
+        flv_ring_push(&pl.blocks_free, block);
+    }
+    for (; pl.batch_count < opts.batches; pl.batch_count++) {
+        struct pipe_batch *batch = &pl.batches[pl.batch_count];
+        batch->data = malloc(opts.batch_size);
+        if (!batch->data) {
+            goto out;
+        }
+        batch->size = opts.batch_size;
+        flv_ring_push(&pl.batches_free, batch);
+    }
+
+    parser->visitor = &pl.recorder;
+    parser->opaque = &pl;
+    if (pthread_create(&reader, NULL, reader_main, &pl) != 0) {
+        goto restore;
+    }
+    if (pthread_create(&parse, NULL, parse_main, &pl) != 0) {
+        stop_pipeline(&pl);
+        pthread_join(reader, NULL);
+        goto restore;
+    }
+
+    // the output stage: the parse thread always ends with an eof batch
+    for (;;) {
+        struct pipe_batch *batch = flv_ring_pop_wait(&pl.batches_full, &pl.stop);
+        int stage = FLV_STATS_ENTER(&pl.output_stats, FLV_STAGE_OUTPUT);
+        visitor_stopped = replay(&pl, batch) != 0;
+        if (pl.visitor->on_release) {
+            // the views point into the batch, which goes back to the parse thread
+            pl.visitor->on_release(pl.opaque);
+        }
+        FLV_STATS_ENTER(&pl.output_stats, stage);
+
+        int eof = batch->eof;
+        batch->count = 0;
+        batch->len = 0;
+        batch->eof = 0;
+        flv_ring_push_wait(&pl.batches_free, batch, &pl.stop);
+        if (visitor_stopped || eof) {
+            break;
+        }
+    }
+
+    stop_pipeline(&pl);
+    pthread_join(reader, NULL);
+    pthread_join(parse, NULL);
+    parser->visitor = pl.visitor;
+    parser->opaque = pl.opaque;
+
+    FLV_STATS_ADD(&parser->stats, read_calls, pl.read_calls);
+    FLV_STATS_ADD(&parser->stats, bytes_read, pl.bytes_read);
+    FLV_STATS_ADD(&parser->stats, stage_ns[FLV_STAGE_OUTPUT], pl.output_stats.stage_ns[FLV_STAGE_OUTPUT]);
+    ret = flv_parser_finish(parser);
+    if (visitor_stopped) {
+        ret = FLV_STOP;
+    } else if (pl.record_failed || (ret == FLV_END && pl.read_failed)) {
+        ret = FLV_ERROR;
+    }
+    goto out;
+
+restore:
+    parser->visitor = pl.visitor;
+    parser->opaque = pl.opaque;
+out:
+    for (unsigned i = 0; i < pl.block_count; i++) {
+        free(pl.blocks[i].data);
+    }
+    for (unsigned i = 0; i < pl.batch_count; i++) {
+        free(pl.batches[i].events);
+        free(pl.batches[i].data);
+    }
+    free(pl.blocks);
+    free(pl.batches);
+    flv_ring_free(&pl.blocks_full);
+    flv_ring_free(&pl.blocks_free);
+    flv_ring_free(&pl.batches_full);
+    flv_ring_free(&pl.batches_free);
+    if (pl.wake_fd >= 0) {
+        close(pl.wake_fd);
+    }
+    return ret;
+}
@@ -0,0 +1,35 @@
+/*
+ * @file flv-pipeline.h
+ *
+ * Three-stage parse of a single stream: a reader thread fills large blocks
+ * with read(), a parse thread feeds them to flv_parser_feed() as they are,
+ * and the calling thread runs the visitor, so I/O, decoding and the
+ * visitor's formatting and writes overlap. The parse thread records the
+ * visitor calls of each block into a batch, with a copy of the payload bytes
+ * their views cover, and the calling thread replays them in order. The
+ * visitor's on_release comes once per batch, after its replay.
+ *
+ * The stages pass block and batch descriptors over lock-free
+ * single-producer single-consumer rings; a fixed number of each gives the
+ * backpressure, and a stage with nothing to do sleeps on a futex. The
+ * reader waits for a pipe or socket together with an eventfd, so the
+ * pipeline stops without waiting for more input.
+ */
+
+#ifndef FLV_PIPELINE_H_
+#define FLV_PIPELINE_H_ (1)
+
+#include <stddef.h>
+
+#include "flv-parser.h"
+
+typedef struct flv_pipeline_opts {
+    size_t block_size;  // bytes per read, default 512 KiB
+    unsigned blocks;    // read buffers, default 8
+    size_t batch_size;  // payload bytes a batch holds before it grows, default 1 MiB
+    unsigned batches;   // batches between the parse and the calling thread, default 4
+} flv_pipeline_opts_t;
+
+int flv_pipeline_run(flv_parser_t *parser, int fd, const flv_pipeline_opts_t *opts);
+
+#endif // FLV_PIPELINE_H_
@@ -0,0 +1,443 @@
+/*
+ * @file flv-print.c
+ *
+ * The human-readable dump of the command line tool, one visitor of the parser.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <time.h>
+#include <inttypes.h>
+
+#include "flv-print.h"
+#include "flv-log.h"
+
+int flv_log_level = LOG_LEVEL;
+
+static const char *scriptdata_value_type_names[] = {
+    "Number",       // DOUBLE
+    "Boolean",      // UI8
+    "String",       // SCRIPTDATASTRING:      {Length UI16, Data STRING(no terminating NUL)}
+    "Object",       // SCRIPTDATAOBJECT       {Properties, List Terminator}
+    "MovieClip",    // (reserved, not supported)
+    "Null",
+    "Undefined",
+    "Reference",    // UI16
+    "ECMA array",   // SCRIPTDATAECMAARRAY    {Length UI32, Variables, List Terminator}
+    "Object end marker",
+    "Strict array", // SCRIPTDATASTRICTARRAY: {Length UI32, Value SCRIPTDATAVALUE[Length]}
+    "Date",         // SCRIPTDATADATE:        {DateTime DOUBLE, LocalDateTimeOffset SI16}
+    "Long string",  // SCRIPTDATALONGSTRING:  {Length UI32, Data STRING(no terminating NUL)}
+};
+
+static const char *sound_formats[] = {
+        "Linear PCM, platform endian",
+        "ADPCM",
+        "MP3",
+        "Linear PCM, little endian",
+        "Nellymoser 16-kHz mono",
+        "Nellymoser 8-kHz mono",
+        "Nellymoser",
+        "G.711 A-law logarithmic PCM",
+        "G.711 mu-law logarithmic PCM",
+        "not defined by standard",
+        "AAC",
+        "Speex",
+        "not defined by standard",
+        "not defined by standard",
+        "MP3 8-Khz",
+        "Device-specific sound"
+};
+
+static const char *sound_rates[] = {
+        "5.5-Khz",
+        "11-Khz",
+        "22-Khz",
+        "44-Khz"
+};
+
+static const char *sound_sizes[] = {
+        "8 bit",
+        "16 bit"
+};
+
+static const char *sound_types[] = {
+        "Mono",
+        "Stereo"
+};
+
+static const char *frame_types[] = {
+        "not defined by standard",
+        "keyframe (for AVC, a seekable frame)",
+        "inter frame (for AVC, a non-seekable frame)",
+        "disposable inter frame (H.263 only)",
+        "generated keyframe (reserved for server use only)",
+        "video info/command frame"
+};
+
+static const char *codec_ids[] = {
+        "not defined by standard",
+        "JPEG (currently unused)",
+        "Sorenson H.263",
+        "Screen video",
+        "On2 VP6",
+        "On2 VP6 with alpha channel",
+        "Screen video version 2",
+        "AVC",
+        "not defined by standard",
+        "not defined by standard",
+        "not defined by standard",
+        "not defined by standard",
+        "HEVC",
+        "AV1",
+        "VP9"
+};
+
+static const char *video_packet_types[] = {
+        "sequence start",
+        "coded frames",
+        "sequence end",
+        "coded frames, no composition time",
+        "metadata",
+        "MPEG-2 TS sequence start",
+        "multitrack",
+        "ModEx"
+};
+
+static const char *multitrack_types[] = {
+        "one track",
+        "many tracks",
+        "many tracks, many codecs"
+};
+
+static const char *avc_packet_types[] = {
+        "AVC sequence header",
+        "AVC NALU",
+        "AVC end of sequence (lower level NALU sequence ender is not required or supported)"
+};
+
+#define NAME_OF(names, value) name_of(names, sizeof(names) / sizeof(names[0]), value)
+
+/*
+ * @brief entry of a name table, streams may carry values past its end
+ */
+static const char *name_of(const char *const *names, size_t count, unsigned value) {
+    return value < count ? names[value] : "not defined by standard";
+}
+
+void flv_set_log_level(int level) {
+    flv_log_level = level;
+}
+
+void flv_print_header(const flv_header_t *flv_header) {
+
+    flv_log_info("FLV file version %u\n", flv_header->version);
+    flv_log_debug("  Contains audio tags: %s\n", (flv_header->type_flags & (1 << FLV_HEADER_AUDIO_BIT)) ? "Yes" : "No");
+    flv_log_debug("  Contains video tags: %s\n", (flv_header->type_flags & (1 << FLV_HEADER_VIDEO_BIT)) ? "Yes" : "No");
+    flv_log_debug("  Data offset: %lu\n", (unsigned long) flv_header->data_offset);
+
+    return;
+}
+
+static int print_header(void *opaque, const flv_header_t *header) {
+    (void) opaque;
+    flv_print_header(header);
+    return 0;
+}
+
+static void print_general_tag_info(const flv_tag_t *tag) {
+    uint32_t timestamp = ((uint32_t) tag->timestamp_ext << 24) | tag->timestamp;
+
+    flv_log_debug("  Offset: %" PRIu64 "\n", tag->offset);
+    flv_log_debug("  Data size: %lu\n", (unsigned long) tag->data_size);
+    if (tag->time == timestamp) {
+        flv_log_debug("  Timestamp: %lu\n", (unsigned long) timestamp);
+    } else {
+        flv_log_debug("  Timestamp: %" PRIu64 " (wrapped, stored as %lu)\n", tag->time, (unsigned long) timestamp);
+    }
+    flv_log_debug("  StreamID: %lu\n", (unsigned long) tag->stream_id);
+
+    return;
+}
+
+static int print_tag_header(void *opaque, const flv_tag_t *tag) {
+    flv_print_t *print = opaque;
+
+    flv_log_debug("Prev tag size: %lu\n", (unsigned long) tag->prev_tag_size);
+    flv_log_debug("\n");
+
+    switch (tag->tag_type) {
+        case TAGTYPE_AUDIODATA:
+            flv_log_info("Tag type: %u - Audio data #%d\n", tag->tag_type, print->a_count);
+            print->a_count++;
+            break;
+        case TAGTYPE_VIDEODATA:
+            flv_log_info("Tag type: %u - Video data #%d\n", tag->tag_type, print->v_count);
+            print->v_count++;
+            break;
+        case TAGTYPE_SCRIPTDATAOBJECT:
+            flv_log_info("Tag type: %u - Script data object\n", tag->tag_type);
+            break;
+        default:
+            flv_log_err("Tag type: %u - Unknown tag type!\n", tag->tag_type);
+            return 0;
+    }
+    print_general_tag_info(tag);
+
+    return 0;
+}
+
+static int print_audio(void *opaque, const flv_tag_t *flv_tag, const audio_tag_t *tag) {
+    (void) opaque;
+    (void) flv_tag;
+
+    flv_log_debug("  Audio tag:\n");
+    flv_log_debug("    Sound format: %u - %s\n", tag->sound_format, sound_formats[tag->sound_format]);
+    flv_log_debug("    Sound rate: %u - %s\n", tag->sound_rate, sound_rates[tag->sound_rate]);
+
+    flv_log_debug("    Sound size: %u - %s\n", tag->sound_size, sound_sizes[tag->sound_size]);
+    flv_log_debug("    Sound type: %u - %s\n", tag->sound_type, sound_types[tag->sound_type]);
+
+    if (tag->sound_format == FLV_SOUND_FORMAT_AAC) {
+        flv_log_debug("      AAC packet type: %u - %s\n", tag->aac_packet_type, (tag->aac_packet_type == 0) ? "AAC sequence header" : "AAC raw");
+    }
+
+    if (tag->aac_packet_type == 0 && tag->data_size > 0 && FLV_LOG_ENABLED(DEBUG)) {
+        const uint8_t *p = tag->data;
+        const uint8_t *p_end = p + tag->data_size;
+
+        flv_log_debug("      AAC AudioSpecificConfig:");
+        while (p < p_end) {
+            flv_log_debug(" 0x%x", *p++);
+        }
+        flv_log_debug("\n");
+    }
+
+    return 0;
+}
+
+/*
+ * @brief FourCC as text, unprintable bytes as '.'
+ */
+static const char *fourcc_str(uint32_t fourcc, char *str) {
+    for (int i = 0; i < 4; i++) {
+        char c = (char) (fourcc >> (24 - 8 * i));
+        str[i] = (c >= 0x20 && c < 0x7f) ? c : '.';
+    }
+    return str;
+}
+
+static int print_video(void *opaque, const flv_tag_t *flv_tag, const video_tag_t *tag) {
+    char fourcc[4];
+    (void) opaque;
+    (void) flv_tag;
+
+    flv_log_debug("  Video tag:\n");
+    flv_log_debug("    Frame type: %u - %s\n", tag->frame_type, NAME_OF(frame_types, tag->frame_type));
+    flv_log_debug("    Codec ID: %u - %s\n", tag->codec_id, NAME_OF(codec_ids, tag->codec_id));
+    if (tag->ex_header) {
+        flv_log_debug("    Enhanced FLV packet type: %u - %s\n", tag->packet_type, NAME_OF(video_packet_types, tag->packet_type));
+        if (tag->fourcc) {
+            // none on command frames and truncated headers
+            flv_log_debug("    FourCC: %.4s\n", fourcc_str(tag->fourcc, fourcc));
+        }
+        if (tag->multitrack) {
+            flv_log_debug("    Multitrack: %s\n", NAME_OF(multitrack_types, tag->multitrack - 1));
+        }
+    }
+
+    return 0;
+}
+
+static int print_avc(void *opaque, const flv_tag_t *flv_tag, const video_tag_t *video_tag, const avc_video_tag_t *tag) {
+    (void) opaque;
+    (void) video_tag;
+
+    flv_log_debug("    AVC video tag:\n");
+    flv_log_debug("      AVC packet type: %u - %s\n", tag->avc_packet_type, NAME_OF(avc_packet_types, tag->avc_packet_type));
+    flv_log_debug("      AVC composition time: %" PRId32 "\n", tag->composition_time);
+    flv_log_debug("      DTS: %" PRIu64 " PTS: %" PRId64 "\n", flv_tag->time, tag->pts);
+    flv_log_debug("      AVC 1st nalu length: %i\n", tag->nalu_len);
+    flv_log_debug("      AVC packet data length: %lu\n", (unsigned long) tag->data_size);
+
+    return 0;
+}
+
+static int print_video_packet(void *opaque, const flv_tag_t *flv_tag, const video_tag_t *video_tag, const flv_video_packet_t *packet) {
+    char fourcc[4];
+    (void) opaque;
+
+    flv_log_debug("    %s track %u:\n", video_tag->multitrack ? "Multitrack" : "Video", packet->track_id);
+    flv_log_debug("      FourCC: %.4s - %s\n", fourcc_str(packet->fourcc, fourcc), NAME_OF(codec_ids, packet->codec_id));
+    flv_log_debug("      Packet type: %u - %s\n", packet->packet_type, NAME_OF(video_packet_types, packet->packet_type));
+    if (packet->packet_type == FLV_PACKET_CODED_FRAMES || packet->packet_type == FLV_PACKET_CODED_FRAMES_X) {
+        flv_log_debug("      Composition time: %" PRId32 "\n", packet->composition_time);
+        flv_log_debug("      DTS: %" PRIu64 " PTS: %" PRId64 "\n", flv_tag->time, packet->pts);
+    }
+    flv_log_debug("      Packet data length: %lu\n", (unsigned long) packet->data_size);
+
+    return 0;
+}
+
+/*
+ * @brief whether flv_print_script_value() has a format for a property type
+ */
+static int script_property_known(uint8_t type) {
+    switch (type) {
+        case SCRIPTDATA_OBJECT_END_MARKER:
+        case SCRIPTDATA_NUMBER:
+        case SCRIPTDATA_BOOLEAN:
+        case SCRIPTDATA_STRING:
+        case SCRIPTDATA_OBJECT:
+        case SCRIPTDATA_STRICT_ARRAY:
+        case SCRIPTDATA_DATE:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/*
+ * @brief print a script data value in the format of the dump, whatever the log level
+ */
+void flv_print_script_value(const flv_script_value_t *value) {
+    if (value->depth == 0) {
+        if (value->type == SCRIPTDATA_STRING) {
+            printf("  Scriptdata tag:\n");
+            printf("    Name:  %.*s\n", (int) value->string_len, value->string);
+        } else {
+            printf("    Value: %s (%u items, %lu bytes)\n", scriptdata_value_type_names[value->type], value->items, (unsigned long) value->size);
+        }
+        return;
+    }
+
+    int name_len = value->name_len;
+    const char *name = value->name;
+    const char *type_name = value->type <= SCRIPTDATA_LONG_STRING ? scriptdata_value_type_names[value->type] : "";
+
+    switch (value->type) {
+        case SCRIPTDATA_OBJECT_END_MARKER:
+            printf("      Property: %s\n", type_name);
+            if (value->depth > 1) {
+                printf("        ---- end Object ----\n");
+            }
+            break;
+        case SCRIPTDATA_NUMBER:
+            printf("      Property: %.*s %s %f\n", name_len, name, type_name, value->number);
+            break;
+        case SCRIPTDATA_BOOLEAN:
+            printf("      Property: %.*s %s %u\n", name_len, name, type_name, value->boolean);
+            break;
+        case SCRIPTDATA_STRING:
+            printf("      Property: %.*s %s %.*s\n", name_len, name, type_name, (int) value->string_len, value->string);
+            break;
+        case SCRIPTDATA_OBJECT:
+            printf("      Property: %.*s %s\n", name_len, name, type_name);
+            printf("        ---- begin Object ----\n");
+            break;
+        case SCRIPTDATA_STRICT_ARRAY:
+            printf("      property: %.*s %s %u[items]\n", name_len, name, type_name, value->items);
+            break;
+        case SCRIPTDATA_DATE:
+            {
+                /*
+                struct timespec ts;
+                ts.tv_sec = date_time_ms / 1000.0;
+                ts.tv_nsec = (date_time_ms - ts.tv_sec * 1000) * 1000 * 1000;
+                */
+                double date_time_ms = value->number;
+                struct tm local_time = {0};
+                time_t date_time_sec = date_time_ms / 1000.0;
+                localtime_r(&date_time_sec, &local_time);
+
+                char date[256];
+                strftime(date, sizeof(date), "%F %T %z (%Z)", &local_time);
+
+                printf("      property: %.*s %s %f[msec] %ld[sec] %s\n",
+                    name_len,
+                    name,
+                    type_name,
+                    date_time_ms,
+                    date_time_sec,
+                    date
+                    );
+            }
+            break;
+        default:
+            printf("      Unknown property: %.*s %u %s\n", name_len, name, value->type, type_name);
+            break;
+    }
+}
+
+static int print_script_value(void *opaque, const flv_tag_t *flv_tag, const flv_script_value_t *value) {
+    (void) opaque;
+    (void) flv_tag;
+
+    // an unknown property is an error, the rest debug output
+    if ((value->depth == 0 || script_property_known(value->type)) ? FLV_LOG_ENABLED(DEBUG) : FLV_LOG_ENABLED(ERR)) {
+        flv_print_script_value(value);
+    }
+    return 0;
+}
+
+const flv_visitor_t flv_print_visitor = {
+    .on_header = print_header,
+    .on_tag_header = print_tag_header,
+    .on_audio = print_audio,
+    .on_video = print_video,
+    .on_avc = print_avc,
+    .on_video_packet = print_video_packet,
+    .on_script_value = print_script_value,
+};
+
+static int summary_tag_header(void *opaque, const flv_tag_t *tag) {
+    flv_summary_t *summary = opaque;
+
+    if (summary->tags == 0) {
+        summary->first_timestamp = tag->time;
+    }
+    summary->last_timestamp = tag->time;
+    summary->tags++;
+    summary->payload_bytes += tag->data_size;
+    switch (tag->tag_type) {
+        case TAGTYPE_AUDIODATA:
+            summary->audio_tags++;
+            break;
+        case TAGTYPE_VIDEODATA:
+            summary->video_tags++;
+            break;
+        case TAGTYPE_SCRIPTDATAOBJECT:
+            summary->scriptdata_tags++;
+            break;
+    }
+
+    return 0;
+}
+
+static int summary_video(void *opaque, const flv_tag_t *flv_tag, const video_tag_t *tag) {
+    flv_summary_t *summary = opaque;
+    (void) flv_tag;
+
+    if (tag->frame_type == 1) {
+        summary->keyframes++;
+    }
+    return 0;
+}
+
+const flv_visitor_t flv_summary_visitor = {
+    .on_tag_header = summary_tag_header,
+    .on_video = summary_video,
+};
+
+void flv_print_summary(const char *name, const flv_summary_t *summary) {
+    printf("%s: %" PRIu64 " tags (%" PRIu64 " audio, %" PRIu64 " video, %" PRIu64 " scriptdata), "
+           "%" PRIu64 " keyframes, %" PRIu64 " payload bytes, %" PRIu64 " ms\n",
+           name,
+           summary->tags,
+           summary->audio_tags,
+           summary->video_tags,
+           summary->scriptdata_tags,
+           summary->keyframes,
+           summary->payload_bytes,
+           summary->last_timestamp - summary->first_timestamp);
+}
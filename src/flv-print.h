@@ -0,0 +1,44 @@
+/*
+ * @file flv-print.h
+ */
+
+#ifndef FLV_PRINT_H_
+#define FLV_PRINT_H_ (1)
+
+#include "flv-parser.h"
+
+/*
+ * @brief state of the dump visitor, pass it as the visitor opaque
+ */
+typedef struct flv_print {
+    int a_count;
+    int v_count;
+} flv_print_t;
+
+/*
+ * @brief per stream totals of the summary visitor
+ */
+typedef struct flv_summary {
+    uint64_t tags;
+    uint64_t audio_tags;
+    uint64_t video_tags;
+    uint64_t scriptdata_tags;
+    uint64_t keyframes;
+    uint64_t payload_bytes;
+    uint64_t first_timestamp;
+    uint64_t last_timestamp;
+} flv_summary_t;
+
+extern const flv_visitor_t flv_print_visitor;
+
+extern const flv_visitor_t flv_summary_visitor;
+
+void flv_print_summary(const char *name, const flv_summary_t *summary);
+
+void flv_print_script_value(const flv_script_value_t *value);
+
+void flv_set_log_level(int level);
+
+void flv_print_header(const flv_header_t *flv_header);
+
+#endif // FLV_PRINT_H_
@@ -0,0 +1,187 @@
+/*
+ * @file flv-reader.c
+ */
+
+#define _GNU_SOURCE // F_SETPIPE_SZ
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "flv-reader.h"
+
+/*
+ * @brief one read() at the end of the buffer
+ * @return bytes read, 0 at the end of the input or on error
+ */
+static size_t read_more(flv_reader_t *reader, uint8_t *dst, size_t size) {
+    for (;;) {
+        ssize_t n = read(reader->fd, dst, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        reader->read_calls++;
+        if (n < 0) {
+            reader->error = 1;
+            return 0;
+        }
+        if (n == 0) {
+            reader->eof = 1;
+            return 0;
+        }
+        reader->bytes_read += (uint64_t) n;
+        return (size_t) n;
+    }
+}
+
+/*
+ * @param[in] fd: the input, read from its current offset and left open
+ * @param[in] size: buffer bytes, the largest view the reader hands out
+ * @return 0, or -1 if the buffer cannot be allocated
+ */
+int flv_reader_init(flv_reader_t *reader, int fd, size_t size) {
+    struct stat st;
+
+    memset(reader, 0, sizeof(*reader));
+    reader->fd = fd;
+    reader->size = size;
+    reader->buf = malloc(size);
+    if (!reader->buf) {
+        return -1;
+    }
+
+    // the hints are best effort, the reads work without them
+    if (fstat(fd, &st) == 0) {
+        if (S_ISREG(st.st_mode)) {
+            reader->seekable = 1;
+            posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        }
+#ifdef F_SETPIPE_SZ
+        if (S_ISFIFO(st.st_mode)) {
+            // a writer that can run a whole buffer ahead keeps the reads large
+            fcntl(fd, F_SETPIPE_SZ, (int) size);
+        }
+#endif
+    }
+    return 0;
+}
+
+/*
+ * @brief release the buffer
+ *
+ * A regular file is left at the offset of the cursor, for anyone reading
+ * the descriptor on.
+ */
+void flv_reader_close(flv_reader_t *reader) {
+    size_t ahead = reader->end - reader->pos;
+
+    if (reader->seekable && ahead) {
+        lseek(reader->fd, -(off_t) ahead, SEEK_CUR);
+    }
+    free(reader->buf);
+    reader->buf = NULL;
+    reader->pos = reader->end = 0;
+}
+
+/*
+ * @brief get at least want bytes at the cursor, want is at most the buffer size
+ *
+ * The unread bytes move to the front when the room behind them is short,
+ * then every read() asks for all the room left.
+ * @return bytes at the cursor, fewer than want at the end of the input
+ */
+size_t flv_reader_fill(flv_reader_t *reader, size_t want) {
+    if (want > reader->size) {
+        want = reader->size;
+    }
+    if (reader->size - reader->pos < want) {
+        memmove(reader->buf, reader->buf + reader->pos, reader->end - reader->pos);
+        reader->end -= reader->pos;
+        reader->pos = 0;
+    }
+    while (reader->end - reader->pos < want && !reader->eof && !reader->error) {
+        reader->end += read_more(reader, reader->buf + reader->end, reader->size - reader->end);
+    }
+    return reader->end - reader->pos;
+}
+
+/*
+ * @brief copy size bytes out, what the buffer lacks is read straight into dst
+ * @return bytes copied, fewer than size at the end of the input
+ */
+size_t flv_reader_read(flv_reader_t *reader, void *dst, size_t size) {
+    uint8_t *p = dst;
+    size_t done = reader->end - reader->pos;
+
+    if (done > size) {
+        done = size;
+    }
+    memcpy(p, reader->buf + reader->pos, done);
+    reader->pos += done;
+
+    if (size - done >= reader->size) {
+        while (done < size && !reader->eof && !reader->error) {
+            done += read_more(reader, p + done, size - done);
+        }
+        return done;
+    }
+    if (done < size) {
+        size_t n = flv_reader_fill(reader, size - done);
+        if (n > size - done) {
+            n = size - done;
+        }
+        memcpy(p + done, reader->buf + reader->pos, n);
+        reader->pos += n;
+        done += n;
+    }
+    return done;
+}
+
+/*
+ * @brief move the cursor size bytes on
+ *
+ * A regular file seeks past what the buffer does not hold and reads the
+ * last byte back, so a payload cut short still fails; anything else reads
+ * and drops the bytes.
+ * @return bytes passed over, fewer than size if the input ends first
+ */
+uint64_t flv_reader_skip(flv_reader_t *reader, uint64_t size) {
+    uint64_t done = reader->end - reader->pos;
+
+    if (done > size) {
+        done = size;
+    }
+    reader->pos += (size_t) done;
+    if (done == size) {
+        return done;
+    }
+
+    reader->pos = reader->end = 0;
+    off_t seek = (off_t) (size - done - 1);
+    off_t at = reader->seekable ? lseek(reader->fd, seek, SEEK_CUR) : -1;
+    if (at >= 0) {
+        if (flv_reader_fill(reader, 1) < 1) {
+            // the seek went past the end, count what is there
+            off_t end = lseek(reader->fd, 0, SEEK_END);
+            at -= seek;
+            return done + (uint64_t) (end > at ? (end - at < seek ? end - at : seek) : 0);
+        }
+        reader->pos = 1;
+        return size;
+    }
+    while (done < size) {
+        uint64_t left = size - done;
+        size_t n = flv_reader_fill(reader, left < reader->size ? (size_t) left : reader->size);
+        if (n == 0) {
+            break;
+        }
+        if (n > left) {
+            n = (size_t) left;
+        }
+        reader->pos += n;
+        done += n;
+    }
+    return done;
+}
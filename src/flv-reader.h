@@ -0,0 +1,65 @@
+/*
+ * @file flv-reader.h
+ *
+ * Byte cursor over a large buffer that read() refills, the input of the
+ * parser's pull path. flv_reader_need() bounds-checks a run of bytes once,
+ * so a whole tag header is decoded in place, and anything up to the buffer
+ * size can be looked at as a view instead of being copied out. Pipes get a
+ * larger kernel buffer and files a sequential readahead hint.
+ */
+
+#ifndef FLV_READER_H_
+#define FLV_READER_H_ (1)
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FLV_READER_SIZE (1024 * 1024)
+
+typedef struct flv_reader {
+    int fd;
+    uint8_t *buf;
+    size_t size; // capacity of buf
+    size_t pos; // cursor
+    size_t end; // bytes of buf holding input
+    int eof; // read() returned 0
+    int error; // read() failed
+    int seekable; // a regular file, skips seek
+    // read() calls and bytes so far, the owner may collect and zero them
+    uint64_t read_calls;
+    uint64_t bytes_read;
+} flv_reader_t;
+
+int flv_reader_init(flv_reader_t *reader, int fd, size_t size);
+
+void flv_reader_close(flv_reader_t *reader);
+
+size_t flv_reader_fill(flv_reader_t *reader, size_t want);
+
+size_t flv_reader_read(flv_reader_t *reader, void *dst, size_t size);
+
+uint64_t flv_reader_skip(flv_reader_t *reader, uint64_t size);
+
+/*
+ * @brief bytes at the cursor without reading more
+ */
+static inline size_t flv_reader_avail(const flv_reader_t *reader) {
+    return reader->end - reader->pos;
+}
+
+/*
+ * @brief size bytes at the cursor, refilling when short
+ * @return a view valid until the next fill, NULL if the input ends first
+ */
+static inline const uint8_t *flv_reader_need(flv_reader_t *reader, size_t size) {
+    if (reader->end - reader->pos < size && flv_reader_fill(reader, size) < size) {
+        return NULL;
+    }
+    return reader->buf + reader->pos;
+}
+
+static inline void flv_reader_consume(flv_reader_t *reader, size_t size) {
+    reader->pos += size;
+}
+
+#endif // FLV_READER_H_
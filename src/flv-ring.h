@@ -0,0 +1,158 @@
+/*
+ * @file flv-ring.h
+ *
+ * Lock-free single-producer single-consumer ring of pointers. One thread
+ * pushes, one thread pops; the indices are published with release stores
+ * and read with acquire loads, so the pointed-to descriptor is visible to
+ * the consumer once it pops it. Each side keeps a copy of the other side's
+ * index and only reloads it when the ring looks full or empty.
+ *
+ * A side that finds the ring full or empty can sleep on a futex until the
+ * other side, or whoever stops the rings, kicks it; the push and pop
+ * themselves take no lock and make a system call only when a side sleeps.
+ */
+
+#ifndef FLV_RING_H_
+#define FLV_RING_H_ (1)
+
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define FLV_RING_CACHE_LINE (64)
+
+typedef struct flv_ring {
+    // producer side
+    uint32_t tail;
+    uint32_t head_cache;
+    uint8_t pad_producer[FLV_RING_CACHE_LINE - 2 * sizeof(uint32_t)];
+    // consumer side
+    uint32_t head;
+    uint32_t tail_cache;
+    uint8_t pad_consumer[FLV_RING_CACHE_LINE - 2 * sizeof(uint32_t)];
+    uint32_t mask;
+    void **slots;
+    // sleeping, apart from the indices: bumped by every kick, the futex word
+    uint8_t pad_indices[FLV_RING_CACHE_LINE];
+    uint32_t events;
+    uint32_t sleepers;
+} flv_ring_t;
+
+/*
+ * @param[in] capacity: power of two
+ * @return 0, or -1 if out of memory
+ */
+static inline int flv_ring_init(flv_ring_t *ring, uint32_t capacity) {
+    ring->tail = ring->head_cache = 0;
+    ring->head = ring->tail_cache = 0;
+    ring->mask = capacity - 1;
+    ring->events = ring->sleepers = 0;
+    ring->slots = calloc(capacity, sizeof(void *));
+    return ring->slots ? 0 : -1;
+}
+
+static inline void flv_ring_free(flv_ring_t *ring) {
+    free(ring->slots);
+    ring->slots = NULL;
+}
+
+/*
+ * @brief producer: append item
+ * @return 0, or -1 if the ring is full
+ */
+static inline int flv_ring_push(flv_ring_t *ring, void *item) {
+    uint32_t tail = ring->tail;
+
+    if (tail - ring->head_cache > ring->mask) {
+        ring->head_cache = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (tail - ring->head_cache > ring->mask) {
+            return -1;
+        }
+    }
+    ring->slots[tail & ring->mask] = item;
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/*
+ * @brief consumer: take the oldest item
+ * @return the item, or NULL if the ring is empty
+ */
+static inline void *flv_ring_pop(flv_ring_t *ring) {
+    uint32_t head = ring->head;
+
+    if (head == ring->tail_cache) {
+        ring->tail_cache = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if (head == ring->tail_cache) {
+            return NULL;
+        }
+    }
+    void *item = ring->slots[head & ring->mask];
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return item;
+}
+
+/*
+ * @brief wake the other side if it sleeps on the ring
+ */
+static inline void flv_ring_kick(flv_ring_t *ring) {
+    __atomic_add_fetch(&ring->events, 1, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->sleepers, __ATOMIC_RELAXED)) {
+        syscall(SYS_futex, &ring->events, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+/*
+ * @brief sleep unless the ring was kicked since events read seen
+ */
+static inline void flv_ring_sleep(flv_ring_t *ring, uint32_t seen) {
+    __atomic_add_fetch(&ring->sleepers, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    syscall(SYS_futex, &ring->events, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+    __atomic_sub_fetch(&ring->sleepers, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * @brief producer: append item, sleeping while the ring is full
+ * @param[in] stop: flag that ends the wait once set and the ring kicked
+ * @return 0, or -1 if stopped
+ */
+static inline int flv_ring_push_wait(flv_ring_t *ring, void *item, const int *stop) {
+    for (;;) {
+        uint32_t seen = __atomic_load_n(&ring->events, __ATOMIC_ACQUIRE);
+        if (flv_ring_push(ring, item) == 0) {
+            flv_ring_kick(ring);
+            return 0;
+        }
+        if (__atomic_load_n(stop, __ATOMIC_ACQUIRE)) {
+            return -1;
+        }
+        flv_ring_sleep(ring, seen);
+    }
+}
+
+/*
+ * @brief consumer: take the oldest item, sleeping while the ring is empty
+ * @param[in] stop: flag that ends the wait once set and the ring kicked
+ * @return the item, or NULL if stopped
+ */
+static inline void *flv_ring_pop_wait(flv_ring_t *ring, const int *stop) {
+    for (;;) {
+        uint32_t seen = __atomic_load_n(&ring->events, __ATOMIC_ACQUIRE);
+        void *item = flv_ring_pop(ring);
+        if (item) {
+            flv_ring_kick(ring);
+            return item;
+        }
+        if (__atomic_load_n(stop, __ATOMIC_ACQUIRE)) {
+            return NULL;
+        }
+        flv_ring_sleep(ring, seen);
+    }
+}
+
+#endif // FLV_RING_H_
@@ -0,0 +1,219 @@
+/*
+ * @file flv-send.c
+ *
+ * Test client for the ingest mode: plays one FLV file into many connections,
+ * standing in for live encoders.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "flv-parser.h"
+#include "flv-server.h"
+
+void usage(char *program_name) {
+    printf("Usage: %s [-n connections] [-r] [-l loops] [-H] address input.flv\n", program_name);
+    printf("  -n  connections to open, default 1\n");
+    printf("  -r  pace tags by their timestamps instead of sending as fast as possible\n");
+    printf("  -l  times to play the file, 0 forever, default 1\n");
+    printf("  -H  start each stream with an HTTP request header\n");
+    printf("  address is host:port or unix:/path\n");
+    exit(-1);
+}
+
+static int send_all(int fd, const uint8_t *data, size_t size) {
+    while (size > 0) {
+        ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += n;
+        size -= n;
+    }
+    return 0;
+}
+
+static int send_to_all(int *fds, int count, const uint8_t *data, size_t size) {
+    int alive = 0;
+    for (int i = 0; i < count; i++) {
+        if (fds[i] < 0) {
+            continue;
+        }
+        if (send_all(fds[i], data, size) < 0) {
+            close(fds[i]);
+            fds[i] = -1;
+            continue;
+        }
+        alive++;
+    }
+    return alive;
+}
+
+static uint8_t *load_file(const char *path, size_t *size) {
+    FILE *f = fopen(path, "rb");
+    uint8_t *data = NULL;
+    size_t cap = 0;
+
+    if (!f) {
+        return NULL;
+    }
+    *size = 0;
+    for (;;) {
+        if (*size == cap) {
+            cap = cap ? cap * 2 : 1024 * 1024;
+            uint8_t *grown = realloc(data, cap);
+            if (!grown) {
+                free(data);
+                fclose(f);
+                return NULL;
+            }
+            data = grown;
+        }
+        size_t n = fread(data + *size, 1, cap - *size, f);
+        if (n == 0) {
+            break;
+        }
+        *size += n;
+    }
+    fclose(f);
+    return data;
+}
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void sleep_ms(uint64_t ms) {
+    struct timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000;
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR) {
+    }
+}
+
+int main(int argc, char **argv) {
+    int connections = 1;
+    int realtime = 0;
+    int loops = 1;
+    int http = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:rl:H")) != -1) {
+        switch (opt) {
+            case 'n':
+                connections = atoi(optarg);
+                break;
+            case 'r':
+                realtime = 1;
+                break;
+            case 'l':
+                loops = atoi(optarg);
+                break;
+            case 'H':
+                http = 1;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (argc - optind != 2 || connections <= 0) {
+        usage(argv[0]);
+    }
+
+    size_t size;
+    uint8_t *data = load_file(argv[optind + 1], &size);
+    if (!data || size < FLV_HEADER_SIZE || memcmp(data, "FLV", 3) != 0) {
+        fprintf(stderr, "%s: not an FLV file\n", argv[optind + 1]);
+        return -1;
+    }
+    size_t header_size = data[5] << 24 | data[6] << 16 | data[7] << 8 | data[8];
+    if (header_size > size) {
+        return -1;
+    }
+
+    int *fds = malloc(connections * sizeof(int));
+    if (!fds) {
+        return -1;
+    }
+    for (int i = 0; i < connections; i++) {
+        fds[i] = flv_server_connect(argv[optind]);
+        if (fds[i] < 0) {
+            fprintf(stderr, "cannot connect to %s: %s\n", argv[optind], strerror(errno));
+            return -1;
+        }
+        if (http) {
+            static const char request[] = "POST /live/stream HTTP/1.1\r\nContent-Type: video/x-flv\r\n\r\n";
+            send_all(fds[i], (const uint8_t *) request, sizeof(request) - 1);
+        }
+    }
+
+    int alive = send_to_all(fds, connections, data, header_size);
+    uint64_t base_ts = 0; // stream time already played by earlier loops
+    uint64_t start = now_ms();
+
+    for (int loop = 0; alive && (loops == 0 || loop < loops); loop++) {
+        size_t pos = header_size;
+        uint32_t last_ts = 0;
+
+        // previous tag size + tag header + payload, one send per tag
+        while (alive && pos + FLV_PREV_TAG_SIZE_SIZE + FLV_TAG_HEADER_SIZE <= size) {
+            uint8_t *tag = data + pos + FLV_PREV_TAG_SIZE_SIZE;
+            uint32_t data_size = tag[1] << 16 | tag[2] << 8 | tag[3];
+            uint32_t ts = (uint32_t) tag[7] << 24 | tag[4] << 16 | tag[5] << 8 | tag[6];
+            size_t end = pos + FLV_PREV_TAG_SIZE_SIZE + FLV_TAG_HEADER_SIZE + data_size;
+            if (end > size) {
+                break;
+            }
+
+            // later loops continue the timeline instead of jumping back
+            uint64_t stream_ts = base_ts + ts;
+            uint8_t saved[4];
+            memcpy(saved, tag + 4, sizeof(saved));
+            tag[4] = (uint8_t) (stream_ts >> 16);
+            tag[5] = (uint8_t) (stream_ts >> 8);
+            tag[6] = (uint8_t) stream_ts;
+            tag[7] = (uint8_t) (stream_ts >> 24);
+
+            if (realtime) {
+                uint64_t due = start + stream_ts;
+                uint64_t now = now_ms();
+                if (due > now) {
+                    sleep_ms(due - now);
+                }
+            }
+
+            alive = send_to_all(fds, connections, data + pos, end - pos);
+            memcpy(tag + 4, saved, sizeof(saved));
+            last_ts = ts;
+            pos = end;
+        }
+        base_ts += last_ts + 1;
+    }
+
+    // trailing previous tag size
+    if (alive && size >= FLV_PREV_TAG_SIZE_SIZE) {
+        send_to_all(fds, connections, data + size - FLV_PREV_TAG_SIZE_SIZE, FLV_PREV_TAG_SIZE_SIZE);
+    }
+
+    for (int i = 0; i < connections; i++) {
+        if (fds[i] >= 0) {
+            close(fds[i]);
+        }
+    }
+    free(fds);
+    free(data);
+
+    return alive ? 0 : -1;
+}
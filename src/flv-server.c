@@ -0,0 +1,545 @@
+/*
+ * @file flv-server.c
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "flv-parser.h"
+#include "flv-server.h"
+
+#define SERVER_MAX_EVENTS (256)
+#define SERVER_MAX_PREAMBLE (8192) // longest HTTP request header we skip
+
+static volatile sig_atomic_t g_server_stop;
+
+enum server_fd_types {
+    SERVER_LISTENER,
+    SERVER_CONNECTION
+};
+
+/*
+ * @brief what a stream looks like, recomputed as tags arrive
+ */
+struct stream_health {
+    uint64_t bytes;
+    uint64_t tags;
+    uint64_t interval_bytes;
+    uint64_t last_timestamp;
+    uint64_t last_type_timestamp[2]; // audio, video
+    int have_type_timestamp[2];
+    uint64_t last_keyframe;
+    int have_keyframe;
+    uint32_t keyframe_interval; // ms, between the last two keyframes
+    uint32_t max_keyframe_interval;
+    uint64_t gaps;
+    uint64_t backwards;
+    uint32_t max_gap;
+    uint32_t gap_threshold;
+};
+
+struct server_fd {
+    int type;
+    int fd;
+};
+
+struct connection {
+    struct server_fd sfd; // first, epoll hands it back
+    uint64_t id;
+    char peer[64];
+    flv_parser_t parser;
+    struct stream_health health;
+    uint8_t *buf;
+    int preamble; // still looking for the end of an HTTP request header
+    size_t preamble_seen;
+    int crlf_match;
+    struct connection *prev;
+    struct connection *next;
+};
+
+struct worker {
+    pthread_t thread;
+    const flv_server_opts_t *opts;
+    struct server_fd *listeners;
+    int listener_count;
+    int epoll_fd;
+    int connections_count;
+    struct connection *connections;
+};
+
+static uint64_t g_connection_ids;
+
+void flv_server_stop(void) {
+    g_server_stop = 1;
+}
+
+static void server_signal_handler(int signo) {
+    (void) signo;
+    g_server_stop = 1;
+}
+
+static int health_tag_header(void *opaque, const flv_tag_t *tag) {
+    struct stream_health *health = opaque;
+    uint64_t timestamp = tag->time;
+    uint32_t size = FLV_PREV_TAG_SIZE_SIZE + FLV_TAG_HEADER_SIZE + tag->data_size;
+
+    health->bytes += size;
+    health->interval_bytes += size;
+    health->tags++;
+    health->last_timestamp = timestamp;
+
+    if (tag->tag_type == TAGTYPE_AUDIODATA || tag->tag_type == TAGTYPE_VIDEODATA) {
+        int i = (tag->tag_type == TAGTYPE_VIDEODATA);
+        if (health->have_type_timestamp[i]) {
+            uint64_t prev = health->last_type_timestamp[i];
+            if (timestamp < prev) {
+                health->backwards++;
+            } else if (timestamp - prev > health->gap_threshold) {
+                health->gaps++;
+            }
+            if (timestamp >= prev && timestamp - prev > health->max_gap) {
+                health->max_gap = (uint32_t) (timestamp - prev);
+            }
+        }
+        health->last_type_timestamp[i] = timestamp;
+        health->have_type_timestamp[i] = 1;
+    }
+
+    return 0;
+}
+
+static int health_video(void *opaque, const flv_tag_t *tag, const video_tag_t *video) {
+    struct stream_health *health = opaque;
+    uint64_t timestamp = tag->time;
+
+    if (video->frame_type != 1) {
+        return 0;
+    }
+    if (health->have_keyframe && timestamp >= health->last_keyframe) {
+        health->keyframe_interval = (uint32_t) (timestamp - health->last_keyframe);
+        if (health->keyframe_interval > health->max_keyframe_interval) {
+            health->max_keyframe_interval = health->keyframe_interval;
+        }
+    }
+    health->last_keyframe = timestamp;
+    health->have_keyframe = 1;
+
+    return 0;
+}
+
+static const flv_visitor_t health_visitor = {
+    .on_tag_header = health_tag_header,
+    .on_video = health_video,
+};
+
+static void report(struct connection *conn, double seconds, const char *state) {
+    struct stream_health *health = &conn->health;
+    double kbps = seconds > 0 ? health->interval_bytes * 8 / 1000.0 / seconds : 0;
+
+    printf("stream %" PRIu64 " (%s) %s: %.0f kbps, %" PRIu64 " tags, %" PRIu64 " bytes, ts %" PRIu64 " ms, "
+           "keyframe interval %lu ms (max %lu), %" PRIu64 " gaps (max %lu ms), %" PRIu64 " backwards\n",
+           conn->id, conn->peer, state, kbps,
+           health->tags, health->bytes,
+           health->last_timestamp,
+           (unsigned long) health->keyframe_interval,
+           (unsigned long) health->max_keyframe_interval,
+           health->gaps, (unsigned long) health->max_gap,
+           health->backwards);
+    fflush(stdout);
+    health->interval_bytes = 0;
+}
+
+static int split_host_port(const char *addr, char *host, size_t host_size, const char **port) {
+    const char *colon = strrchr(addr, ':');
+    if (!colon || (size_t) (colon - addr) >= host_size) {
+        return -1;
+    }
+    memcpy(host, addr, colon - addr);
+    host[colon - addr] = '\0';
+    *port = colon + 1;
+    return 0;
+}
+
+static int socket_for(const char *addr, int listening) {
+    int fd = -1;
+
+    if (strncmp(addr, "unix:", 5) == 0) {
+        struct sockaddr_un sun;
+        memset(&sun, 0, sizeof(sun));
+        sun.sun_family = AF_UNIX;
+        if (strlen(addr + 5) >= sizeof(sun.sun_path)) {
+            return -1;
+        }
+        strcpy(sun.sun_path, addr + 5);
+
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            return -1;
+        }
+        if (listening) {
+            unlink(sun.sun_path);
+            if (bind(fd, (struct sockaddr *) &sun, sizeof(sun)) < 0 || listen(fd, SOMAXCONN) < 0) {
+                close(fd);
+                return -1;
+            }
+        } else if (connect(fd, (struct sockaddr *) &sun, sizeof(sun)) < 0) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    char host[256];
+    const char *port;
+    struct addrinfo hints;
+    struct addrinfo *res;
+    if (split_host_port(addr, host, sizeof(host), &port) < 0) {
+        return -1;
+    }
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = listening ? AI_PASSIVE : 0;
+    if (getaddrinfo(host[0] ? host : NULL, port, &hints, &res) != 0) {
+        return -1;
+    }
+
+    for (struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        if (listening) {
+            int one = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, SOMAXCONN) == 0) {
+                break;
+            }
+        } else if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+
+    return fd;
+}
+
+/*
+ * @brief listening socket for "host:port" or "unix:/path"
+ */
+int flv_server_listen(const char *addr) {
+    int fd = socket_for(addr, 1);
+    if (fd >= 0) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+    return fd;
+}
+
+/*
+ * @brief blocking client socket for "host:port" or "unix:/path"
+ */
+int flv_server_connect(const char *addr) {
+    return socket_for(addr, 0);
+}
+
+static void close_connection(struct worker *worker, struct connection *conn, const char *state, double seconds) {
+    report(conn, seconds, state);
+
+    epoll_ctl(worker->epoll_fd, EPOLL_CTL_DEL, conn->sfd.fd, NULL);
+    close(conn->sfd.fd);
+    flv_parser_close(&conn->parser);
+
+    if (conn->prev) {
+        conn->prev->next = conn->next;
+    } else {
+        worker->connections = conn->next;
+    }
+    if (conn->next) {
+        conn->next->prev = conn->prev;
+    }
+    worker->connections_count--;
+
+    free(conn->buf);
+    free(conn);
+}
+
+static void accept_connections(struct worker *worker, struct server_fd *listener) {
+    for (;;) {
+        struct sockaddr_storage ss;
+        socklen_t len = sizeof(ss);
+        int fd = accept4(listener->fd, (struct sockaddr *) &ss, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            return; // EAGAIN, or another worker was faster
+        }
+        if (worker->connections_count >= worker->opts->max_connections) {
+            close(fd);
+            continue;
+        }
+
+        struct connection *conn = calloc(1, sizeof(struct connection));
+        if (conn) {
+            conn->buf = malloc(worker->opts->buffer_size);
+        }
+        if (!conn || !conn->buf) {
+            free(conn);
+            close(fd);
+            continue;
+        }
+        conn->sfd.type = SERVER_CONNECTION;
+        conn->sfd.fd = fd;
+        conn->id = __atomic_add_fetch(&g_connection_ids, 1, __ATOMIC_RELAXED);
+        conn->preamble = 1;
+        conn->health.gap_threshold = worker->opts->gap_threshold;
+        if (ss.ss_family == AF_UNIX) {
+            snprintf(conn->peer, sizeof(conn->peer), "unix");
+        } else {
+            char host[48];
+            char port[16];
+            if (getnameinfo((struct sockaddr *) &ss, len, host, sizeof(host), port, sizeof(port),
+                            NI_NUMERICHOST | NI_NUMERICSERV) == 0) {
+                snprintf(conn->peer, sizeof(conn->peer), "%s:%s", host, port);
+            }
+        }
+        flv_parser_init(&conn->parser, NULL, &health_visitor, &conn->health);
+        conn->parser.max_tag_size = worker->opts->max_tag_size;
+        // the health visitor needs only tag headers, keep big payloads out of memory
+        flv_parser_set_chunk_size(&conn->parser, worker->opts->chunk_size);
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.ptr = &conn->sfd;
+        if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            free(conn->buf);
+            free(conn);
+            close(fd);
+            continue;
+        }
+
+        conn->next = worker->connections;
+        if (conn->next) {
+            conn->next->prev = conn;
+        }
+        worker->connections = conn;
+        worker->connections_count++;
+    }
+}
+
+/*
+ * @brief drop an HTTP request header in front of the FLV bytes
+ * @return bytes of data that belong to the header
+ */
+static size_t skip_preamble(struct connection *conn, const uint8_t *data, size_t size) {
+    static const char crlf[] = "\r\n\r\n";
+    size_t i = 0;
+
+    if (conn->preamble_seen == 0 && size > 0 && data[0] == 'F') {
+        conn->preamble = 0; // raw FLV
+        return 0;
+    }
+    for (; i < size; i++) {
+        conn->crlf_match = (data[i] == crlf[conn->crlf_match]) ? conn->crlf_match + 1 : (data[i] == '\r');
+        if (conn->crlf_match == 4) {
+            conn->preamble = 0;
+            i++;
+            break;
+        }
+    }
+    conn->preamble_seen += i;
+    return i;
+}
+
+/*
+ * @brief one read per wakeup, so busy streams do not starve the others
+ * @return FLV_OK to keep the connection, otherwise how it ended
+ */
+static int read_connection(struct connection *conn, size_t buffer_size) {
+    ssize_t n = recv(conn->sfd.fd, conn->buf, buffer_size, 0);
+
+    if (n < 0) {
+        return (errno == EAGAIN || errno == EINTR) ? FLV_OK : FLV_ERROR;
+    }
+    if (n == 0) {
+        return flv_parser_finish(&conn->parser);
+    }
+    FLV_STATS_ADD(&conn->parser.stats, read_calls, 1);
+    FLV_STATS_ADD(&conn->parser.stats, bytes_read, n);
+
+    const uint8_t *data = conn->buf;
+    size_t size = n;
+    if (conn->preamble) {
+        size_t skip = skip_preamble(conn, data, size);
+        data += skip;
+        size -= skip;
+        if (conn->preamble && conn->preamble_seen > SERVER_MAX_PREAMBLE) {
+            return FLV_ERROR;
+        }
+    }
+
+    return flv_parser_feed(&conn->parser, data, size);
+}
+
+static double elapsed(const struct timespec *from, const struct timespec *to) {
+    return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+static void *worker_main(void *arg) {
+    struct worker *worker = arg;
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    struct timespec last_report;
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &last_report);
+
+    while (!g_server_stop) {
+        int count = epoll_wait(worker->epoll_fd, events, SERVER_MAX_EVENTS, 500);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        double seconds = elapsed(&last_report, &now);
+
+        for (int i = 0; i < count; i++) {
+            struct server_fd *sfd = events[i].data.ptr;
+            if (sfd->type == SERVER_LISTENER) {
+                accept_connections(worker, sfd);
+                continue;
+            }
+
+            struct connection *conn = (struct connection *) sfd;
+            // a hangup is seen as EOF by the read that drains the socket
+            int ret = read_connection(conn, worker->opts->buffer_size);
+            if (ret != FLV_OK) {
+                close_connection(worker, conn, ret == FLV_END ? "ended" : "failed", seconds);
+            }
+        }
+
+        if (seconds >= worker->opts->report_interval) {
+            for (struct connection *conn = worker->connections; conn; conn = conn->next) {
+                report(conn, seconds, "live");
+            }
+            last_report = now;
+        }
+    }
+
+    while (worker->connections) {
+        close_connection(worker, worker->connections, "closed", elapsed(&last_report, &now));
+    }
+    return NULL;
+}
+
+/*
+ * @brief serve until SIGINT, SIGTERM or flv_server_stop()
+ * @return 0, or -1 if a listener or a worker thread cannot be started
+ */
+int flv_server_run(const flv_server_opts_t *in_opts) {
+    flv_server_opts_t opts = *in_opts;
+    struct server_fd listeners[FLV_SERVER_MAX_LISTEN];
+    struct worker *workers;
+    int ret = 0;
+
+    if (opts.threads <= 0) {
+        opts.threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+        if (opts.threads <= 0) {
+            opts.threads = 1;
+        }
+    }
+    if (opts.max_connections <= 0) {
+        opts.max_connections = 4096;
+    }
+    if (!opts.buffer_size) {
+        opts.buffer_size = 64 * 1024;
+    }
+    if (!opts.max_tag_size) {
+        opts.max_tag_size = 16 * 1024 * 1024;
+    }
+    if (!opts.chunk_size) {
+        opts.chunk_size = 16 * 1024;
+    }
+    if (opts.report_interval <= 0) {
+        opts.report_interval = 5;
+    }
+    if (!opts.gap_threshold) {
+        opts.gap_threshold = 1000;
+    }
+
+    for (int i = 0; i < opts.listen_count; i++) {
+        listeners[i].type = SERVER_LISTENER;
+        listeners[i].fd = flv_server_listen(opts.listen[i]);
+        if (listeners[i].fd < 0) {
+            fprintf(stderr, "cannot listen on %s: %s\n", opts.listen[i], strerror(errno));
+            for (int j = 0; j < i; j++) {
+                close(listeners[j].fd);
+            }
+            return -1;
+        }
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = server_signal_handler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    workers = calloc(opts.threads, sizeof(struct worker));
+    if (!workers) {
+        ret = -1;
+        goto out;
+    }
+    for (int i = 0; i < opts.threads; i++) {
+        struct worker *worker = &workers[i];
+        worker->opts = &opts;
+        worker->listeners = listeners;
+        worker->listener_count = opts.listen_count;
+        worker->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+        // every loop waits on every listener, EPOLLEXCLUSIVE wakes only one of them
+        for (int j = 0; j < opts.listen_count; j++) {
+            struct epoll_event ev;
+            ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+            ev.data.ptr = &listeners[j];
+            epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, listeners[j].fd, &ev);
+        }
+    }
+    int started = 0;
+    while (started < opts.threads) {
+        int err = pthread_create(&workers[started].thread, NULL, worker_main, &workers[started]);
+        if (err) {
+            fprintf(stderr, "cannot start worker %d: %s\n", started, strerror(err));
+            // the loops already running see the flag within one epoll timeout
+            g_server_stop = 1;
+            ret = -1;
+            break;
+        }
+        started++;
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    for (int i = 0; i < opts.threads; i++) {
+        close(workers[i].epoll_fd);
+    }
+    free(workers);
+
+out:
+    for (int i = 0; i < opts.listen_count; i++) {
+        close(listeners[i].fd);
+        if (strncmp(opts.listen[i], "unix:", 5) == 0) {
+            unlink(opts.listen[i] + 5);
+        }
+    }
+    return ret;
+}
@@ -0,0 +1,37 @@
+/*
+ * @file flv-server.h
+ *
+ * Live ingest: raw FLV byte streams (optionally behind an HTTP request
+ * header, as HTTP-FLV pushers send them) over TCP or Unix sockets, one
+ * epoll loop per thread, one parser per connection.
+ */
+
+#ifndef FLV_SERVER_H_
+#define FLV_SERVER_H_ (1)
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FLV_SERVER_MAX_LISTEN (8)
+
+typedef struct flv_server_opts {
+    const char *listen[FLV_SERVER_MAX_LISTEN]; // "host:port" or "unix:/path"
+    int listen_count;
+    int threads;             // epoll loops, default one per online CPU
+    int max_connections;     // per thread, default 4096
+    size_t buffer_size;      // receive buffer per connection, default 64 KiB
+    uint32_t max_tag_size;   // larger tags end the stream as an error, default 16 MiB
+    uint32_t chunk_size;     // bound of the per connection payload buffer, default 16 KiB
+    int report_interval;     // seconds between health reports, default 5
+    uint32_t gap_threshold;  // timestamp jump reported as a gap, ms, default 1000
+} flv_server_opts_t;
+
+int flv_server_listen(const char *addr);
+
+int flv_server_connect(const char *addr);
+
+int flv_server_run(const flv_server_opts_t *opts);
+
+void flv_server_stop(void);
+
+#endif // FLV_SERVER_H_
@@ -0,0 +1,132 @@
+/*
+ * @file flv-stats.c
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <inttypes.h>
+
+#include "flv-parser.h"
+#include "flv-stats.h"
+
+static volatile sig_atomic_t g_stats_signaled;
+
+#if FLV_ENABLE_STATS
+static const char *stage_names[] = {
+    "other",
+    "I/O",
+    "header decode",
+    "payload",
+    "output"
+};
+
+static const char *tag_kind_names[] = {
+    "audio",
+    "video",
+    "scriptdata",
+    "unknown"
+};
+#endif
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+void flv_stats_reset(flv_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->stage = FLV_STAGE_NONE;
+    stats->stage_start = now_ns();
+}
+
+/*
+ * @brief charge the time since the last switch to the current stage and enter a new one
+ * @return the stage that was active, so the caller can switch back
+ */
+int flv_stats_enter(flv_stats_t *stats, int stage) {
+    uint64_t now = now_ns();
+    int prev = stats->stage;
+
+    stats->stage_ns[prev] += now - stats->stage_start;
+    stats->stage_start = now;
+    stats->stage = stage;
+
+    return prev;
+}
+
+void flv_stats_count_tag(flv_stats_t *stats, uint8_t tag_type, uint32_t data_size) {
+    switch (tag_type) {
+        case TAGTYPE_AUDIODATA:
+            stats->tags[FLV_STATS_AUDIO]++;
+            break;
+        case TAGTYPE_VIDEODATA:
+            stats->tags[FLV_STATS_VIDEO]++;
+            break;
+        case TAGTYPE_SCRIPTDATAOBJECT:
+            stats->tags[FLV_STATS_SCRIPTDATA]++;
+            break;
+        default:
+            stats->tags[FLV_STATS_UNKNOWN]++;
+            break;
+    }
+    if (data_size > stats->max_tag_size) {
+        stats->max_tag_size = data_size;
+        stats->max_tag_type = tag_type;
+    }
+}
+
+void flv_stats_print(flv_stats_t *stats, FILE *out) {
+#if FLV_ENABLE_STATS
+    // settle the running stage so the totals are up to date
+    flv_stats_enter(stats, stats->stage);
+
+    fprintf(out, "Parser stats:\n");
+    fprintf(out, "  Bytes read: %" PRIu64 "\n", stats->bytes_read);
+    fprintf(out, "  Read calls: %" PRIu64 "\n", stats->read_calls);
+    fprintf(out, "  Allocations: %" PRIu64 " (%" PRIu64 " bytes)\n", stats->allocs, stats->alloc_bytes);
+    fprintf(out, "  Skipped: %" PRIu64 " tags (%" PRIu64 " bytes)\n", stats->tags_skipped, stats->bytes_skipped);
+    for (int i = 0; i < FLV_STATS_TAG_KINDS; i++) {
+        fprintf(out, "  Tags %s: %" PRIu64 "\n", tag_kind_names[i], stats->tags[i]);
+    }
+    fprintf(out, "  Largest tag: %lu bytes (type %u)\n", (unsigned long) stats->max_tag_size, stats->max_tag_type);
+    for (int i = 0; i < FLV_STAGE_MAX; i++) {
+        fprintf(out, "  Time %s: %.3f ms\n", stage_names[i], stats->stage_ns[i] / 1e6);
+    }
+#else
+    (void) stats;
+    fprintf(out, "Parser stats: disabled at build time\n");
+#endif
+}
+
+static void stats_signal_handler(int signo) {
+    (void) signo;
+    g_stats_signaled = 1;
+}
+
+/*
+ * @brief request a stats dump whenever signo is delivered
+ */
+int flv_stats_install_signal(int signo) {
+    struct sigaction sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stats_signal_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+
+    return sigaction(signo, &sa, NULL);
+}
+
+/*
+ * @brief check and clear a pending dump request
+ */
+int flv_stats_signaled(void) {
+    if (!g_stats_signaled) {
+        return 0;
+    }
+    g_stats_signaled = 0;
+    return 1;
+}
@@ -0,0 +1,80 @@
+/*
+ * @file flv-stats.h
+ */
+
+#ifndef FLV_STATS_H_
+#define FLV_STATS_H_ (1)
+
+#include <stdint.h>
+#include <stdio.h>
+
+// build with -DFLV_ENABLE_STATS=0 to compile the counters out
+#ifndef FLV_ENABLE_STATS
+#define FLV_ENABLE_STATS (1)
+#endif
+
+enum flv_stats_stages {
+    FLV_STAGE_NONE,
+    FLV_STAGE_IO,
+    FLV_STAGE_HEADER,  // tag header decode
+    FLV_STAGE_PAYLOAD, // audio/video/scriptdata payload handling
+    FLV_STAGE_OUTPUT,  // output formatting
+    FLV_STAGE_MAX
+};
+
+enum flv_stats_tag_kinds {
+    FLV_STATS_AUDIO,
+    FLV_STATS_VIDEO,
+    FLV_STATS_SCRIPTDATA,
+    FLV_STATS_UNKNOWN,
+    FLV_STATS_TAG_KINDS
+};
+
+/*
+ * @brief instrumentation counters and stage timers of a parser
+ */
+struct flv_stats {
+    uint64_t bytes_read;
+    uint64_t read_calls;  // read() calls
+    uint64_t allocs;
+    uint64_t alloc_bytes;
+    uint64_t tags_skipped; // dropped by the filter
+    uint64_t bytes_skipped;
+    uint64_t tags[FLV_STATS_TAG_KINDS];
+    uint32_t max_tag_size;
+    uint8_t max_tag_type;
+    uint64_t stage_ns[FLV_STAGE_MAX];
+    int stage;            // stage the clock is currently charged to
+    uint64_t stage_start; // ns
+};
+
+typedef struct flv_stats flv_stats_t;
+
+void flv_stats_reset(flv_stats_t *stats);
+
+int flv_stats_enter(flv_stats_t *stats, int stage);
+
+void flv_stats_count_tag(flv_stats_t *stats, uint8_t tag_type, uint32_t data_size);
+
+void flv_stats_print(flv_stats_t *stats, FILE *out);
+
+int flv_stats_install_signal(int signo);
+
+int flv_stats_signaled(void);
+
+#if FLV_ENABLE_STATS
+#define FLV_STATS_ADD(s, field, n) ((s)->field += (n))
+#define FLV_STATS_ENTER(s, stage) flv_stats_enter((s), (stage))
+#define FLV_STATS_TAG(s, type, size) flv_stats_count_tag((s), (type), (size))
+#else
+static inline int flv_stats_enter_nop(flv_stats_t *stats, int stage) {
+    (void) stats;
+    (void) stage;
+    return FLV_STAGE_NONE;
+}
+#define FLV_STATS_ADD(s, field, n) ((void) 0)
+#define FLV_STATS_ENTER(s, stage) flv_stats_enter_nop((s), (stage))
+#define FLV_STATS_TAG(s, type, size) ((void) 0)
+#endif
+
+#endif // FLV_STATS_H_
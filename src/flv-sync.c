@@ -0,0 +1,258 @@
+/*
+ * @file flv-sync.c
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <inttypes.h>
+#include <math.h>
+#include <string.h>
+
+#include "flv-sync.h"
+
+#define AAC_FRAME_SAMPLES (1024)
+
+static const uint32_t aac_sample_rates[] = {
+    96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 7350
+};
+
+static int64_t abs64(int64_t value) {
+    return value < 0 ? -value : value;
+}
+
+static void reset_window(flv_sync_t *sync, int64_t start) {
+    memset(&sync->win, 0, sizeof(sync->win));
+    sync->win.start = start;
+    sync->win.offset_min = INT64_MAX;
+    sync->win.offset_max = INT64_MIN;
+}
+
+static void print_window(const flv_sync_t *sync) {
+    const flv_sync_window_t *win = &sync->win;
+
+    fprintf(sync->out, "%10.3f s: ", win->start / 1000.0);
+    if (win->offsets) {
+        fprintf(sync->out, "A/V offset %.1f ms (%" PRId64 " .. %" PRId64 "), ",
+                win->offset_sum / win->offsets, win->offset_min, win->offset_max);
+    } else {
+        fprintf(sync->out, "A/V offset -, ");
+    }
+    fprintf(sync->out, "audio drift %" PRId64 " ms, jitter audio %.1f ms video %.1f ms, "
+            "%" PRIu64 " gaps, %" PRIu64 " non-monotonic\n",
+            sync->drift, win->max_jitter[FLV_SYNC_AUDIO], win->max_jitter[FLV_SYNC_VIDEO],
+            win->gaps, win->non_monotonic);
+}
+
+/*
+ * @brief close the windows that end before dts
+ */
+static void advance_window(flv_sync_t *sync, int64_t dts) {
+    if (!sync->window) {
+        return;
+    }
+    if (sync->win.start == INT64_MIN) {
+        reset_window(sync, dts - dts % sync->window);
+        return;
+    }
+    if (dts < sync->win.start + sync->window) {
+        return;
+    }
+    if (sync->out) {
+        print_window(sync);
+    }
+    reset_window(sync, dts - dts % sync->window);
+}
+
+static void track_dts(flv_sync_t *sync, int kind, int64_t dts) {
+    flv_sync_track_t *track = &sync->tracks[kind];
+
+    advance_window(sync, dts);
+
+    if (track->count++ == 0) {
+        track->first_dts = dts;
+        track->last_dts = dts;
+        return;
+    }
+
+    int64_t step = dts - track->last_dts;
+    track->last_dts = dts;
+    if (step < 0) {
+        track->non_monotonic++;
+        sync->win.non_monotonic++;
+        return;
+    }
+    if (step > sync->gap_threshold) {
+        track->gaps++;
+        sync->win.gaps++;
+    }
+    if (step > track->max_step) {
+        track->max_step = step;
+    }
+
+    // a gap is not jitter, keep it out of the step statistics
+    if (step > sync->gap_threshold) {
+        return;
+    }
+    track->steps++;
+    double delta = step - track->step_mean;
+    track->step_mean += delta / track->steps;
+    track->step_m2 += delta * (step - track->step_mean);
+
+    double jitter = fabs(step - track->step_mean);
+    if (track->steps > 1) {
+        if (jitter > track->max_jitter) {
+            track->max_jitter = jitter;
+        }
+        if (jitter > sync->win.max_jitter[kind]) {
+            sync->win.max_jitter[kind] = jitter;
+        }
+    }
+}
+
+static int sync_audio(void *opaque, const flv_tag_t *flv_tag, const audio_tag_t *audio) {
+    flv_sync_t *sync = opaque;
+    int64_t dts = (int64_t) flv_tag->time;
+
+    if (audio->sound_format == FLV_SOUND_FORMAT_AAC && audio->aac_packet_type == 0) {
+        // AudioSpecificConfig: 5 bits object type, 4 bits sampling frequency index
+        if (audio->data_size >= 2) {
+            uint8_t index = ((audio->data[0] & 0x07) << 1) | (audio->data[1] >> 7);
+            sync->sample_rate = index < sizeof(aac_sample_rates) / sizeof(aac_sample_rates[0]) ? aac_sample_rates[index] : 0;
+            sync->samples = 0;
+        }
+        return 0;
+    }
+
+    track_dts(sync, FLV_SYNC_AUDIO, dts);
+
+    if (audio->sound_format == FLV_SOUND_FORMAT_AAC && sync->sample_rate) {
+        if (sync->samples == 0) {
+            sync->clock_start = dts;
+        }
+        int64_t expected = sync->clock_start + (int64_t) (sync->samples * 1000 / sync->sample_rate);
+        sync->drift = dts - expected;
+        if (abs64(sync->drift) > abs64(sync->max_drift)) {
+            sync->max_drift = sync->drift;
+        }
+        sync->samples += AAC_FRAME_SAMPLES;
+    }
+
+    return 0;
+}
+
+static int sync_video(void *opaque, const flv_tag_t *flv_tag, const video_tag_t *video) {
+    flv_sync_t *sync = opaque;
+    int64_t dts = (int64_t) flv_tag->time;
+    const flv_sync_track_t *audio = &sync->tracks[FLV_SYNC_AUDIO];
+
+    // sequence headers and end of sequence carry no frame
+    if (video->ex_header) {
+        if (video->frame_type == FLV_VIDEO_FRAME_COMMAND ||
+            (video->packet_type != FLV_PACKET_CODED_FRAMES && video->packet_type != FLV_PACKET_CODED_FRAMES_X)) {
+            return 0;
+        }
+    } else if (video->codec_id == FLV_CODEC_ID_AVC && (video->data_size == 0 || video->data[0] != 1)) {
+        return 0;
+    }
+
+    track_dts(sync, FLV_SYNC_VIDEO, dts);
+
+    if (audio->count) {
+        int64_t offset = audio->last_dts - dts;
+        sync->offsets++;
+        sync->offset_sum += offset;
+        if (offset < sync->offset_min) {
+            sync->offset_min = offset;
+        }
+        if (offset > sync->offset_max) {
+            sync->offset_max = offset;
+        }
+        sync->win.offsets++;
+        sync->win.offset_sum += offset;
+        if (offset < sync->win.offset_min) {
+            sync->win.offset_min = offset;
+        }
+        if (offset > sync->win.offset_max) {
+            sync->win.offset_max = offset;
+        }
+    }
+
+    return 0;
+}
+
+static int sync_avc(void *opaque, const flv_tag_t *flv_tag, const video_tag_t *video, const avc_video_tag_t *avc) {
+    flv_sync_t *sync = opaque;
+    (void) video;
+
+    if (avc->avc_packet_type == 1 && avc->pts - (int64_t) flv_tag->time > sync->max_pts_lag) {
+        sync->max_pts_lag = avc->pts - (int64_t) flv_tag->time;
+    }
+    return 0;
+}
+
+static int sync_video_packet(void *opaque, const flv_tag_t *flv_tag, const video_tag_t *video, const flv_video_packet_t *packet) {
+    flv_sync_t *sync = opaque;
+    (void) video;
+
+    if (packet->packet_type == FLV_PACKET_CODED_FRAMES && packet->pts - (int64_t) flv_tag->time > sync->max_pts_lag) {
+        sync->max_pts_lag = packet->pts - (int64_t) flv_tag->time;
+    }
+    return 0;
+}
+
+const flv_visitor_t flv_sync_visitor = {
+    .on_audio = sync_audio,
+    .on_video = sync_video,
+    .on_avc = sync_avc,
+    .on_video_packet = sync_video_packet,
+};
+
+/*
+ * @brief start an analysis
+ * @param[in] out: where window lines go
+ * @param[in] window: ms of stream time per window line, 0 for none
+ */
+void flv_sync_init(flv_sync_t *sync, FILE *out, uint32_t window) {
+    memset(sync, 0, sizeof(*sync));
+    sync->out = out;
+    sync->window = window;
+    sync->gap_threshold = 1000;
+    sync->offset_min = INT64_MAX;
+    sync->offset_max = INT64_MIN;
+    reset_window(sync, INT64_MIN);
+}
+
+/*
+ * @brief report the last, partial window
+ */
+void flv_sync_finish(flv_sync_t *sync) {
+    if (sync->window && sync->out && sync->win.start != INT64_MIN) {
+        print_window(sync);
+    }
+}
+
+static double track_jitter(const flv_sync_track_t *track) {
+    return track->steps > 1 ? sqrt(track->step_m2 / (track->steps - 1)) : 0;
+}
+
+/*
+ * @brief one summary line for the whole stream
+ */
+void flv_sync_print(const char *name, const flv_sync_t *sync, FILE *out) {
+    const flv_sync_track_t *a = &sync->tracks[FLV_SYNC_AUDIO];
+    const flv_sync_track_t *v = &sync->tracks[FLV_SYNC_VIDEO];
+
+    fprintf(out, "%s: %" PRIu64 " audio, %" PRIu64 " video frames; ", name, a->count, v->count);
+    if (sync->offsets) {
+        fprintf(out, "A/V offset %.1f ms (%" PRId64 " .. %" PRId64 "); ",
+                sync->offset_sum / sync->offsets, sync->offset_min, sync->offset_max);
+    }
+    if (sync->sample_rate) {
+        fprintf(out, "audio drift %" PRId64 " ms (max %" PRId64 "); ", sync->drift, sync->max_drift);
+    }
+    fprintf(out, "jitter audio %.1f/%.1f ms video %.1f/%.1f ms (stddev/max); "
+            "gaps %" PRIu64 "/%" PRIu64 " (max step %" PRId64 "/%" PRId64 " ms); "
+            "non-monotonic DTS %" PRIu64 "/%" PRIu64 "; max PTS-DTS %" PRId64 " ms\n",
+            track_jitter(a), a->max_jitter, track_jitter(v), v->max_jitter,
+            a->gaps, v->gaps, a->max_step, v->max_step,
+            a->non_monotonic, v->non_monotonic, sync->max_pts_lag);
+}
@@ -0,0 +1,90 @@
+/*
+ * @file flv-sync.h
+ *
+ * Streaming A/V sync analyzer: audio/video offset, audio clock drift,
+ * timestamp jitter, gaps and non-monotonic DTS, in constant memory however
+ * long the stream.
+ */
+
+#ifndef FLV_SYNC_H_
+#define FLV_SYNC_H_ (1)
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "flv-parser.h"
+
+enum flv_sync_tracks {
+    FLV_SYNC_AUDIO,
+    FLV_SYNC_VIDEO,
+    FLV_SYNC_TRACKS
+};
+
+/*
+ * @brief DTS statistics of one track
+ */
+typedef struct flv_sync_track {
+    uint64_t count;
+    int64_t first_dts;
+    int64_t last_dts;
+    uint64_t non_monotonic; // DTS lower than the one before
+    uint64_t gaps;          // DTS step above the gap threshold
+    int64_t max_step;
+    // running mean and variance of the DTS step (Welford), jitter is its deviation
+    uint64_t steps;
+    double step_mean;
+    double step_m2;
+    double max_jitter;  // largest distance of a step from the mean
+} flv_sync_track_t;
+
+/*
+ * @brief an interval of stream time, reported and reset as it closes
+ */
+typedef struct flv_sync_window {
+    int64_t start;
+    uint64_t offsets;
+    double offset_sum;
+    int64_t offset_min;
+    int64_t offset_max;
+    double max_jitter[FLV_SYNC_TRACKS];
+    uint64_t gaps;
+    uint64_t non_monotonic;
+} flv_sync_window_t;
+
+/*
+ * @brief analyzer state, pass it as the visitor opaque
+ */
+typedef struct flv_sync {
+    FILE *out;              // window lines, NULL for none
+    uint32_t window;        // ms of stream time per window line, 0 for none
+    uint32_t gap_threshold; // ms, default 1000
+
+    flv_sync_track_t tracks[FLV_SYNC_TRACKS];
+
+    // A/V offset: latest audio DTS minus the DTS of each video frame
+    uint64_t offsets;
+    double offset_sum;
+    int64_t offset_min;
+    int64_t offset_max;
+
+    // AAC clock: DTS against the duration of the samples before it
+    uint32_t sample_rate;
+    uint64_t samples;
+    int64_t clock_start;
+    int64_t drift;      // at the last AAC frame
+    int64_t max_drift;  // largest absolute drift seen
+
+    int64_t max_pts_lag; // largest PTS - DTS
+
+    flv_sync_window_t win;
+} flv_sync_t;
+
+extern const flv_visitor_t flv_sync_visitor;
+
+void flv_sync_init(flv_sync_t *sync, FILE *out, uint32_t window);
+
+void flv_sync_finish(flv_sync_t *sync);
+
+void flv_sync_print(const char *name, const flv_sync_t *sync, FILE *out);
+
+#endif // FLV_SYNC_H_
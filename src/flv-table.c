@@ -0,0 +1,436 @@
+/*
+ * @file flv-table.c
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "flv-table.h"
+
+#define FLV_TABLE_VERSION (2)
+#define FLV_TABLE_BOM (0x01020304)
+
+static const char flv_table_magic[4] = {'F', 'L', 'V', 'T'};
+
+struct flv_table_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t bom;
+    uint32_t block_rows;
+};
+
+struct flv_table_block_header {
+    uint32_t rows;
+    uint8_t width[4]; // bytes per value of the offset delta, time delta, size and CTS columns
+    uint64_t base_offset;
+    int64_t base_time;
+};
+
+struct flv_table_writer {
+    FILE *out;
+    int error;
+    uint32_t rows;
+    uint64_t base_offset;
+    int64_t base_time;
+    uint64_t last_offset;
+    int64_t last_time;
+    int have_cts; // the CTS of the last row is set, it may be 0
+    uint32_t offset_delta[FLV_TABLE_BLOCK_ROWS];
+    int32_t time_delta[FLV_TABLE_BLOCK_ROWS];
+    uint32_t size[FLV_TABLE_BLOCK_ROWS];
+    int32_t cts[FLV_TABLE_BLOCK_ROWS];
+    uint8_t tag_type[FLV_TABLE_BLOCK_ROWS];
+    uint8_t frame_type[FLV_TABLE_BLOCK_ROWS];
+    uint8_t codec[FLV_TABLE_BLOCK_ROWS];
+    uint8_t packed[FLV_TABLE_BLOCK_ROWS * 4];
+};
+
+struct flv_table_reader {
+    FILE *in;
+    uint32_t block_rows;
+    uint8_t *packed; // a column as stored
+    uint32_t *delta; // offset and time deltas are unpacked here, then summed up
+    uint64_t *offset;
+    int64_t *time;
+    uint32_t *size;
+    int32_t *cts;
+    uint8_t *tag_type;
+    uint8_t *frame_type;
+    uint8_t *codec;
+};
+
+/*
+ * @brief the narrowest width, 1, 2 or 4 bytes, that holds every value of a column
+ * @param[in] is_signed: the values are int32_t, stored sign-extended
+ */
+static uint8_t column_width(const uint32_t *values, uint32_t rows, int is_signed) {
+    uint32_t bits = 0;
+
+    for (uint32_t i = 0; i < rows; i++) {
+        uint32_t v = values[i];
+        // a negative value needs the bits of its complement plus the sign
+        bits |= (is_signed && (v >> 31)) ? ~v : v;
+    }
+    if (is_signed) {
+        bits <<= 1;
+    }
+    return bits <= 0xff ? 1 : bits <= 0xffff ? 2 : 4;
+}
+
+static void pack_column(uint8_t *dst, const uint32_t *values, uint32_t rows, uint8_t width) {
+    if (width == 1) {
+        for (uint32_t i = 0; i < rows; i++) {
+            dst[i] = (uint8_t) values[i];
+        }
+    } else if (width == 2) {
+        for (uint32_t i = 0; i < rows; i++) {
+            uint16_t v = (uint16_t) values[i];
+            memcpy(dst + 2 * i, &v, 2);
+        }
+    } else {
+        memcpy(dst, values, (size_t) rows * 4);
+    }
+}
+
+static void unpack_column(uint32_t *values, const uint8_t *src, uint32_t rows, uint8_t width, int is_signed) {
+    if (width == 1) {
+        for (uint32_t i = 0; i < rows; i++) {
+            values[i] = is_signed ? (uint32_t) (int32_t) (int8_t) src[i] : src[i];
+        }
+    } else if (width == 2) {
+        for (uint32_t i = 0; i < rows; i++) {
+            uint16_t v;
+            memcpy(&v, src + 2 * i, 2);
+            values[i] = is_signed ? (uint32_t) (int32_t) (int16_t) v : v;
+        }
+    } else {
+        memcpy(values, src, (size_t) rows * 4);
+    }
+}
+
+static int write_column(flv_table_writer_t *writer, const uint32_t *values, uint32_t rows, uint8_t width) {
+    pack_column(writer->packed, values, rows, width);
+    return fwrite(writer->packed, width, rows, writer->out) == rows ? 0 : -1;
+}
+
+static int write_block(flv_table_writer_t *writer) {
+    struct flv_table_block_header header;
+    uint32_t rows = writer->rows;
+
+    if (rows == 0) {
+        return 0;
+    }
+    memset(&header, 0, sizeof(header));
+    header.rows = rows;
+    header.width[0] = column_width(writer->offset_delta, rows, 0);
+    header.width[1] = column_width((const uint32_t *) writer->time_delta, rows, 1);
+    header.width[2] = column_width(writer->size, rows, 0);
+    header.width[3] = column_width((const uint32_t *) writer->cts, rows, 1);
+    header.base_offset = writer->base_offset;
+    header.base_time = writer->base_time;
+
+    if (fwrite(&header, sizeof(header), 1, writer->out) != 1 ||
+        write_column(writer, writer->offset_delta, rows, header.width[0]) < 0 ||
+        write_column(writer, (const uint32_t *) writer->time_delta, rows, header.width[1]) < 0 ||
+        write_column(writer, writer->size, rows, header.width[2]) < 0 ||
+        write_column(writer, (const uint32_t *) writer->cts, rows, header.width[3]) < 0 ||
+        fwrite(writer->tag_type, 1, rows, writer->out) != rows ||
+        fwrite(writer->frame_type, 1, rows, writer->out) != rows ||
+        fwrite(writer->codec, 1, rows, writer->out) != rows) {
+        writer->error = 1;
+        return -1;
+    }
+    writer->rows = 0;
+    return 0;
+}
+
+static int table_tag_header(void *opaque, const flv_tag_t *tag) {
+    flv_table_writer_t *writer = opaque;
+    int64_t time = (int64_t) tag->time;
+
+    // a full block, or a delta that does not fit 32 bits, starts a new block
+    if (writer->rows == FLV_TABLE_BLOCK_ROWS ||
+        (writer->rows && (tag->offset - writer->last_offset > UINT32_MAX ||
+                          time - writer->last_time > INT32_MAX ||
+                          time - writer->last_time < INT32_MIN))) {
+        if (write_block(writer) < 0) {
+            return -1;
+        }
+    }
+
+    uint32_t row = writer->rows++;
+    if (row == 0) {
+        writer->base_offset = tag->offset;
+        writer->base_time = time;
+        writer->last_offset = tag->offset;
+        writer->last_time = time;
+    }
+    writer->offset_delta[row] = (uint32_t) (tag->offset - writer->last_offset);
+    writer->time_delta[row] = (int32_t) (time - writer->last_time);
+    writer->size[row] = tag->data_size;
+    writer->cts[row] = 0;
+    writer->have_cts = 0;
+    writer->tag_type[row] = tag->tag_type;
+    writer->frame_type[row] = 0;
+    writer->codec[row] = FLV_TABLE_NO_CODEC;
+    writer->last_offset = tag->offset;
+    writer->last_time = time;
+
+    return 0;
+}
+
+static int table_audio(void *opaque, const flv_tag_t *tag, const audio_tag_t *audio) {
+    flv_table_writer_t *writer = opaque;
+    (void) tag;
+
+    writer->codec[writer->rows - 1] = audio->sound_format;
+    return 0;
+}
+
+static int table_video(void *opaque, const flv_tag_t *tag, const video_tag_t *video) {
+    flv_table_writer_t *writer = opaque;
+    (void) tag;
+
+    writer->frame_type[writer->rows - 1] = video->frame_type;
+    writer->codec[writer->rows - 1] = video->codec_id;
+    return 0;
+}
+
+static int table_avc(void *opaque, const flv_tag_t *tag, const video_tag_t *video, const avc_video_tag_t *avc) {
+    flv_table_writer_t *writer = opaque;
+    (void) tag;
+    (void) video;
+
+    writer->cts[writer->rows - 1] = avc->composition_time;
+    writer->have_cts = 1;
+    return 0;
+}
+
+static int table_video_packet(void *opaque, const flv_tag_t *tag, const video_tag_t *video, const flv_video_packet_t *packet) {
+    flv_table_writer_t *writer = opaque;
+    (void) tag;
+    (void) video;
+
+    // the CTS of the first track
+    if (!writer->have_cts) {
+        writer->cts[writer->rows - 1] = packet->composition_time;
+        writer->have_cts = 1;
+    }
+    return 0;
+}
+
+const flv_visitor_t flv_table_visitor = {
+    .on_tag_header = table_tag_header,
+    .on_audio = table_audio,
+    .on_video = table_video,
+    .on_avc = table_avc,
+    .on_video_packet = table_video_packet,
+};
+
+flv_table_writer_t *flv_table_writer_open(const char *path) {
+    struct flv_table_header header;
+    flv_table_writer_t *writer = calloc(1, sizeof(flv_table_writer_t));
+
+    if (!writer) {
+        return NULL;
+    }
+    writer->out = fopen(path, "wb");
+    if (!writer->out) {
+        free(writer);
+        return NULL;
+    }
+
+    memcpy(header.magic, flv_table_magic, sizeof(header.magic));
+    header.version = FLV_TABLE_VERSION;
+    header.bom = FLV_TABLE_BOM;
+    header.block_rows = FLV_TABLE_BLOCK_ROWS;
+    if (fwrite(&header, sizeof(header), 1, writer->out) != 1) {
+        writer->error = 1;
+    }
+    return writer;
+}
+
+/*
+ * @brief write the last block and close
+ * @return 0, or -1 if any write failed
+ */
+int flv_table_writer_close(flv_table_writer_t *writer) {
+    write_block(writer);
+    if (fclose(writer->out) != 0) {
+        writer->error = 1;
+    }
+    int ret = writer->error ? -1 : 0;
+    free(writer);
+    return ret;
+}
+
+flv_table_reader_t *flv_table_reader_open(const char *path) {
+    struct flv_table_header header;
+    flv_table_reader_t *reader = calloc(1, sizeof(flv_table_reader_t));
+
+    if (!reader) {
+        return NULL;
+    }
+    reader->in = fopen(path, "rb");
+    if (!reader->in ||
+        fread(&header, sizeof(header), 1, reader->in) != 1 ||
+        memcmp(header.magic, flv_table_magic, sizeof(header.magic)) != 0 ||
+        header.version != FLV_TABLE_VERSION ||
+        header.bom != FLV_TABLE_BOM ||
+        header.block_rows == 0 || header.block_rows > FLV_TABLE_BLOCK_ROWS) {
+        goto fail;
+    }
+
+    uint32_t n = header.block_rows;
+    reader->block_rows = n;
+    reader->packed = malloc(n * sizeof(uint32_t));
+    reader->delta = malloc(n * sizeof(uint32_t));
+    reader->offset = malloc(n * sizeof(uint64_t));
+    reader->time = malloc(n * sizeof(int64_t));
+    reader->size = malloc(n * sizeof(uint32_t));
+    reader->cts = malloc(n * sizeof(int32_t));
+    reader->tag_type = malloc(n);
+    reader->frame_type = malloc(n);
+    reader->codec = malloc(n);
+    if (!reader->packed || !reader->delta || !reader->offset || !reader->time || !reader->size || !reader->cts ||
+        !reader->tag_type || !reader->frame_type || !reader->codec) {
+        goto fail;
+    }
+    return reader;
+
+fail:
+    flv_table_reader_close(reader);
+    return NULL;
+}
+
+/*
+ * @brief read a column of width-byte values into 32-bit ones
+ */
+static int read_column(flv_table_reader_t *reader, uint32_t *values, uint32_t rows, uint8_t width, int is_signed) {
+    if (fread(reader->packed, width, rows, reader->in) != rows) {
+        return -1;
+    }
+    unpack_column(values, reader->packed, rows, width, is_signed);
+    return 0;
+}
+
+/*
+ * @brief decode the next block, the columns stay valid until the next call
+ * @return 1 with a block, 0 at the end, -1 on a damaged file
+ */
+int flv_table_reader_next(flv_table_reader_t *reader, flv_table_block_t *block) {
+    struct flv_table_block_header header;
+
+    size_t n = fread(&header, 1, sizeof(header), reader->in);
+    if (n != sizeof(header)) {
+        return (n == 0 && feof(reader->in)) ? 0 : -1;
+    }
+    uint32_t rows = header.rows;
+    if (rows == 0 || rows > reader->block_rows) {
+        return -1;
+    }
+    for (int i = 0; i < 4; i++) {
+        if (header.width[i] != 1 && header.width[i] != 2 && header.width[i] != 4) {
+            return -1;
+        }
+    }
+
+    if (read_column(reader, reader->delta, rows, header.width[0], 0) < 0) {
+        return -1;
+    }
+    uint64_t offset = header.base_offset;
+    for (uint32_t i = 0; i < rows; i++) {
+        offset += reader->delta[i];
+        reader->offset[i] = offset;
+    }
+
+    if (read_column(reader, reader->delta, rows, header.width[1], 1) < 0) {
+        return -1;
+    }
+    int64_t time = header.base_time;
+    for (uint32_t i = 0; i < rows; i++) {
+        time += (int32_t) reader->delta[i];
+        reader->time[i] = time;
+    }
+
+    if (read_column(reader, reader->size, rows, header.width[2], 0) < 0 ||
+        read_column(reader, (uint32_t *) reader->cts, rows, header.width[3], 1) < 0 ||
+        fread(reader->tag_type, 1, rows, reader->in) != rows ||
+        fread(reader->frame_type, 1, rows, reader->in) != rows ||
+        fread(reader->codec, 1, rows, reader->in) != rows) {
+        return -1;
+    }
+
+    block->rows = rows;
+    block->offset = reader->offset;
+    block->time = reader->time;
+    block->size = reader->size;
+    block->cts = reader->cts;
+    block->tag_type = reader->tag_type;
+    block->frame_type = reader->frame_type;
+    block->codec = reader->codec;
+    return 1;
+}
+
+void flv_table_reader_close(flv_table_reader_t *reader) {
+    if (reader->in) {
+        fclose(reader->in);
+    }
+    free(reader->packed);
+    free(reader->delta);
+    free(reader->offset);
+    free(reader->time);
+    free(reader->size);
+    free(reader->cts);
+    free(reader->tag_type);
+    free(reader->frame_type);
+    free(reader->codec);
+    free(reader);
+}
+
+/*
+ * The selections below fill a byte per row instead of collecting row
+ * numbers: branch-free loops over the columns that the compiler vectorizes.
+ */
+
+/*
+ * @brief mark the video keyframes with t1 <= time < t2
+ * @param[out] match: FLV_TABLE_BLOCK_ROWS bytes, 1 for a selected row
+ * @return selected rows
+ */
+size_t flv_table_keyframes(const flv_table_block_t *block, int64_t t1, int64_t t2, uint8_t *match) {
+    const int64_t *restrict time = block->time;
+    const uint8_t *restrict frame_type = block->frame_type;
+    const uint8_t *restrict tag_type = block->tag_type;
+    uint8_t *restrict out = match;
+    uint32_t rows = block->rows;
+    size_t count = 0;
+
+    for (uint32_t i = 0; i < rows; i++) {
+        out[i] = (tag_type[i] == TAGTYPE_VIDEODATA) & (frame_type[i] == 1) & (time[i] >= t1) & (time[i] < t2);
+    }
+    for (uint32_t i = 0; i < rows; i++) {
+        count += match[i];
+    }
+    return count;
+}
+
+/*
+ * @brief mark the tags with a payload larger than size bytes
+ * @param[out] match: FLV_TABLE_BLOCK_ROWS bytes, 1 for a selected row
+ * @return selected rows
+ */
+size_t flv_table_larger(const flv_table_block_t *block, uint32_t size, uint8_t *match) {
+    const uint32_t *restrict sizes = block->size;
+    uint8_t *restrict out = match;
+    uint32_t rows = block->rows;
+    size_t count = 0;
+
+    for (uint32_t i = 0; i < rows; i++) {
+        out[i] = sizes[i] > size;
+    }
+    for (uint32_t i = 0; i < rows; i++) {
+        count += match[i];
+    }
+    return count;
+}
@@ -0,0 +1,67 @@
+/*
+ * @file flv-table.h
+ *
+ * Columnar tag table: one row per tag, stored as blocks of struct-of-arrays
+ * columns so per-tag questions can be answered without walking the FLV.
+ *
+ * File layout (host byte order, checked on open):
+ *   header: "FLVT", version, byte order mark 0x01020304, rows per block
+ *   blocks: rows, column widths (4 x u8), base offset (u64), base time (i64),
+ *           then the columns offset delta, time delta, data size, CTS,
+ *           tag type (u8), frame type (u8), codec (u8)
+ * Offsets and times are stored as deltas from the previous row of the block.
+ * Each of the four 32-bit columns is narrowed per block to 1, 2 or 4 bytes
+ * a value, the least that holds all of its values; the deltas and CTS are
+ * signed and sign-extended on reading.
+ */
+
+#ifndef FLV_TABLE_H_
+#define FLV_TABLE_H_ (1)
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "flv-parser.h"
+
+#define FLV_TABLE_BLOCK_ROWS (4096)
+#define FLV_TABLE_NO_CODEC (255)
+
+/*
+ * @brief one decoded block, columns indexed by row
+ */
+typedef struct flv_table_block {
+    uint32_t rows;
+    uint64_t *offset;     // of the tag header
+    int64_t *time;        // ms, the DTS
+    uint32_t *size;       // payload bytes
+    int32_t *cts;         // AVC, HEVC composition time, 0 otherwise
+    uint8_t *tag_type;
+    uint8_t *frame_type;  // 0 for non-video tags
+    uint8_t *codec;       // video codec id or sound format, FLV_TABLE_NO_CODEC for script data
+} flv_table_block_t;
+
+typedef struct flv_table_writer flv_table_writer_t;
+
+typedef struct flv_table_reader flv_table_reader_t;
+
+/*
+ * @brief visitor that appends a row per tag, pass the writer as the opaque
+ */
+extern const flv_visitor_t flv_table_visitor;
+
+flv_table_writer_t *flv_table_writer_open(const char *path);
+
+int flv_table_writer_close(flv_table_writer_t *writer);
+
+flv_table_reader_t *flv_table_reader_open(const char *path);
+
+int flv_table_reader_next(flv_table_reader_t *reader, flv_table_block_t *block);
+
+void flv_table_reader_close(flv_table_reader_t *reader);
+
+size_t flv_table_keyframes(const flv_table_block_t *block, int64_t t1, int64_t t2, uint8_t *match);
+
+size_t flv_table_larger(const flv_table_block_t *block, uint32_t size, uint8_t *match);
+
+#endif // FLV_TABLE_H_
@@ -0,0 +1,566 @@
+/*
+ * @file flv-uring.c
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "flv-uring.h"
+
+#define URING_ALIGN (4096)
+
+enum uring_block_states {
+    BLOCK_FREE,
+    BLOCK_INFLIGHT,
+    BLOCK_READY
+};
+
+struct uring_file;
+
+struct uring_block {
+    struct uring_file *file;
+    uint8_t *buf;
+    uint64_t offset;
+    size_t want;
+    size_t filled;
+    int state;
+};
+
+struct uring_file {
+    char *path;
+    flv_parser_t *parser;
+    int fd;
+    int direct;           // fd was opened with O_DIRECT
+    uint64_t size;
+    uint64_t next_submit; // file offset of the next read
+    uint64_t next_feed;   // file offset the parser wants next
+    unsigned inflight;
+    int result;           // FLV_OK while the file is scanned
+    struct uring_block *blocks; // blocks_per_file blocks of a slot, NULL when not open
+};
+
+struct flv_uring {
+    flv_uring_opts_t opts;
+    int ring_fd;
+
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned sq_entries;
+    unsigned sq_pending; // prepared, not yet submitted
+    struct io_uring_sqe *sqes;
+
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ptr;
+    void *cq_ptr;
+    size_t sq_len;
+    size_t cq_len;
+    size_t sqes_len;
+
+    struct uring_file *files;
+    int files_count;
+    int files_size;
+    int next_open;
+    unsigned inflight;
+
+    unsigned slots;     // files open at once
+    struct uring_block *blocks;
+    uint8_t *pool;
+};
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *params) {
+    return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int ring_setup(flv_uring_t *uring, unsigned entries) {
+    struct io_uring_params params;
+
+    memset(&params, 0, sizeof(params));
+    uring->ring_fd = sys_io_uring_setup(entries, &params);
+    if (uring->ring_fd < 0) {
+        return -1;
+    }
+
+    uring->sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    uring->cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (uring->cq_len > uring->sq_len) {
+            uring->sq_len = uring->cq_len;
+        }
+        uring->cq_len = 0;
+    }
+
+    uring->sq_ptr = mmap(NULL, uring->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         uring->ring_fd, IORING_OFF_SQ_RING);
+    if (uring->sq_ptr == MAP_FAILED) {
+        uring->sq_ptr = NULL;
+        return -1;
+    }
+    uring->cq_ptr = uring->sq_ptr;
+    if (uring->cq_len) {
+        uring->cq_ptr = mmap(NULL, uring->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                             uring->ring_fd, IORING_OFF_CQ_RING);
+        if (uring->cq_ptr == MAP_FAILED) {
+            uring->cq_ptr = NULL;
+            return -1;
+        }
+    }
+    uring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    uring->sqes = mmap(NULL, uring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       uring->ring_fd, IORING_OFF_SQES);
+    if (uring->sqes == MAP_FAILED) {
+        uring->sqes = NULL;
+        return -1;
+    }
+
+    uint8_t *sq = uring->sq_ptr;
+    uint8_t *cq = uring->cq_ptr;
+    uring->sq_head = (unsigned *) (sq + params.sq_off.head);
+    uring->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+    uring->sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+    uring->sq_array = (unsigned *) (sq + params.sq_off.array);
+    uring->sq_entries = params.sq_entries;
+    uring->cq_head = (unsigned *) (cq + params.cq_off.head);
+    uring->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+    uring->cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+    uring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+    return 0;
+}
+
+static void ring_teardown(flv_uring_t *uring) {
+    if (uring->sqes) {
+        munmap(uring->sqes, uring->sqes_len);
+    }
+    if (uring->cq_ptr && uring->cq_ptr != uring->sq_ptr) {
+        munmap(uring->cq_ptr, uring->cq_len);
+    }
+    if (uring->sq_ptr) {
+        munmap(uring->sq_ptr, uring->sq_len);
+    }
+    if (uring->ring_fd >= 0) {
+        close(uring->ring_fd);
+    }
+    uring->ring_fd = -1;
+}
+
+flv_uring_t *flv_uring_new(const flv_uring_opts_t *opts) {
+    flv_uring_t *uring = calloc(1, sizeof(flv_uring_t));
+    if (!uring) {
+        return NULL;
+    }
+
+    if (opts) {
+        uring->opts = *opts;
+    }
+    if (!uring->opts.queue_depth) {
+        uring->opts.queue_depth = 64;
+    }
+    if (!uring->opts.blocks_per_file) {
+        uring->opts.blocks_per_file = 2;
+    }
+    if (uring->opts.blocks_per_file > uring->opts.queue_depth) {
+        uring->opts.blocks_per_file = uring->opts.queue_depth;
+    }
+    if (!uring->opts.block_size) {
+        uring->opts.block_size = 1 << 20;
+    }
+    uring->opts.block_size = (uring->opts.block_size + URING_ALIGN - 1) & ~(size_t) (URING_ALIGN - 1);
+    uring->slots = uring->opts.queue_depth / uring->opts.blocks_per_file;
+
+    size_t blocks = (size_t) uring->slots * uring->opts.blocks_per_file;
+    uring->blocks = calloc(blocks, sizeof(struct uring_block));
+    if (!uring->blocks ||
+        posix_memalign((void **) &uring->pool, URING_ALIGN, blocks * uring->opts.block_size) != 0) {
+        free(uring->blocks);
+        free(uring);
+        return NULL;
+    }
+    for (size_t i = 0; i < blocks; i++) {
+        uring->blocks[i].buf = uring->pool + i * uring->opts.block_size;
+    }
+
+    // without io_uring (old kernel, seccomp) flv_uring_run() reads synchronously
+    uring->ring_fd = -1;
+    if (ring_setup(uring, uring->opts.queue_depth) < 0) {
+        ring_teardown(uring);
+    }
+
+    return uring;
+}
+
+int flv_uring_is_async(flv_uring_t *uring) {
+    return uring->ring_fd >= 0;
+}
+
+/*
+ * @brief queue a file, its parser must stay valid until flv_uring_run() returns
+ * @return index of the file for flv_uring_result()
+ */
+int flv_uring_add(flv_uring_t *uring, const char *path, flv_parser_t *parser) {
+    if (uring->files_count == uring->files_size) {
+        int size = uring->files_size ? uring->files_size * 2 : 16;
+        struct uring_file *files = realloc(uring->files, size * sizeof(struct uring_file));
+        if (!files) {
+            return -1;
+        }
+        uring->files = files;
+        uring->files_size = size;
+    }
+
+    struct uring_file *file = &uring->files[uring->files_count];
+    memset(file, 0, sizeof(*file));
+    file->path = strdup(path);
+    file->parser = parser;
+    file->fd = -1;
+    file->result = FLV_OK;
+    if (!file->path) {
+        return -1;
+    }
+
+    return uring->files_count++;
+}
+
+int flv_uring_result(flv_uring_t *uring, int index) {
+    return uring->files[index].result;
+}
+
+static int open_file(flv_uring_t *uring, struct uring_file *file) {
+    struct stat st;
+
+    file->fd = -1;
+    file->direct = 0;
+    if (uring->opts.direct) {
+        file->fd = open(file->path, O_RDONLY | O_DIRECT);
+        file->direct = file->fd >= 0;
+    }
+    if (file->fd < 0) {
+        // also when the file system refuses O_DIRECT
+        file->fd = open(file->path, O_RDONLY);
+    }
+    if (file->fd < 0) {
+        return -1;
+    }
+    if (fstat(file->fd, &st) < 0) {
+        close(file->fd);
+        file->fd = -1;
+        return -1;
+    }
+    file->size = st.st_size;
+    if (!uring->opts.direct) {
+        posix_fadvise(file->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    return 0;
+}
+
+static void close_file(struct uring_file *file) {
+    if (file->fd >= 0) {
+        close(file->fd);
+        file->fd = -1;
+    }
+    if (file->blocks) {
+        file->blocks[0].file = NULL; // the slot is free again
+        file->blocks = NULL;
+    }
+}
+
+static int prep_read(flv_uring_t *uring, struct uring_block *block) {
+    unsigned tail = *uring->sq_tail + uring->sq_pending;
+    unsigned head = __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE);
+
+    if (tail - head >= uring->sq_entries) {
+        return -1;
+    }
+
+    unsigned index = tail & *uring->sq_mask;
+    struct io_uring_sqe *sqe = &uring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = block->file->fd;
+    sqe->off = block->offset + block->filled;
+    sqe->addr = (uint64_t) (uintptr_t) (block->buf + block->filled);
+    sqe->len = (uint32_t) (block->want - block->filled);
+    sqe->user_data = (uint64_t) (uintptr_t) block;
+    uring->sq_array[index] = index;
+    uring->sq_pending++;
+
+    block->state = BLOCK_INFLIGHT;
+    block->file->inflight++;
+    uring->inflight++;
+    FLV_STATS_ADD(&block->file->parser->stats, read_calls, 1);
+    return 0;
+}
+
+/*
+ * @brief get the rest of a block that came back short or interrupted
+ *
+ * When the SQ has no room the rest is read with pread() right away, so the
+ * block never waits for a submission that is not coming. O_DIRECT takes
+ * only aligned offsets, so there the read resumes at the last aligned
+ * boundary and reads the bytes past it again.
+ * @return 1 when a read is in flight again, 0 when the block is ready or the file failed
+ */
+static int requeue_read(flv_uring_t *uring, struct uring_block *block) {
+    struct uring_file *file = block->file;
+
+    if (file->direct) {
+        block->filled &= ~(size_t) (URING_ALIGN - 1);
+    }
+    if (prep_read(uring, block) == 0) {
+        return 1;
+    }
+    while (block->filled < block->want && block->offset + block->filled < file->size) {
+        ssize_t n = pread(file->fd, block->buf + block->filled, block->want - block->filled,
+                          (off_t) (block->offset + block->filled));
+        FLV_STATS_ADD(&file->parser->stats, read_calls, 1);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            block->state = BLOCK_FREE;
+            if (file->result == FLV_OK) {
+                file->result = FLV_ERROR;
+            }
+            return 0;
+        }
+        if (n == 0) {
+            file->size = block->offset + block->filled; // the file shrank under us
+            break;
+        }
+        FLV_STATS_ADD(&file->parser->stats, bytes_read, n);
+        block->filled += n;
+    }
+    block->state = BLOCK_READY;
+    return 0;
+}
+
+/*
+ * @brief keep the free blocks of a file busy
+ */
+static void submit_file(flv_uring_t *uring, struct uring_file *file) {
+    for (unsigned i = 0; i < uring->opts.blocks_per_file && file->result == FLV_OK; i++) {
+        struct uring_block *block = &file->blocks[i];
+        if (block->state != BLOCK_FREE || file->next_submit >= file->size) {
+            continue;
+        }
+
+        size_t want = uring->opts.block_size;
+        if (file->size - file->next_submit < want) {
+            want = file->size - file->next_submit;
+            if (uring->opts.direct) {
+                // O_DIRECT wants aligned lengths, the read comes back short at EOF
+                want = (want + URING_ALIGN - 1) & ~(size_t) (URING_ALIGN - 1);
+            }
+        }
+        block->file = file;
+        block->offset = file->next_submit;
+        block->want = want;
+        block->filled = 0;
+        if (prep_read(uring, block) < 0) {
+            block->state = BLOCK_FREE;
+            break;
+        }
+        file->next_submit += want;
+    }
+}
+
+/*
+ * @brief push the completed blocks that continue the stream into the parser
+ */
+static void feed_file(struct uring_file *file, unsigned blocks_per_file) {
+    int progress = 1;
+
+    while (progress && file->result == FLV_OK) {
+        progress = 0;
+        for (unsigned i = 0; i < blocks_per_file; i++) {
+            struct uring_block *block = &file->blocks[i];
+            if (block->state != BLOCK_READY || block->offset != file->next_feed) {
+                continue;
+            }
+
+            file->result = flv_parser_feed(file->parser, block->buf, block->filled);
+            file->next_feed += block->filled;
+            block->state = BLOCK_FREE;
+            progress = 1;
+            break;
+        }
+    }
+
+    if (file->result == FLV_OK && file->next_feed >= file->size) {
+        file->result = flv_parser_finish(file->parser);
+    }
+}
+
+static void start_files(flv_uring_t *uring) {
+    for (unsigned slot = 0; slot < uring->slots && uring->next_open < uring->files_count; slot++) {
+        struct uring_block *blocks = &uring->blocks[slot * uring->opts.blocks_per_file];
+        if (blocks[0].file) {
+            continue;
+        }
+
+        struct uring_file *file = &uring->files[uring->next_open++];
+        if (open_file(uring, file) < 0) {
+            file->result = FLV_ERROR;
+            slot--; // try the next file in the same slot
+            continue;
+        }
+        file->blocks = blocks;
+        for (unsigned i = 0; i < uring->opts.blocks_per_file; i++) {
+            blocks[i].state = BLOCK_FREE;
+            blocks[i].file = file;
+        }
+        if (file->size == 0) {
+            file->result = flv_parser_finish(file->parser);
+            close_file(file);
+            slot--;
+            continue;
+        }
+        submit_file(uring, file);
+    }
+}
+
+static void complete(flv_uring_t *uring, struct io_uring_cqe *cqe) {
+    struct uring_block *block = (struct uring_block *) (uintptr_t) cqe->user_data;
+    struct uring_file *file = block->file;
+
+    file->inflight--;
+    uring->inflight--;
+
+    if (cqe->res == -EINTR || cqe->res == -EAGAIN) {
+        if (requeue_read(uring, block)) {
+            return;
+        }
+    } else if (cqe->res < 0) {
+        block->state = BLOCK_FREE;
+        if (file->result == FLV_OK) {
+            file->result = FLV_ERROR;
+        }
+    } else {
+        FLV_STATS_ADD(&file->parser->stats, bytes_read, cqe->res);
+        block->filled += cqe->res;
+        if (cqe->res == 0 && block->offset + block->filled < file->size) {
+            // the file shrank under us
+            file->size = block->offset + block->filled;
+        }
+        if (block->filled < block->want && block->offset + block->filled < file->size) {
+            // short read, get the rest
+            if (requeue_read(uring, block)) {
+                return;
+            }
+        } else {
+            block->state = BLOCK_READY;
+        }
+    }
+
+    if (file->result == FLV_OK) {
+        feed_file(file, uring->opts.blocks_per_file);
+    }
+    if (file->result == FLV_OK) {
+        submit_file(uring, file);
+    } else if (file->inflight == 0) {
+        close_file(file);
+    }
+}
+
+static int run_sync(flv_uring_t *uring) {
+    for (int i = 0; i < uring->files_count; i++) {
+        struct uring_file *file = &uring->files[i];
+        uint8_t *buf = uring->blocks[0].buf;
+
+        if (open_file(uring, file) < 0) {
+            file->result = FLV_ERROR;
+            continue;
+        }
+        while (file->result == FLV_OK) {
+            ssize_t n = pread(file->fd, buf, uring->opts.block_size, file->next_feed);
+            FLV_STATS_ADD(&file->parser->stats, read_calls, 1);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                file->result = (n == 0) ? flv_parser_finish(file->parser) : FLV_ERROR;
+                break;
+            }
+            FLV_STATS_ADD(&file->parser->stats, bytes_read, n);
+            file->result = flv_parser_feed(file->parser, buf, n);
+            file->next_feed += n;
+        }
+        close_file(file);
+    }
+    return 0;
+}
+
+/*
+ * @brief scan all queued files, each result is in flv_uring_result()
+ */
+int flv_uring_run(flv_uring_t *uring) {
+    if (uring->ring_fd < 0) {
+        return run_sync(uring);
+    }
+
+    for (;;) {
+        start_files(uring);
+        if (uring->inflight == 0 && uring->next_open >= uring->files_count) {
+            break;
+        }
+
+        // publish the prepared entries, then wait for one completion
+        unsigned tail = *uring->sq_tail + uring->sq_pending;
+        __atomic_store_n(uring->sq_tail, tail, __ATOMIC_RELEASE);
+        uring->sq_pending = 0;
+        unsigned to_submit = tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE);
+        if (sys_io_uring_enter(uring->ring_fd, to_submit, 1, IORING_ENTER_GETEVENTS) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+
+        unsigned head = *uring->cq_head;
+        for (;;) {
+            unsigned tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+            if (head == tail) {
+                break;
+            }
+            struct io_uring_cqe cqe = uring->cqes[head & *uring->cq_mask];
+            head++;
+            __atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+            complete(uring, &cqe);
+        }
+    }
+
+    return 0;
+}
+
+void flv_uring_free(flv_uring_t *uring) {
+    if (!uring) {
+        return;
+    }
+    ring_teardown(uring);
+    for (int i = 0; i < uring->files_count; i++) {
+        close_file(&uring->files[i]);
+        free(uring->files[i].path);
+    }
+    free(uring->files);
+    free(uring->blocks);
+    free(uring->pool);
+    free(uring);
+}
@@ -0,0 +1,36 @@
+/*
+ * @file flv-uring.h
+ *
+ * Batch scanner that keeps reads of many files in flight on one io_uring and
+ * pushes the completed blocks into each file's parser in order.
+ */
+
+#ifndef FLV_URING_H_
+#define FLV_URING_H_ (1)
+
+#include <stddef.h>
+
+#include "flv-parser.h"
+
+typedef struct flv_uring_opts {
+    unsigned queue_depth;     // reads in flight over all files, default 64
+    unsigned blocks_per_file; // reads in flight per file, default 2
+    size_t block_size;        // bytes per read, multiple of 4096, default 1 MiB
+    int direct;               // open with O_DIRECT, bypassing the page cache
+} flv_uring_opts_t;
+
+typedef struct flv_uring flv_uring_t;
+
+flv_uring_t *flv_uring_new(const flv_uring_opts_t *opts);
+
+int flv_uring_add(flv_uring_t *uring, const char *path, flv_parser_t *parser);
+
+int flv_uring_run(flv_uring_t *uring);
+
+int flv_uring_result(flv_uring_t *uring, int index);
+
+int flv_uring_is_async(flv_uring_t *uring);
+
+void flv_uring_free(flv_uring_t *uring);
+
+#endif // FLV_URING_H_
@@ -0,0 +1,276 @@
+/*
+ * @file flv-writer.c
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "flv-writer.h"
+
+#define FLV_MAX_DATA_SIZE (0xffffff) // 24 bits
+
+static void put_be(uint8_t *p, uint32_t value, int bytes) {
+    for (int i = bytes - 1; i >= 0; i--) {
+        p[i] = (uint8_t) value;
+        value >>= 8;
+    }
+}
+
+/*
+ * @brief add bytes to the batch, copied into the arena or referenced where they lie
+ */
+static int append(flv_writer_t *writer, const void *data, size_t size, int copy) {
+    if (size == 0) {
+        return FLV_OK;
+    }
+
+    if (copy) {
+        if (writer->arena_used + size > FLV_WRITER_ARENA_SIZE && flv_writer_flush(writer) != FLV_OK) {
+            return FLV_ERROR;
+        }
+        uint8_t *p = writer->arena + writer->arena_used;
+        struct iovec *last = writer->iov_count ? &writer->iov[writer->iov_count - 1] : NULL;
+        if (last && (uint8_t *) last->iov_base + last->iov_len == p) {
+            // right behind the previous copy, one piece grows
+            memcpy(p, data, size);
+            last->iov_len += size;
+            writer->arena_used += size;
+            writer->pending += size;
+            return FLV_OK;
+        }
+        if (writer->iov_count == writer->iov_max) {
+            if (flv_writer_flush(writer) != FLV_OK) {
+                return FLV_ERROR;
+            }
+            p = writer->arena;
+        }
+        memcpy(p, data, size);
+        writer->arena_used += size;
+        data = p;
+    } else if (writer->iov_count == writer->iov_max && flv_writer_flush(writer) != FLV_OK) {
+        return FLV_ERROR;
+    }
+
+    writer->iov[writer->iov_count].iov_base = (void *) data;
+    writer->iov[writer->iov_count].iov_len = size;
+    writer->iov_count++;
+    writer->pending += size;
+    return FLV_OK;
+}
+
+/*
+ * @brief the tag is complete, write the batch out once it is large enough
+ */
+static int end_tag(flv_writer_t *writer) {
+    if (writer->pending >= FLV_WRITER_BATCH_SIZE) {
+        return flv_writer_flush(writer);
+    }
+    return FLV_OK;
+}
+
+/*
+ * @param[in] fd: where the stream goes, left open by flv_writer_close()
+ * @return FLV_OK, or FLV_ERROR if the arena cannot be allocated
+ */
+int flv_writer_init(flv_writer_t *writer, int fd) {
+    memset(writer, 0, sizeof(*writer));
+    writer->fd = fd;
+    writer->copy_limit = FLV_WRITER_COPY_LIMIT;
+
+    writer->iov_max = FLV_WRITER_IOV;
+    long iov_max = sysconf(_SC_IOV_MAX);
+    if (iov_max > 0 && iov_max < writer->iov_max) {
+        writer->iov_max = (int) iov_max;
+    }
+
+    writer->arena = malloc(FLV_WRITER_ARENA_SIZE);
+    if (!writer->arena) {
+        writer->error = 1;
+        return FLV_ERROR;
+    }
+    return FLV_OK;
+}
+
+/*
+ * @brief the 9 bytes file header, data offset 9
+ */
+int flv_writer_header(flv_writer_t *writer, const flv_header_t *header) {
+    uint8_t bytes[FLV_HEADER_SIZE] = {'F', 'L', 'V'};
+
+    if (writer->error) {
+        return FLV_ERROR;
+    }
+    bytes[3] = header->version;
+    bytes[4] = header->type_flags;
+    put_be(bytes + 5, FLV_HEADER_SIZE, 4);
+
+    if (append(writer, bytes, sizeof(bytes), 1) != FLV_OK) {
+        writer->error = 1;
+        return FLV_ERROR;
+    }
+    writer->offset += sizeof(bytes);
+    return FLV_OK;
+}
+
+/*
+ * @brief start a tag of size payload bytes, flv_writer_payload() brings them
+ *
+ * The tag type and stream id come from tag. Without FLV_WRITE_RAW the
+ * timestamp is the low 32 bits of tag->time and the PreviousTagSize is that
+ * of the tag written before.
+ */
+int flv_writer_tag_header(flv_writer_t *writer, const flv_tag_t *tag, uint32_t size, int flags) {
+    uint8_t bytes[FLV_PREV_TAG_SIZE_SIZE + FLV_TAG_HEADER_SIZE];
+    uint32_t prev_tag_size = writer->tag_size;
+    uint32_t timestamp = (uint32_t) tag->time;
+
+    if (writer->error) {
+        return FLV_ERROR;
+    }
+    if (writer->tag_left || size > FLV_MAX_DATA_SIZE) {
+        writer->error = 1; // the previous tag is short of payload, or this one cannot be described
+        return FLV_ERROR;
+    }
+    if (flags & FLV_WRITE_RAW) {
+        prev_tag_size = tag->prev_tag_size;
+        timestamp = ((uint32_t) tag->timestamp_ext << 24) | (tag->timestamp & 0xffffff);
+    }
+
+    put_be(bytes, prev_tag_size, 4);
+    bytes[4] = tag->tag_type;
+    put_be(bytes + 5, size, 3);
+    put_be(bytes + 8, timestamp & 0xffffff, 3);
+    bytes[11] = (uint8_t) (timestamp >> 24);
+    put_be(bytes + 12, tag->stream_id & 0xffffff, 3);
+
+    if (append(writer, bytes, sizeof(bytes), 1) != FLV_OK) {
+        writer->error = 1;
+        return FLV_ERROR;
+    }
+    writer->offset += sizeof(bytes);
+    writer->have_tags = 1;
+    writer->tag_size = FLV_TAG_HEADER_SIZE + size;
+    writer->tag_left = size;
+    return size ? FLV_OK : end_tag(writer);
+}
+
+/*
+ * @brief the next payload bytes of the current tag, in one piece or several
+ */
+int flv_writer_payload(flv_writer_t *writer, const uint8_t *data, size_t size, int flags) {
+    int copy = (flags & FLV_WRITE_VOLATILE) && size <= writer->copy_limit;
+
+    if (writer->error) {
+        return FLV_ERROR;
+    }
+    if (size > writer->tag_left) {
+        writer->error = 1;
+        return FLV_ERROR;
+    }
+    if (append(writer, data, size, copy) != FLV_OK) {
+        writer->error = 1;
+        return FLV_ERROR;
+    }
+    writer->offset += size;
+    writer->tag_left -= (uint32_t) size;
+
+    if ((flags & FLV_WRITE_VOLATILE) && !copy) {
+        return flv_writer_flush(writer); // the view ends with this call
+    }
+    return writer->tag_left ? FLV_OK : end_tag(writer);
+}
+
+/*
+ * @brief write out the batch, borrowed payloads are free to go afterwards
+ */
+int flv_writer_flush(flv_writer_t *writer) {
+    struct iovec *iov = writer->iov;
+    int count = writer->iov_count;
+
+    if (writer->error) {
+        return FLV_ERROR;
+    }
+    while (count > 0) {
+        ssize_t n = writev(writer->fd, iov, count);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            writer->error = 1;
+            return FLV_ERROR;
+        }
+        // drop what went out, a short write leaves part of a piece
+        while (count > 0 && (size_t) n >= iov->iov_len) {
+            n -= (ssize_t) iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (uint8_t *) iov->iov_base + n;
+            iov->iov_len -= (size_t) n;
+        }
+    }
+
+    writer->iov_count = 0;
+    writer->pending = 0;
+    writer->arena_used = 0;
+    return FLV_OK;
+}
+
+/*
+ * @brief write the final PreviousTagSize, flush and release the arena
+ *
+ * A tag short of payload, as when the input ended inside one, is written
+ * out as far as it got.
+ * @return FLV_OK, or FLV_ERROR if any write failed or a tag is short of payload
+ */
+int flv_writer_close(flv_writer_t *writer) {
+    uint8_t bytes[FLV_PREV_TAG_SIZE_SIZE];
+    int short_tag = writer->tag_left != 0;
+
+    if (!writer->error && writer->have_tags && !short_tag) {
+        put_be(bytes, writer->tag_size, 4);
+        if (append(writer, bytes, sizeof(bytes), 1) != FLV_OK) {
+            writer->error = 1;
+        }
+        writer->offset += sizeof(bytes);
+    }
+    flv_writer_flush(writer);
+
+    free(writer->arena);
+    writer->arena = NULL;
+    return (writer->error || short_tag) ? FLV_ERROR : FLV_OK;
+}
+
+static int writer_header(void *opaque, const flv_header_t *header) {
+    return flv_writer_header(opaque, header) != FLV_OK;
+}
+
+static int writer_tag_header(void *opaque, const flv_tag_t *tag) {
+    flv_writer_t *writer = opaque;
+
+    return flv_writer_tag_header(writer, tag, tag->data_size, writer->visitor_flags) != FLV_OK;
+}
+
+static int writer_payload(void *opaque, const flv_tag_t *tag, const uint8_t *data, size_t size, uint32_t offset) {
+    (void) tag;
+    (void) offset;
+
+    // borrowed until writer_release
+    return flv_writer_payload(opaque, data, size, 0) != FLV_OK;
+}
+
+static void writer_release(void *opaque) {
+    // a failed write is sticky, the next tag stops the parse
+    flv_writer_flush(opaque);
+}
+
+const flv_visitor_t flv_writer_visitor = {
+    .on_header = writer_header,
+    .on_tag_header = writer_tag_header,
+    .on_payload = writer_payload,
+    .on_release = writer_release,
+};
@@ -0,0 +1,95 @@
+/*
+ * @file flv-writer.h
+ *
+ * FLV muxer, the mirror of the parser: the file header, then tags whose
+ * PreviousTagSize fields it fills in. Tag headers and small payloads are
+ * collected in an arena, larger payloads are referenced where they lie, and
+ * the lot goes out with writev() in batches of up to IOV_MAX pieces.
+ */
+
+#ifndef FLV_WRITER_H_
+#define FLV_WRITER_H_ (1)
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "flv-parser.h"
+
+#define FLV_WRITER_IOV (1024) // pieces per writev(), lowered to IOV_MAX
+#define FLV_WRITER_ARENA_SIZE (256 * 1024)
+#define FLV_WRITER_BATCH_SIZE (1024 * 1024) // bytes gathered before a writev()
+#define FLV_WRITER_COPY_LIMIT (4096) // default bound of the payloads FLV_WRITE_VOLATILE copies
+
+/*
+ * @brief flags of flv_writer_tag_header() and flv_writer_payload()
+ */
+enum flv_write_flags {
+    // tag header: timestamp, timestamp_ext and the PreviousTagSize in front
+    // of the tag exactly as in the flv_tag_t, as the parser read them, so
+    // with the payload the tag comes out byte for byte as it went in
+    FLV_WRITE_RAW = 1,
+    // payload: the data is only valid during the call, so it is copied into
+    // the arena up to the copy limit, and written out before the call
+    // returns when larger
+    FLV_WRITE_VOLATILE = 2,
+};
+
+/*
+ * @brief writer context, owned by the caller
+ *
+ * Payloads written without FLV_WRITE_VOLATILE are borrowed views: they
+ * must stay valid until the next flv_writer_flush() or flv_writer_close().
+ */
+typedef struct flv_writer {
+    int fd;
+    int error; // sticky, every later call fails too
+    uint64_t offset; // stream bytes handed to the writer so far
+    uint32_t copy_limit;
+    int visitor_flags; // tag header flags of flv_writer_visitor, FLV_WRITE_RAW or 0
+
+    // batch being gathered
+    struct iovec iov[FLV_WRITER_IOV];
+    int iov_max;
+    int iov_count;
+    size_t pending; // bytes in iov
+    uint8_t *arena;
+    size_t arena_used;
+
+    // tag being written
+    int have_tags;
+    uint32_t tag_size; // header and payload, the next PreviousTagSize
+    uint32_t tag_left; // payload bytes still to come
+} flv_writer_t;
+
+/*
+ * @brief visitor that writes the tags it sees, pass the flv_writer_t as the opaque
+ *
+ * Times are written from the unwrapped tag time and every PreviousTagSize is
+ * recomputed, so a filtered parse writes a well-formed file of the tags kept.
+ * With FLV_WRITE_RAW in visitor_flags the tags are copied as read instead,
+ * damaged PreviousTagSize fields and all; only the final PreviousTagSize,
+ * which the parser does not report, is still computed.
+ *
+ * Payloads are never copied: they are borrowed until the parser's
+ * on_release, which flushes. A file parse thus costs one writev() per
+ * refill of the 1 MiB read buffer, a pipeline one per batch and a fed
+ * stream one per flv_parser_feed(), unless the IOV_MAX pieces (two per tag)
+ * or FLV_WRITER_BATCH_SIZE bytes run out first. Only the tag headers are
+ * copied, into the arena.
+ */
+extern const flv_visitor_t flv_writer_visitor;
+
+int flv_writer_init(flv_writer_t *writer, int fd);
+
+int flv_writer_header(flv_writer_t *writer, const flv_header_t *header);
+
+int flv_writer_tag_header(flv_writer_t *writer, const flv_tag_t *tag, uint32_t size, int flags);
+
+int flv_writer_payload(flv_writer_t *writer, const uint8_t *data, size_t size, int flags);
+
+int flv_writer_flush(flv_writer_t *writer);
+
+int flv_writer_close(flv_writer_t *writer);
+
+#endif // FLV_WRITER_H_
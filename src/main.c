@@ -4,31 +4,717 @@
  * @date 2015/02/04
  */
 
+#define _POSIX_C_SOURCE 200809L
+#include <ctype.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
 #include "flv-parser.h"
+#include "flv-log.h"
+#include "flv-print.h"
+#include "flv-uring.h"
+#include "flv-server.h"
+#include "flv-follow.h"
+#include "flv-sync.h"
+#include "flv-table.h"
+#include "flv-index.h"
+#include "flv-cache.h"
+#include "flv-pipeline.h"
+#include "flv-diff.h"
+#include "flv-fingerprint.h"
+#include "flv-writer.h"
 
 void usage(char *program_name) {
-    printf("Usage: %s [input.flv]\n", program_name);
+    printf("Usage: %s [-s] [-v level] [--filter expr] [--pipeline] [input.flv]\n", program_name);
+    printf("       %s --output out.flv [--raw] [--filter expr] [--pipeline] [input.flv]\n", program_name);
+    printf("       %s -u [--direct] input.flv...\n", program_name);
+    printf("       %s --sync [-u] [--window seconds] input.flv...\n", program_name);
+    printf("       %s --export table.flvt [--pipeline] [input.flv]\n", program_name);
+    printf("       %s --query q table.flvt...\n", program_name);
+    printf("       %s --index [--cache dir [--cache-size mb]] input.flv...\n", program_name);
+    printf("       %s --diff [--first] a.flv b.flv\n", program_name);
+    printf("       %s --fingerprint out.flvf [--pipeline] [input.flv]\n", program_name);
+    printf("       %s --overlap a.flvf b.flvf...\n", program_name);
+    printf("       %s -f [--idle seconds] [-s] [-v level] input.flv\n", program_name);
+    printf("       %s --serve addr [--serve addr...] [--threads n] [--report seconds]\n", program_name);
+    printf("  -s  print parser stats to stderr at the end and on SIGUSR1\n");
+    printf("  -v  output level, 3 (errors) .. %d (default), this build's compile-time ceiling; every field needs 7\n", LOG_LEVEL);
+    printf("  -u, --uring  scan many files concurrently with io_uring, one summary line each\n");
+    printf("  --direct     read with O_DIRECT, leaving the page cache alone\n");
+    printf("  --filter expr     dump or export only the matching tags, comma-separated terms:\n");
+    printf("                    audio, video, script, keyframes, time=T1:T2 (ms, T1 <= time < T2), size=MIN:MAX,\n");
+    printf("                    stream=N, vcodec=N|avc|hevc|av1|vp9, acodec=N|aac|mp3\n");
+    printf("  --pipeline        read, parse and print on three threads\n");
+    printf("  --chunk-size n    deliver payloads larger than n bytes in chunks, bounding the buffer\n");
+    printf("  --output out.flv  write the tags, those the filter keeps, to out.flv (- for stdout) instead of dumping them\n");
+    printf("  --raw             with --output, copy the tags as read: timestamps and PreviousTagSize unchanged\n");
+    printf("  -f, --follow      keep parsing input.flv while it is being written\n");
+    printf("  --idle seconds    stop following after this long without new data, default never\n");
+    printf("  --sync            A/V sync report per file: offset, AAC clock drift, jitter, gaps, non-monotonic DTS\n");
+    printf("  --window seconds  with --sync, also a line per window of stream time\n");
+    printf("  --export table    write a columnar table with a row per tag\n");
+    printf("  --query q         rows of tag tables: keyframes:T1:T2 (ms) or larger:N (bytes)\n");
+    printf("  --index           summary, onMetaData and keyframe index per file\n");
+    printf("  --cache dir       keep --index results in dir, keyed by file identity\n");
+    printf("  --cache-size mb   bound of the cache, least recently used entries go first, default 64\n");
+    printf("  --diff            compare two files tag by tag: header, timestamps, sizes, codec fields, payload hashes\n");
+    printf("  --first           with --diff, stop at the first tag that differs\n");
+    printf("  --fingerprint out write a fingerprint per GOP, from CRC32Cs of the video frames\n");
+    printf("  --overlap         runs of GOPs that fingerprint files have in common\n");
+    printf("  --serve addr      ingest live streams on host:port or unix:/path (repeatable)\n");
+    printf("  --threads n       epoll loops for --serve, default one per CPU\n");
+    printf("  --report seconds  interval of the per-stream health lines, default 5\n");
     exit(-1);
 }
 
+void die(const flv_parser_t *parser) {
+    printf("Error at offset %" PRIu64 "!\n", flv_parser_offset(parser));
+
+    exit(-1);
+}
+
+/*
+ * @brief parse "LO:HI", either side may be left out to keep its default
+ */
+int parse_range(const char *str, uint64_t *lo, uint64_t *hi) {
+    const char *colon = strchr(str, ':');
+    char *end;
+
+    if (!colon) {
+        return -1;
+    }
+    if (colon != str) {
+        *lo = strtoull(str, &end, 10);
+        if (end != colon) {
+            return -1;
+        }
+    }
+    if (colon[1]) {
+        *hi = strtoull(colon + 1, &end, 10);
+        if (*end) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * @brief parse a --filter expression, terms of one kind add up
+ * @return 0, or -1 on an unknown term
+ */
+int parse_filter(char *expr, flv_filter_t *filter) {
+    int have_type = 0;
+    int have_vcodec = 0;
+    int have_acodec = 0;
+    unsigned long n1;
+    char tail;
+
+    flv_filter_init(filter);
+    for (char *term = strtok(expr, ","); term; term = strtok(NULL, ",")) {
+        uint8_t type = 0;
+        int vcodec = -1;
+        int acodec = -1;
+
+        if (strcmp(term, "audio") == 0) {
+            type = TAGTYPE_AUDIODATA;
+        } else if (strcmp(term, "video") == 0) {
+            type = TAGTYPE_VIDEODATA;
+        } else if (strcmp(term, "script") == 0) {
+            type = TAGTYPE_SCRIPTDATAOBJECT;
+        } else if (strcmp(term, "keyframes") == 0) {
+            filter->keyframes = 1;
+        } else if (strncmp(term, "time=", 5) == 0) {
+            if (parse_range(term + 5, &filter->time_from, &filter->time_to) < 0) {
+                return -1;
+            }
+        } else if (strncmp(term, "size=", 5) == 0) {
+            uint64_t lo = 0;
+            uint64_t hi = UINT32_MAX;
+            if (parse_range(term + 5, &lo, &hi) < 0 || lo > UINT32_MAX || hi > UINT32_MAX) {
+                return -1;
+            }
+            filter->min_size = (uint32_t) lo;
+            filter->max_size = (uint32_t) hi;
+        } else if (sscanf(term, "stream=%lu%c", &n1, &tail) == 1) {
+            filter->stream_id = (int64_t) n1;
+        } else if (strcmp(term, "vcodec=avc") == 0) {
+            vcodec = FLV_CODEC_ID_AVC;
+        } else if (strcmp(term, "vcodec=hevc") == 0) {
+            vcodec = FLV_CODEC_ID_HEVC;
+        } else if (strcmp(term, "vcodec=av1") == 0) {
+            vcodec = FLV_CODEC_ID_AV1;
+        } else if (strcmp(term, "vcodec=vp9") == 0) {
+            vcodec = FLV_CODEC_ID_VP9;
+        } else if (sscanf(term, "vcodec=%lu%c", &n1, &tail) == 1 && n1 < 16) {
+            vcodec = (int) n1;
+        } else if (strcmp(term, "acodec=aac") == 0) {
+            acodec = FLV_SOUND_FORMAT_AAC;
+        } else if (strcmp(term, "acodec=mp3") == 0) {
+            acodec = 2;
+        } else if (sscanf(term, "acodec=%lu%c", &n1, &tail) == 1 && n1 < 16) {
+            acodec = (int) n1;
+        } else {
+            return -1;
+        }
+
+        if (type) {
+            filter->tag_types = (have_type++ ? filter->tag_types : 0) | FLV_FILTER_BIT(type);
+        }
+        if (vcodec >= 0) {
+            filter->video_codecs = (have_vcodec++ ? filter->video_codecs : 0) | FLV_FILTER_BIT(vcodec);
+        }
+        if (acodec >= 0) {
+            filter->sound_formats = (have_acodec++ ? filter->sound_formats : 0) | FLV_FILTER_BIT(acodec);
+        }
+    }
+    return 0;
+}
+
+/*
+ * @brief summaries (or sync reports) of many files, read through io_uring
+ */
+int scan_files(int count, char **paths, int direct, int print_stats, int sync) {
+    flv_uring_opts_t opts = {0};
+    opts.direct = direct;
+    flv_uring_t *uring = flv_uring_new(&opts);
+    flv_parser_t *parsers = calloc(count, sizeof(flv_parser_t));
+    flv_summary_t *summaries = calloc(count, sizeof(flv_summary_t));
+    flv_sync_t *syncs = sync ? calloc(count, sizeof(flv_sync_t)) : NULL;
+    int failed = 0;
+
+    if (!uring || !parsers || !summaries || (sync && !syncs)) {
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        if (sync) {
+            // files finish in any order, no window lines
+            flv_sync_init(&syncs[i], NULL, 0);
+            flv_parser_init(&parsers[i], NULL, &flv_sync_visitor, &syncs[i]);
+        } else {
+            flv_parser_init(&parsers[i], NULL, &flv_summary_visitor, &summaries[i]);
+        }
+        flv_uring_add(uring, paths[i], &parsers[i]);
+    }
+
+    flv_uring_run(uring);
+
+    for (int i = 0; i < count; i++) {
+        if (flv_uring_result(uring, i) == FLV_ERROR) {
+            printf("%s: error at offset %" PRIu64 "\n", paths[i], flv_parser_offset(&parsers[i]));
+            failed++;
+        } else if (sync) {
+            flv_sync_print(paths[i], &syncs[i], stdout);
+        } else {
+            flv_print_summary(paths[i], &summaries[i]);
+        }
+        if (print_stats) {
+            flv_stats_print(&parsers[i].stats, stderr);
+        }
+        flv_parser_close(&parsers[i]);
+    }
+
+    flv_uring_free(uring);
+    free(parsers);
+    free(summaries);
+    free(syncs);
+    return failed ? -1 : 0;
+}
+
+/*
+ * @brief A/V sync report of each file, with a line per window of stream time
+ */
+int sync_files(int count, char **paths, uint32_t window, int print_stats) {
+    int failed = 0;
+
+    for (int i = 0; i < count; i++) {
+        flv_parser_t parser;
+        flv_sync_t sync;
+        FILE *infile = fopen(paths[i], "rb");
+        if (!infile) {
+            printf("%s: cannot open\n", paths[i]);
+            failed++;
+            continue;
+        }
+
+        flv_sync_init(&sync, stdout, window);
+        flv_parser_init(&parser, infile, &flv_sync_visitor, &sync);
+        if (print_stats) {
+            flv_parser_set_stats(&parser, stderr, SIGUSR1);
+        }
+        if (flv_parser_run(&parser) == FLV_ERROR) {
+            printf("%s: error at offset %" PRIu64 "\n", paths[i], flv_parser_offset(&parser));
+            failed++;
+        } else {
+            flv_sync_finish(&sync);
+            flv_sync_print(paths[i], &sync, stdout);
+        }
+        flv_parser_close(&parser);
+        fclose(infile);
+    }
+
+    return failed ? -1 : 0;
+}
+
+/*
+ * @brief flv_parser_run() on three threads, see flv-pipeline.h
+ */
+int run_pipeline(flv_parser_t *parser, FILE *infile) {
+    flv_pipeline_opts_t opts = {0};
+
+    return flv_pipeline_run(parser, fileno(infile), &opts);
+}
+
+/*
+ * @brief write the tag table of an FLV file
+ */
+int export_table(const char *table_path, FILE *infile, const flv_filter_t *filter, int pipeline, int print_stats) {
+    flv_parser_t parser;
+    flv_table_writer_t *writer = flv_table_writer_open(table_path);
+    int ret;
+
+    if (!writer) {
+        printf("%s: cannot create\n", table_path);
+        return -1;
+    }
+    flv_parser_init(&parser, infile, &flv_table_visitor, writer);
+    flv_parser_set_filter(&parser, filter);
+    if (print_stats) {
+        flv_parser_set_stats(&parser, stderr, SIGUSR1);
+    }
+    ret = pipeline ? run_pipeline(&parser, infile) : flv_parser_run(&parser);
+    if (ret == FLV_ERROR) {
+        printf("Error at offset %" PRIu64 "!\n", flv_parser_offset(&parser));
+    }
+    flv_parser_close(&parser);
+
+    if (flv_table_writer_close(writer) < 0) {
+        printf("%s: write error\n", table_path);
+        return -1;
+    }
+    return ret == FLV_ERROR ? -1 : 0;
+}
+
+/*
+ * @brief write the tags of an FLV file to another, those the filter keeps
+ */
+int rewrite_file(const char *out_path, FILE *infile, const flv_filter_t *filter, uint32_t chunk_size, int raw, int pipeline, int print_stats) {
+    flv_parser_t parser;
+    flv_writer_t writer;
+    int fd = strcmp(out_path, "-") ? open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0644) : STDOUT_FILENO;
+    int ret;
+
+    if (fd < 0 || flv_writer_init(&writer, fd) != FLV_OK) {
+        fprintf(stderr, "%s: cannot create\n", out_path);
+        return -1;
+    }
+    writer.visitor_flags = raw ? FLV_WRITE_RAW : 0;
+    flv_parser_init(&parser, infile, &flv_writer_visitor, &writer);
+    flv_parser_set_filter(&parser, filter);
+    flv_parser_set_chunk_size(&parser, chunk_size);
+    if (print_stats) {
+        flv_parser_set_stats(&parser, stderr, SIGUSR1);
+    }
+    ret = pipeline ? run_pipeline(&parser, infile) : flv_parser_run(&parser);
+    if (ret == FLV_ERROR) {
+        fprintf(stderr, "Error at offset %" PRIu64 "!\n", flv_parser_offset(&parser));
+    }
+    flv_parser_close(&parser);
+
+    // after a parse error the last tag is short, which is no write error
+    if (flv_writer_close(&writer) != FLV_OK && ret != FLV_ERROR) {
+        fprintf(stderr, "%s: write error\n", out_path);
+        ret = FLV_ERROR;
+    }
+    if (fd != STDOUT_FILENO) {
+        close(fd);
+    }
+    return ret == FLV_ERROR ? -1 : 0;
+}
+
+/*
+ * @brief write the GOP fingerprints of an FLV file
+ */
+int fingerprint_file(const char *fp_path, FILE *infile, int pipeline, int print_stats) {
+    flv_parser_t parser;
+    flv_fingerprint_t fp;
+    int ret;
+
+    if (flv_fingerprint_open(&fp, fp_path) < 0) {
+        printf("%s: cannot create\n", fp_path);
+        return -1;
+    }
+    flv_parser_init(&parser, infile, &flv_fingerprint_visitor, &fp);
+    if (print_stats) {
+        flv_parser_set_stats(&parser, stderr, SIGUSR1);
+    }
+    ret = pipeline ? run_pipeline(&parser, infile) : flv_parser_run(&parser);
+    if (ret == FLV_ERROR) {
+        printf("Error at offset %" PRIu64 "!\n", flv_parser_offset(&parser));
+    }
+    flv_parser_close(&parser);
+
+    if (flv_fingerprint_close(&fp) < 0) {
+        printf("%s: write error\n", fp_path);
+        return -1;
+    }
+    return ret == FLV_ERROR ? -1 : 0;
+}
+
+/*
+ * @brief print the rows of tag tables a query selects
+ * @param[in] query: "keyframes:T1:T2" (ms, T1 <= time < T2) or "larger:N" (bytes)
+ */
+int query_tables(const char *query, int count, char **paths) {
+    long long t1 = 0;
+    long long t2 = 0;
+    unsigned long long size = 0;
+    int keyframes = 0;
+    uint8_t match[FLV_TABLE_BLOCK_ROWS];
+    int failed = 0;
+    char *end = NULL;
+
+    if (sscanf(query, "keyframes:%lld:%lld", &t1, &t2) == 2) {
+        keyframes = 1;
+    } else if (strncmp(query, "larger:", 7) == 0 && isdigit((unsigned char) query[7])) {
+        // strtoull saturates, so an overflow is also above UINT32_MAX
+        size = strtoull(query + 7, &end, 10);
+    }
+    if (!keyframes && (!end || *end || size > UINT32_MAX)) {
+        printf("%s: unknown query\n", query);
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        flv_table_reader_t *reader = flv_table_reader_open(paths[i]);
+        flv_table_block_t block;
+        int ret;
+
+        if (!reader) {
+            printf("%s: not a tag table\n", paths[i]);
+            failed++;
+            continue;
+        }
+        while ((ret = flv_table_reader_next(reader, &block)) == 1) {
+            size_t selected = keyframes ? flv_table_keyframes(&block, t1, t2, match)
+                                        : flv_table_larger(&block, (uint32_t) size, match);
+            for (uint32_t row = 0; selected && row < block.rows; row++) {
+                if (!match[row]) {
+                    continue;
+                }
+                printf("%s: offset %" PRIu64 " time %" PRId64 " size %lu type %u frame %u codec %u cts %" PRId32 "\n",
+                       paths[i], block.offset[row], block.time[row], (unsigned long) block.size[row],
+                       block.tag_type[row], block.frame_type[row], block.codec[row], block.cts[row]);
+                selected--;
+            }
+        }
+        if (ret < 0) {
+            printf("%s: damaged tag table\n", paths[i]);
+            failed++;
+        }
+        flv_table_reader_close(reader);
+    }
+
+    return failed ? -1 : 0;
+}
+
+/*
+ * @brief summary, onMetaData and keyframe index of each file, from the cache when it has them
+ * @param[in] cache: NULL to always parse
+ */
+int index_files(int count, char **paths, const flv_cache_t *cache, int print_stats) {
+    int failed = 0;
+
+    for (int i = 0; i < count; i++) {
+        flv_index_t index;
+        flv_cache_key_t key;
+        int have_key = cache && flv_cache_key(paths[i], &key) == 0;
+
+        flv_index_init(&index);
+        if (have_key && flv_cache_load(cache, &key, &index)) {
+            flv_print_index(paths[i], &index);
+            flv_index_free(&index);
+            continue;
+        }
+
+        FILE *infile = fopen(paths[i], "rb");
+        if (!infile) {
+            printf("%s: cannot open\n", paths[i]);
+            failed++;
+            continue;
+        }
+        flv_parser_t parser;
+        flv_parser_init(&parser, infile, &flv_index_visitor, &index);
+        if (print_stats) {
+            flv_parser_set_stats(&parser, stderr, SIGUSR1);
+        }
+        if (flv_parser_run(&parser) == FLV_END) {
+            if (have_key) {
+                flv_cache_store(cache, &key, &index);
+            }
+            flv_print_index(paths[i], &index);
+        } else {
+            printf("%s: error at offset %" PRIu64 "\n", paths[i], flv_parser_offset(&parser));
+            failed++;
+        }
+        flv_parser_close(&parser);
+        fclose(infile);
+        flv_index_free(&index);
+    }
+
+    return failed ? -1 : 0;
+}
+
 int main(int argc, char **argv) {
 
     FILE *infile = NULL;
+    int print_stats = 0;
+    int uring = 0;
+    int direct = 0;
+    int follow = 0;
+    int sync = 0;
+    uint32_t sync_window = 0;
+    const char *export_path = NULL;
+    const char *query = NULL;
+    int index = 0;
+    flv_cache_t cache = {0};
+    uint32_t chunk_size = 0;
+    int pipeline = 0;
+    int diff = 0;
+    flv_diff_opts_t diff_opts = {0};
+    const char *fingerprint_path = NULL;
+    const char *output_path = NULL;
+    int raw = 0;
+    int overlap = 0;
+    flv_filter_t filter;
+    const flv_filter_t *have_filter = NULL;
+    flv_follow_opts_t follow_opts = {0};
+    int opt;
+    flv_parser_t parser;
+    flv_print_t print = {0};
+    flv_server_opts_t server = {{0}};
+    static const struct option long_options[] = {
+        {"uring", no_argument, NULL, 'u'},
+        {"direct", no_argument, NULL, 'D'},
+        {"serve", required_argument, NULL, 'S'},
+        {"threads", required_argument, NULL, 'T'},
+        {"report", required_argument, NULL, 'R'},
+        {"follow", no_argument, NULL, 'f'},
+        {"idle", required_argument, NULL, 'I'},
+        {"sync", no_argument, NULL, 'Y'},
+        {"window", required_argument, NULL, 'W'},
+        {"export", required_argument, NULL, 'E'},
+        {"query", required_argument, NULL, 'Q'},
+        {"index", no_argument, NULL, 'X'},
+        {"cache", required_argument, NULL, 'C'},
+        {"cache-size", required_argument, NULL, 'Z'},
+        {"chunk-size", required_argument, NULL, 'K'},
+        {"filter", required_argument, NULL, 'F'},
+        {"pipeline", no_argument, NULL, 'P'},
+        {"diff", no_argument, NULL, 'G'},
+        {"first", no_argument, NULL, 'N'},
+        {"fingerprint", required_argument, NULL, 'H'},
+        {"overlap", no_argument, NULL, 'O'},
+        {"output", required_argument, NULL, 'o'},
+        {"raw", no_argument, NULL, 'A'},
+        {NULL, 0, NULL, 0}
+    };
+
+    while ((opt = getopt_long(argc, argv, "sv:uf", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 's':
+                print_stats = 1;
+                break;
+            case 'v':
+                flv_set_log_level(atoi(optarg));
+                break;
+            case 'u':
+                uring = 1;
+                break;
+            case 'D':
+                direct = 1;
+                break;
+            case 'S':
+                if (server.listen_count == FLV_SERVER_MAX_LISTEN) {
+                    usage(argv[0]);
+                }
+                server.listen[server.listen_count++] = optarg;
+                break;
+            case 'T':
+                server.threads = atoi(optarg);
+                break;
+            case 'R':
+                server.report_interval = atoi(optarg);
+                break;
+            case 'f':
+                follow = 1;
+                break;
+            case 'I':
+                follow_opts.idle_timeout = atoi(optarg);
+                break;
+            case 'Y':
+                sync = 1;
+                break;
+            case 'W':
+                sync_window = (uint32_t) atoi(optarg) * 1000;
+                break;
+            case 'E':
+                export_path = optarg;
+                break;
+            case 'Q':
+                query = optarg;
+                break;
+            case 'X':
+                index = 1;
+                break;
+            case 'C':
+                cache.dir = optarg;
+                break;
+            case 'Z':
+                cache.max_bytes = (uint64_t) atoi(optarg) * 1024 * 1024;
+                break;
+            case 'K':
+                chunk_size = (uint32_t) atoi(optarg);
+                break;
+            case 'F':
+                if (parse_filter(optarg, &filter) < 0) {
+                    usage(argv[0]);
+                }
+                have_filter = &filter;
+                break;
+            case 'P':
+                pipeline = 1;
+                break;
+            case 'G':
+                diff = 1;
+                break;
+            case 'N':
+                diff_opts.first_only = 1;
+                break;
+            case 'H':
+                fingerprint_path = optarg;
+                break;
+            case 'O':
+                overlap = 1;
+                break;
+            case 'o':
+                output_path = optarg;
+                break;
+            case 'A':
+                raw = 1;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if (server.listen_count) {
+        return flv_server_run(&server) < 0 ? -1 : 0;
+    }
 
-    if (argc == 1) {
+    if (diff) {
+        if (argc - optind != 2) {
+            usage(argv[0]);
+        }
+        return flv_diff(argv[optind], argv[optind + 1], &diff_opts, stdout);
+    }
+
+    if (overlap) {
+        if (optind == argc) {
+            usage(argv[0]);
+        }
+        return flv_overlap(argc - optind, argv + optind, stdout) < 0 ? -1 : 0;
+    }
+
+    if (uring) {
+        if (optind == argc) {
+            usage(argv[0]);
+        }
+        return scan_files(argc - optind, argv + optind, direct, print_stats, sync) < 0 ? -1 : 0;
+    }
+
+    if (sync) {
+        if (optind == argc) {
+            usage(argv[0]);
+        }
+        return sync_files(argc - optind, argv + optind, sync_window, print_stats) < 0 ? -1 : 0;
+    }
+
+    if (follow) {
+        if (optind == argc) {
+            usage(argv[0]);
+        }
+        flv_parser_init(&parser, NULL, &flv_print_visitor, &print);
+        flv_parser_set_filter(&parser, have_filter);
+        if (flv_parser_set_chunk_size(&parser, chunk_size) != FLV_OK) {
+            usage(argv[0]);
+        }
+        if (print_stats) {
+            flv_parser_set_stats(&parser, stderr, SIGUSR1);
+        }
+        if (flv_follow(&parser, argv[optind], &follow_opts) == FLV_ERROR) {
+            die(&parser);
+        }
+        flv_parser_close(&parser);
+        printf("Finished analyzing\n");
+        return 0;
+    }
+
+    if (index) {
+        if (optind == argc) {
+            usage(argv[0]);
+        }
+        return index_files(argc - optind, argv + optind, cache.dir ? &cache : NULL, print_stats) < 0 ? -1 : 0;
+    }
+
+    if (query) {
+        if (optind == argc) {
+            usage(argv[0]);
+        }
+        return query_tables(query, argc - optind, argv + optind) < 0 ? -1 : 0;
+    }
+
+    if (optind == argc) {
         infile = stdin;
     } else {
-        infile = fopen(argv[1], "r");
+        infile = fopen(argv[optind], "r");
         if (!infile) {
             usage(argv[0]);
         }
     }
 
-    flv_parser_init(infile);
+    if (export_path) {
+        return export_table(export_path, infile, have_filter, pipeline, print_stats) < 0 ? -1 : 0;
+    }
+
+    if (output_path) {
+        if (chunk_size && chunk_size < FLV_MIN_CHUNK_SIZE) {
+            usage(argv[0]);
+        }
+        return rewrite_file(output_path, infile, have_filter, chunk_size, raw, pipeline, print_stats) < 0 ? -1 : 0;
+    }
+
+    if (fingerprint_path) {
+        return fingerprint_file(fingerprint_path, infile, pipeline, print_stats) < 0 ? -1 : 0;
+    }
 
-    flv_parser_run();
+    flv_parser_init(&parser, infile, &flv_print_visitor, &print);
+    flv_parser_set_filter(&parser, have_filter);
+    if (flv_parser_set_chunk_size(&parser, chunk_size) != FLV_OK) {
+        usage(argv[0]);
+    }
+    if (print_stats) {
+        flv_parser_set_stats(&parser, stderr, SIGUSR1);
+    }
+
+    if ((pipeline ? run_pipeline(&parser, infile) : flv_parser_run(&parser)) == FLV_ERROR) {
+        die(&parser);
+    }
+    flv_parser_close(&parser);
 
     printf("Finished analyzing\n");
 
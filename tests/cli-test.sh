@@ -0,0 +1,368 @@
+#!/bin/sh
+#
+# @file cli-test.sh
+#
+# End-to-end checks of the flv_parser tool, one case per ctest test:
+#   cli-test.sh <case> <flv_parser> <source dir>
+#
+
+set -e
+
+name=$1
+flv_parser=$2
+sample=$3/res/barsandtone.flv
+flv_gen=$(dirname "$flv_parser")/tests/flv_gen
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+fail() {
+    echo "FAIL: $*" >&2
+    exit 1
+}
+
+# expect <text> <file>: the file has a line containing text
+expect() {
+    grep -qF -- "$1" "$2" || fail "$2 lacks '$1'"
+}
+
+# wait_for <command...>: retry for up to 5 s
+wait_for() {
+    tries=50
+    until "$@"; do
+        tries=$((tries - 1))
+        [ $tries -gt 0 ] || return 1
+        sleep 0.1
+    done
+}
+
+case "$name" in
+stats)
+    "$flv_parser" -s "$sample" > /dev/null 2> "$work/stats"
+    expect "Bytes read: 88722" "$work/stats"
+    expect "Tags audio: 233" "$work/stats"
+    expect "Tags video: 2" "$work/stats"
+    expect "Tags scriptdata: 1" "$work/stats"
+    expect "Largest tag: 5775 bytes (type 9)" "$work/stats"
+    ;;
+log-quiet)
+    "$flv_parser" -v 3 "$sample" > "$work/out"
+    printf 'Finished analyzing\n' | cmp -s - "$work/out" || fail "-v 3 printed more than the end line"
+    ;;
+log-tags)
+    "$flv_parser" -v 6 "$sample" > "$work/out"
+    [ "$(grep -c '^Tag type: ' "$work/out")" -eq 236 ] || fail "-v 6 did not print a line per tag"
+    expect "Tag type: 9 - Video data #1" "$work/out"
+    if grep -q '^  Data size: ' "$work/out"; then
+        fail "-v 6 printed fields"
+    fi
+    ;;
+uring)
+    # more files than the ring has slots for (32), and one cut short
+    i=0
+    while [ $i -lt 40 ]; do
+        cp "$sample" "$work/f$i.flv"
+        i=$((i + 1))
+    done
+    head -c 50000 "$sample" > "$work/short.flv"
+    if "$flv_parser" -u "$work"/f*.flv "$work/short.flv" > "$work/out"; then
+        fail "-u reported no error for the short file"
+    fi
+    [ "$(grep -c ': 236 tags (233 audio, 2 video, 1 scriptdata), 2 keyframes, 85169 payload bytes, 6060 ms$' "$work/out")" -eq 40 ] ||
+        fail "-u summaries are wrong"
+    expect "$work/short.flv: error at offset" "$work/out"
+    # O_DIRECT, where the file system takes it, reads the same; sizes that are not a multiple of 4 KiB
+    "$flv_gen" -n 2000 "$work/long.flv"
+    "$flv_parser" -u "$sample" "$work/long.flv" > "$work/cached"
+    "$flv_parser" -u --direct "$sample" "$work/long.flv" > "$work/direct" || fail "-u --direct failed"
+    cmp -s "$work/cached" "$work/direct" || fail "-u --direct summaries differ"
+    ;;
+serve)
+    flv_send=$(dirname "$flv_parser")/flv_send
+    "$flv_parser" --serve "unix:$work/sock" --threads 2 > "$work/out" 2>&1 &
+    server=$!
+    wait_for test -S "$work/sock" || fail "the server did not listen"
+    "$flv_send" -n 2 "unix:$work/sock" "$sample" || fail "flv_send failed"
+    "$flv_send" -H "unix:$work/sock" "$sample" || fail "flv_send -H failed"
+    ended() {
+        [ "$(grep -c ') ended: .* 236 tags, 88709 bytes, ts 6060 ms, ' "$work/out")" -eq 3 ]
+    }
+    wait_for ended || { kill $server; fail "the streams did not end with 236 tags"; }
+    kill -TERM $server
+    wait $server || fail "the server did not stop cleanly on SIGTERM"
+    ;;
+follow)
+    # the recorder has written part of a tag when the follower starts
+    "$flv_parser" "$sample" > "$work/expected"
+    head -c 40000 "$sample" > "$work/rec.flv"
+    "$flv_parser" -f --idle 1 "$work/rec.flv" > "$work/out" &
+    follower=$!
+    sleep 0.3
+    tail -c +40001 "$sample" | head -c 30000 >> "$work/rec.flv"
+    sleep 0.3
+    tail -c +70001 "$sample" >> "$work/rec.flv"
+    wait $follower || fail "-f failed"
+    cmp -s "$work/expected" "$work/out" || fail "-f output differs from a plain parse"
+    ;;
+sync)
+    # 25 fps video over 44.1 kHz AAC, audio leads by up to a frame
+    "$flv_gen" -c 80 "$work/b.flv"
+    "$flv_parser" --sync "$work/b.flv" > "$work/out"
+    expect ": 431 audio, 250 video frames; A/V offset -12.1 ms (-24 .. -1); audio drift 0 ms (max 0);" "$work/out"
+    expect "; gaps 0/0 (max step 24/40 ms); non-monotonic DTS 0/0; max PTS-DTS 80 ms" "$work/out"
+    "$flv_parser" --sync --window 2 "$work/b.flv" > "$work/out"
+    [ "$(grep -c ' s: A/V offset .*, 0 gaps, 0 non-monotonic$' "$work/out")" -eq 5 ] || fail "--window 2 did not print 5 windows"
+    # a negative composition time is sign-extended, not a PTS 4.6 h ahead
+    "$flv_gen" -c -40 "$work/neg.flv"
+    "$flv_parser" --sync "$work/neg.flv" > "$work/out"
+    expect "non-monotonic DTS 0/0; max PTS-DTS 0 ms" "$work/out"
+    ;;
+table)
+    "$flv_parser" --export "$work/s.flvt" "$sample"
+    "$flv_parser" --query keyframes:0:100000 "$work/s.flvt" > "$work/out"
+    expect "s.flvt: offset 912 time 38 size 5775 type 9 frame 1 codec 4 cts 0" "$work/out"
+    expect "s.flvt: offset 82602 time 6038 size 5775 type 9 frame 1 codec 4 cts 0" "$work/out"
+    [ "$(wc -l < "$work/out")" -eq 2 ] || fail "keyframes query is wrong"
+    [ "$("$flv_parser" --query larger:300 "$work/s.flvt" | wc -l)" -eq 235 ] || fail "larger query is wrong"
+    # 2 bytes of offset delta, 1 of time delta, 2 of size, 1 of CTS, 3 of u8 columns a row
+    [ "$(wc -c < "$work/s.flvt")" -eq $((16 + 24 + 236 * 9)) ] || fail "the columns are not narrowed"
+    for q in larger:4294967296 larger:18446744073709551616 larger:5x larger:-1 larger:; do
+        if "$flv_parser" --query $q "$work/s.flvt" > /dev/null; then
+            fail "--query $q was accepted"
+        fi
+    done
+    # several blocks, negative CTS
+    "$flv_gen" -n 6000 -c -40 "$work/big.flv"
+    "$flv_parser" --export "$work/big.flvt" "$work/big.flv"
+    [ "$("$flv_parser" --query larger:0 "$work/big.flvt" | wc -l)" -eq 16339 ] || fail "rows are missing"
+    "$flv_parser" --query keyframes:1000:1000000000 "$work/big.flvt" > "$work/out"
+    [ "$(grep -c ' type 9 frame 1 codec 7 cts -40$' "$work/out")" -eq 239 ] || fail "keyframes across blocks are wrong"
+    expect "big.flvt: offset 10905796 time 239000 size 5204 type 9" "$work/out"
+    ;;
+index)
+    # the metadata does not depend on the log level, nor on the cache
+    cp "$sample" "$work/a.flv"
+    "$flv_parser" -v 3 --index "$work/a.flv" > "$work/fresh"
+    expect "a.flv: 236 tags (233 audio, 2 video, 1 scriptdata), 2 keyframes, 85169 payload bytes, 6060 ms" "$work/fresh"
+    expect "      Property: duration Number 6.000000" "$work/fresh"
+    expect "      Property: canSeekToEnd Boolean 1" "$work/fresh"
+    expect "  keyframe: offset 912 time 38" "$work/fresh"
+    expect "  keyframe: offset 82602 time 6038" "$work/fresh"
+    "$flv_parser" -v 3 --index --cache "$work/cache" "$work/a.flv" > "$work/miss"
+    [ -n "$(ls "$work/cache")" ] || fail "--cache stored nothing"
+    "$flv_parser" -v 3 --index --cache "$work/cache" "$work/a.flv" > "$work/hit"
+    cmp -s "$work/fresh" "$work/miss" || fail "--cache changed the output"
+    cmp -s "$work/fresh" "$work/hit" || fail "a cache hit differs from a fresh index"
+    ;;
+chunked)
+    # payloads pass through the 64-byte chunks unchanged
+    "$flv_gen" "$work/g.flv"
+    for f in "$sample" "$work/g.flv"; do
+        "$flv_parser" --chunk-size 64 --output "$work/out.flv" "$f"
+        cmp -s "$f" "$work/out.flv" || fail "--chunk-size 64 --output changed $f"
+    done
+    if "$flv_parser" --chunk-size 63 --output "$work/out.flv" "$sample" > /dev/null; then
+        fail "--chunk-size 63 was accepted"
+    fi
+    ;;
+filter)
+    "$flv_gen" "$work/g.flv"
+    # filter <expr> <expected -u line after the file name>
+    filter() {
+        "$flv_parser" --filter "$1" --output "$work/f.flv" "$work/g.flv"
+        "$flv_parser" -u "$work/f.flv" > "$work/out"
+        expect "f.flv: $2" "$work/out"
+    }
+    filter video "251 tags (0 audio, 251 video, 0 scriptdata), 11 keyframes, 324430 payload bytes, 9960 ms"
+    filter audio "432 tags (432 audio, 0 video, 0 scriptdata), 0 keyframes, 117931 payload bytes, 9984 ms"
+    filter video,keyframes "11 tags (0 audio, 11 video, 0 scriptdata), 11 keyframes,"
+    filter time=1000:3000 "136 tags (86 audio, 50 video, 0 scriptdata), 2 keyframes, 94758 payload bytes, 1995 ms"
+    filter video,time=2000:4000 "50 tags (0 audio, 50 video, 0 scriptdata), 2 keyframes,"
+    filter size=5000: "6 tags (0 audio, 6 video, 0 scriptdata), 6 keyframes, 36777 payload bytes,"
+    filter vcodec=hevc,script "1 tags (0 audio, 0 video, 1 scriptdata)"
+    filter stream=1 "0 tags"
+    if "$flv_parser" --filter bogus "$work/g.flv" > /dev/null; then
+        fail "--filter bogus was accepted"
+    fi
+    # with stats: skipped payloads are counted, and the scan stops past time=
+    "$flv_parser" -s --filter audio --output "$work/f.flv" "$work/g.flv" 2> "$work/stats"
+    if grep -q "^Parser stats:$" "$work/stats"; then
+        expect "Skipped: 252 tags (324546 bytes)" "$work/stats"
+        "$flv_parser" -s --filter time=0:1000 --output "$work/f.flv" "$work/g.flv" 2> "$work/stats"
+        expect "Tags audio: 45" "$work/stats"
+    fi
+    ;;
+pipeline)
+    "$flv_gen" -x "$work/g.flv"
+    for f in "$sample" "$work/g.flv"; do
+        "$flv_parser" "$f" > "$work/expected"
+        "$flv_parser" --pipeline "$f" > "$work/out"
+        cmp -s "$work/expected" "$work/out" || fail "--pipeline dump of $f differs"
+        "$flv_parser" --pipeline < "$f" > "$work/out"
+        cmp -s "$work/expected" "$work/out" || fail "--pipeline dump of piped $f differs"
+        "$flv_parser" --pipeline --output "$work/out.flv" "$f"
+        cmp -s "$f" "$work/out.flv" || fail "--pipeline --output changed $f"
+        cat "$f" | "$flv_parser" --pipeline --chunk-size 64 --output - > "$work/out.flv"
+        cmp -s "$f" "$work/out.flv" || fail "--pipeline --chunk-size 64 --output changed piped $f"
+        "$flv_parser" --filter video,time=1000:3000 "$f" > "$work/expected"
+        "$flv_parser" --pipeline --filter video,time=1000:3000 "$f" > "$work/out"
+        cmp -s "$work/expected" "$work/out" || fail "--pipeline --filter dump of $f differs"
+    done
+    # past the end of the time range it stops without waiting for the writer
+    mkfifo "$work/fifo"
+    (cat "$sample"; exec sleep 10) > "$work/fifo" &
+    writer=$!
+    "$flv_parser" --pipeline --filter time=0:1000 "$work/fifo" > "$work/out" &
+    parser=$!
+    exited() {
+        ! kill -0 $parser 2> /dev/null
+    }
+    wait_for exited || { kill $parser $writer; fail "--pipeline waited for more input"; }
+    wait $parser || fail "--pipeline --filter time=0:1000 failed"
+    kill $writer 2> /dev/null || true
+    ;;
+diff)
+    cp "$sample" "$work/copy.flv"
+    "$flv_parser" --diff "$sample" "$work/copy.flv" > "$work/out" || fail "--diff of a copy reported a difference"
+    expect "236 tags compared, identical" "$work/out"
+    # frame 100 comes after 176 audio tags and the 3 tags in front
+    "$flv_gen" "$work/a.flv"
+    "$flv_gen" -m 100 "$work/m.flv"
+    if "$flv_parser" --diff "$work/a.flv" "$work/m.flv" > "$work/out"; then
+        fail "--diff missed a flipped payload byte"
+    fi
+    expect "tag 276: payload hash " "$work/out"
+    expect "684 tags compared, files differ" "$work/out"
+    [ "$(wc -l < "$work/out")" -eq 2 ] || fail "--diff reported more than the flipped byte"
+    # the composition time of Enhanced FLV frames
+    "$flv_gen" -x "$work/x0.flv"
+    "$flv_gen" -x -c 40 "$work/x40.flv"
+    if "$flv_parser" --diff --first "$work/x0.flv" "$work/x40.flv" > "$work/out"; then
+        fail "--diff missed the composition time"
+    fi
+    expect "tag 3: composition time 0 != 40 (offsets 189, 189)" "$work/out"
+    expect "4 tags compared, files differ" "$work/out"
+    ;;
+overlap)
+    "$flv_gen" "$work/a.flv"
+    cp "$work/a.flv" "$work/c.flv"
+    # frames 100-249 of the same stream, starting at 5 s instead of 4 s
+    "$flv_gen" -k 100 -n 150 -t 5000 "$work/k.flv"
+    "$flv_gen" -s 2 "$work/s2.flv"
+    # frame 130 is in GOP 5
+    "$flv_gen" -m 130 "$work/m.flv"
+    for f in a c k s2 m; do
+        "$flv_parser" --fingerprint "$work/$f.flvf" "$work/$f.flv" > /dev/null || fail "--fingerprint $f.flv failed"
+    done
+    cd "$work"
+    "$flv_parser" --overlap a.flvf c.flvf > out || fail "--overlap failed"
+    expect "a.flvf GOPs 0-9 (0-9960 ms) = c.flvf GOPs 0-9 (0-9960 ms): 10 GOPs" out
+    expect "20 GOPs in 2 files, 1 runs in common" out
+    "$flv_parser" --overlap a.flvf k.flvf > out || fail "--overlap failed"
+    expect "a.flvf GOPs 4-9 (4000-9960 ms) = k.flvf GOPs 0-5 (5000-10960 ms): 6 GOPs" out
+    expect "16 GOPs in 2 files, 1 runs in common" out
+    "$flv_parser" --overlap a.flvf s2.flvf > out || fail "--overlap failed"
+    expect "20 GOPs in 2 files, 0 runs in common" out
+    "$flv_parser" --overlap a.flvf m.flvf > out || fail "--overlap failed"
+    expect "a.flvf GOPs 0-4 (0-5000 ms) = m.flvf GOPs 0-4 (0-5000 ms): 5 GOPs" out
+    expect "a.flvf GOPs 6-9 (6000-9960 ms) = m.flvf GOPs 6-9 (6000-9960 ms): 4 GOPs" out
+    expect "20 GOPs in 2 files, 2 runs in common" out
+    ;;
+enhanced)
+    "$flv_gen" -x -c 40 "$work/x.flv"
+    "$flv_parser" "$work/x.flv" > "$work/out" || fail "parsing Enhanced FLV failed"
+    # the track lines are above the Release log ceiling
+    if grep -q "^Tag type:" "$work/out"; then
+        [ "$(grep -c "FourCC: hvc1 - HEVC" "$work/out")" -eq 251 ] || fail "not every video track was hvc1"
+        [ "$(grep -c "Composition time: 40" "$work/out")" -eq 250 ] || fail "coded frames lost their composition time"
+        expect "DTS: 0 PTS: 40" "$work/out"
+    fi
+    "$flv_parser" --sync "$work/x.flv" > "$work/out"
+    expect "250 video frames" "$work/out"
+    expect "max PTS-DTS 40 ms" "$work/out"
+    # filter <expr> <expected -u line after the file name>
+    filter() {
+        "$flv_parser" --filter "$1" --output "$work/f.flv" "$work/x.flv"
+        "$flv_parser" -u "$work/f.flv" > "$work/out"
+        expect "f.flv: $2" "$work/out"
+    }
+    filter vcodec=hevc "684 tags (432 audio, 251 video, 1 scriptdata), 11 keyframes, 443225 payload bytes"
+    filter vcodec=avc "433 tags (432 audio, 0 video, 1 scriptdata), 0 keyframes"
+    filter video,vcodec=hevc,keyframes "11 tags (0 audio, 11 video, 0 scriptdata), 11 keyframes"
+    "$flv_parser" --output "$work/f.flv" "$work/x.flv"
+    cmp "$work/x.flv" "$work/f.flv" || fail "--output changed an Enhanced FLV file"
+    ;;
+output)
+    "$flv_gen" "$work/g.flv"
+    "$flv_gen" -x "$work/x.flv"
+    # timestamps past 24 bits need the extended byte
+    "$flv_gen" -t 16777000 -c -40 "$work/t.flv"
+    # payloads are written from the parser's buffers, which this one refills
+    "$flv_gen" -n 2000 "$work/long.flv"
+    for f in "$sample" "$work/g.flv" "$work/x.flv" "$work/t.flv" "$work/long.flv"; do
+        "$flv_parser" --output "$work/out.flv" "$f"
+        cmp -s "$f" "$work/out.flv" || fail "--output changed $f"
+        "$flv_parser" --output - "$f" > "$work/out.flv"
+        cmp -s "$f" "$work/out.flv" || fail "--output - changed $f"
+        cat "$f" | "$flv_parser" --output "$work/out.flv"
+        cmp -s "$f" "$work/out.flv" || fail "--output changed piped $f"
+    done
+    for mode in "--chunk-size 64" "--filter vcodec=avc,acodec=aac" "--pipeline"; do
+        "$flv_parser" $mode --output "$work/out.flv" "$work/long.flv"
+        cmp -s "$work/long.flv" "$work/out.flv" || fail "--output $mode changed long.flv"
+    done
+    # --raw keeps a damaged PreviousTagSize, the one in front of the first video tag
+    cp "$work/g.flv" "$work/damaged.flv"
+    printf '\377' | dd of="$work/damaged.flv" bs=1 seek=143 conv=notrunc 2> /dev/null
+    "$flv_parser" --output "$work/out.flv" --raw "$work/damaged.flv"
+    cmp -s "$work/damaged.flv" "$work/out.flv" || fail "--raw changed damaged.flv"
+    "$flv_parser" --output "$work/out.flv" "$work/damaged.flv"
+    cmp -s "$work/g.flv" "$work/out.flv" || fail "--output did not mend damaged.flv"
+    # a filtered copy across the 24-bit wrap parses, and filtering it again changes nothing
+    "$flv_parser" --filter time=16778000:16779000 --output "$work/f.flv" "$work/t.flv"
+    "$flv_parser" "$work/f.flv" > /dev/null || fail "the filtered output does not parse"
+    "$flv_parser" -u "$work/f.flv" > "$work/out"
+    expect "f.flv: 68 tags (43 audio, 25 video, 0 scriptdata), 1 keyframes, 44632 payload bytes, 996 ms" "$work/out"
+    "$flv_parser" --filter time=16778000:16779000 --output - "$work/f.flv" > "$work/again.flv"
+    cmp -s "$work/f.flv" "$work/again.flv" || fail "filtering the filtered output changed it"
+    if "$flv_parser" --output "$work/missing/out.flv" "$sample" > "$work/out" 2> "$work/err"; then
+        fail "--output to a missing directory succeeded"
+    fi
+    # stdout may be the stream, the error goes to stderr
+    [ ! -s "$work/out" ] || fail "--output wrote its error to stdout"
+    expect "missing/out.flv: cannot create" "$work/err"
+    ;;
+reader)
+    "$flv_gen" "$work/g.flv"
+    # an audio tag of 2 MiB, past the read buffer: copied out, or skipped with a seek
+    { printf 'FLV\001\004\000\000\000\011\000\000\000\000\010\040\000\000\000\000\000\000\000\000\000'
+      head -c 2097152 /dev/zero
+      printf '\000\040\000\013'; } > "$work/big.flv"
+    for f in "$sample" "$work/g.flv" "$work/big.flv"; do
+        "$flv_parser" "$f" > "$work/file" || fail "parsing $f failed"
+        "$flv_parser" < "$f" > "$work/pipe" || fail "parsing piped $f failed"
+        cmp -s "$work/file" "$work/pipe" || fail "piped $f parsed differently"
+    done
+    # truncated <file> <bytes>: every way of reading the cut file fails where it ends
+    truncated() {
+        head -c "$2" "$1" > "$work/cut.flv"
+        for mode in "" "--filter audio" "--filter video" "--filter vcodec=avc" "--chunk-size 64" "--pipeline"; do
+            if "$flv_parser" -v 3 $mode "$work/cut.flv" > "$work/file" 2>&1; then
+                fail "$1 cut at $2 with '$mode' parsed"
+            fi
+            if "$flv_parser" -v 3 $mode < "$work/cut.flv" > "$work/pipe" 2>&1; then
+                fail "piped $1 cut at $2 with '$mode' parsed"
+            fi
+            expect "Error at offset $2!" "$work/file"
+            expect "Error at offset $2!" "$work/pipe"
+        done
+    }
+    truncated "$work/g.flv" 5
+    truncated "$work/g.flv" 30
+    truncated "$work/g.flv" 210
+    truncated "$work/g.flv" 50000
+    truncated "$work/big.flv" 1500000
+    ;;
+*)
+    fail "unknown case $name"
+    ;;
+esac
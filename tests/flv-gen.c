@@ -0,0 +1,237 @@
+/*
+ * @file flv-gen.c
+ *
+ * Writes synthetic FLV files for the tests: onMetaData, codec configuration,
+ * then 25 fps video in GOPs of 25 frames interleaved with 44.1 kHz AAC.
+ * Every payload is derived from the seed and the frame number, so files
+ * generated from different first frames share their common frames byte for
+ * byte, whatever their timestamps.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define GOP_FRAMES (25)
+#define FRAME_MS (40)
+
+typedef struct gen {
+    FILE *out;
+    uint32_t prev_tag_size;
+    uint32_t seed;
+} gen_t;
+
+static void usage(const char *program_name) {
+    fprintf(stderr, "Usage: %s [-n frames] [-k first] [-s seed] [-c cts] [-t start] [-m frame] [-x] out.flv\n", program_name);
+    fprintf(stderr, "  -n  video frames, default 250\n");
+    fprintf(stderr, "  -k  number of the first frame, the stream time still starts at -t\n");
+    fprintf(stderr, "  -s  seed of the payloads, default 1\n");
+    fprintf(stderr, "  -c  composition time of every video frame in ms, may be negative\n");
+    fprintf(stderr, "  -t  time of the first tag in ms, default 0\n");
+    fprintf(stderr, "  -m  flip a payload byte of this video frame\n");
+    fprintf(stderr, "  -x  Enhanced FLV video (hvc1) instead of AVC\n");
+    exit(2);
+}
+
+static uint32_t next_random(uint32_t *state) {
+    // xorshift32
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static void put_be(uint8_t *p, uint64_t value, int bytes) {
+    for (int i = bytes - 1; i >= 0; i--) {
+        p[i] = (uint8_t) value;
+        value >>= 8;
+    }
+}
+
+static void write_tag(gen_t *gen, uint8_t type, uint32_t time, const uint8_t *data, uint32_t size) {
+    uint8_t header[4 + 11];
+
+    put_be(header, gen->prev_tag_size, 4);
+    header[4] = type;
+    put_be(header + 5, size, 3);
+    put_be(header + 8, time & 0xffffff, 3);
+    header[11] = (uint8_t) (time >> 24);
+    put_be(header + 12, 0, 3);
+    fwrite(header, 1, sizeof(header), gen->out);
+    fwrite(data, 1, size, gen->out);
+    gen->prev_tag_size = 11 + size;
+}
+
+/*
+ * @brief payload bytes of a frame, the same for the same seed, stream and number
+ */
+static void fill(const gen_t *gen, uint32_t stream, uint32_t number, uint8_t *p, uint32_t size) {
+    uint32_t state = (gen->seed * 2654435761u) ^ (stream << 28) ^ (number * 40503u) ^ 0x9e3779b9u;
+
+    if (state == 0) {
+        state = 1;
+    }
+    for (uint32_t i = 0; i < size; i++) {
+        p[i] = (uint8_t) next_random(&state);
+    }
+}
+
+/*
+ * @brief stream time of AAC frame n, 1024 samples each
+ */
+static uint64_t audio_ms(uint32_t n) {
+    return (uint64_t) n * 1024 * 1000 / 44100;
+}
+
+static size_t amf_string(uint8_t *p, const char *s) {
+    size_t n = strlen(s);
+    put_be(p, n, 2);
+    memcpy(p + 2, s, n);
+    return 2 + n;
+}
+
+static size_t amf_number(uint8_t *p, const char *name, double value) {
+    size_t n = amf_string(p, name);
+    uint64_t bits;
+
+    memcpy(&bits, &value, sizeof(bits));
+    p[n] = 0; // number
+    put_be(p + n + 1, bits, 8);
+    return n + 9;
+}
+
+static void write_metadata(gen_t *gen, uint32_t frames, int hevc) {
+    uint8_t data[256];
+    size_t n = 0;
+
+    data[n++] = 2; // string
+    n += amf_string(data + n, "onMetaData");
+    data[n++] = 8; // ECMA array
+    put_be(data + n, 5, 4);
+    n += 4;
+    n += amf_number(data + n, "duration", frames * FRAME_MS / 1000.0);
+    n += amf_number(data + n, "width", 640);
+    n += amf_number(data + n, "height", 360);
+    n += amf_number(data + n, "framerate", 1000 / FRAME_MS);
+    n += amf_number(data + n, "videocodecid", hevc ? 12 : 7);
+    put_be(data + n, 9, 3); // object end
+    n += 3;
+    write_tag(gen, 18, 0, data, (uint32_t) n);
+}
+
+int main(int argc, char **argv) {
+    gen_t gen = {NULL, 0, 1};
+    uint32_t frames = 250;
+    uint32_t first = 0;
+    int32_t cts = 0;
+    uint32_t start = 0;
+    long mutate = -1;
+    int hevc = 0;
+    int opt;
+    static uint8_t buf[16384];
+
+    while ((opt = getopt(argc, argv, "n:k:s:c:t:m:x")) != -1) {
+        switch (opt) {
+            case 'n':
+                frames = (uint32_t) strtoul(optarg, NULL, 10);
+                break;
+            case 'k':
+                first = (uint32_t) strtoul(optarg, NULL, 10);
+                break;
+            case 's':
+                gen.seed = (uint32_t) strtoul(optarg, NULL, 10);
+                break;
+            case 'c':
+                cts = (int32_t) strtol(optarg, NULL, 10);
+                break;
+            case 't':
+                start = (uint32_t) strtoul(optarg, NULL, 10);
+                break;
+            case 'm':
+                mutate = strtol(optarg, NULL, 10);
+                break;
+            case 'x':
+                hevc = 1;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (optind + 1 != argc) {
+        usage(argv[0]);
+    }
+    gen.out = fopen(argv[optind], "wb");
+    if (!gen.out) {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    static const uint8_t header[9] = {'F', 'L', 'V', 1, 5, 0, 0, 0, 9};
+    fwrite(header, 1, sizeof(header), gen.out);
+    write_metadata(&gen, frames, hevc);
+
+    // codec configuration: AVC or HEVC sequence header, AAC AudioSpecificConfig
+    static const uint8_t avc_config[] = {0x17, 0, 0, 0, 0, 1, 0x64, 0, 0x1f, 0xff, 0xe1, 0, 0};
+    static const uint8_t hevc_config[] = {0x90, 'h', 'v', 'c', '1', 1, 1, 0x60, 0, 0, 0};
+    static const uint8_t aac_config[] = {0xaf, 0, 0x12, 0x10};
+    if (hevc) {
+        write_tag(&gen, 9, start, hevc_config, sizeof(hevc_config));
+    } else {
+        write_tag(&gen, 9, start, avc_config, sizeof(avc_config));
+    }
+    write_tag(&gen, 8, start, aac_config, sizeof(aac_config));
+
+    // stream times count from frame 0, the file's from its first frame
+    uint64_t origin = (uint64_t) first * FRAME_MS;
+    uint32_t audio = 0;
+    while (audio_ms(audio) < origin) {
+        audio++;
+    }
+    for (uint32_t i = first; i < first + frames; i++) {
+        uint32_t time = start + (i - first) * FRAME_MS;
+        int key = i % GOP_FRAMES == 0;
+        uint32_t state = gen.seed ^ (i * 2246822519u) ^ 1;
+        uint32_t size = key ? 4000 + next_random(&state) % 4000 : 200 + next_random(&state) % 1800;
+        size_t n = 0;
+
+        if (hevc) {
+            // ExHeader, frame type, CodedFrames, FourCC, SI24 composition time
+            buf[n++] = (uint8_t) (0x80 | (key ? 0x10 : 0x20) | 1);
+            memcpy(buf + n, "hvc1", 4);
+            n += 4;
+        } else {
+            buf[n++] = key ? 0x17 : 0x27;
+            buf[n++] = 1; // NALU
+        }
+        put_be(buf + n, (uint32_t) cts & 0xffffff, 3);
+        n += 3;
+        fill(&gen, 0, i, buf + n, size);
+        if ((long) i == mutate) {
+            buf[n + size - 1] ^= 0xff;
+        }
+        write_tag(&gen, 9, time, buf, (uint32_t) (n + size));
+
+        // the AAC frames due before the next video frame
+        while (audio_ms(audio) < (uint64_t) (i + 1) * FRAME_MS) {
+            uint32_t audio_size = 200 + audio % 150;
+            buf[0] = 0xaf;
+            buf[1] = 1; // raw AAC
+            fill(&gen, 1, audio, buf + 2, audio_size);
+            write_tag(&gen, 8, start + (uint32_t) (audio_ms(audio) - origin), buf, audio_size + 2);
+            audio++;
+        }
+    }
+
+    uint8_t last[4];
+    put_be(last, gen.prev_tag_size, 4);
+    fwrite(last, 1, sizeof(last), gen.out);
+    if (fclose(gen.out) != 0) {
+        perror(argv[optind]);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,532 @@
+/*
+ * @file lib-test.c
+ *
+ * Checks of libflvparser through its API, one case per ctest test:
+ *   lib_test <case> [sample.flv]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "flv-parser.h"
+#include "flv-pipeline.h"
+#include "flv-writer.h"
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        exit(1); \
+    } \
+} while (0)
+
+typedef struct tag_record {
+    uint8_t type;
+    uint32_t data_size;
+    uint64_t offset;
+    uint64_t time;
+    uint32_t payload_bytes;
+    uint64_t payload_hash; // FNV-1a over the payload, however it was split
+} tag_record_t;
+
+/*
+ * @brief what a parse handed to the visitor, in order
+ */
+typedef struct record {
+    int headers;
+    size_t chunks; // on_payload calls
+    size_t largest_chunk;
+    size_t stop_after; // tags before the visitor stops the parse, 0 for all
+    size_t count;
+    size_t alloc;
+    tag_record_t *tags;
+} record_t;
+
+static int record_header(void *opaque, const flv_header_t *header) {
+    record_t *rec = opaque;
+
+    (void) header;
+    rec->headers++;
+    return 0;
+}
+
+static int record_tag_header(void *opaque, const flv_tag_t *tag) {
+    record_t *rec = opaque;
+
+    if (rec->stop_after && rec->count == rec->stop_after) {
+        return 1;
+    }
+    if (rec->count == rec->alloc) {
+        rec->alloc = rec->alloc ? rec->alloc * 2 : 256;
+        rec->tags = realloc(rec->tags, rec->alloc * sizeof(tag_record_t));
+        CHECK(rec->tags != NULL);
+    }
+    tag_record_t *t = &rec->tags[rec->count++];
+    memset(t, 0, sizeof(*t));
+    t->type = tag->tag_type;
+    t->data_size = tag->data_size;
+    t->offset = tag->offset;
+    t->time = tag->time;
+    t->payload_hash = UINT64_C(0xcbf29ce484222325);
+    return 0;
+}
+
+static int record_payload(void *opaque, const flv_tag_t *tag, const uint8_t *data, size_t size, uint32_t offset) {
+    record_t *rec = opaque;
+    tag_record_t *t = &rec->tags[rec->count - 1];
+
+    (void) tag;
+    CHECK(offset == t->payload_bytes);
+    rec->chunks++;
+    if (size > rec->largest_chunk) {
+        rec->largest_chunk = size;
+    }
+    for (size_t i = 0; i < size; i++) {
+        t->payload_hash = (t->payload_hash ^ data[i]) * UINT64_C(0x100000001b3);
+    }
+    t->payload_bytes += (uint32_t) size;
+    return 0;
+}
+
+static const flv_visitor_t record_visitor = {
+    .on_header = record_header,
+    .on_tag_header = record_tag_header,
+    .on_payload = record_payload,
+};
+
+/*
+ * @brief flv_parser_run() over a file
+ * @param[in] chunk_size: as for flv_parser_set_chunk_size(), 0 for whole payloads
+ * @return the status of the run
+ */
+static int parse_file(const char *path, uint32_t chunk_size, record_t *rec) {
+    flv_parser_t parser;
+    FILE *in = fopen(path, "rb");
+    int ret;
+
+    CHECK(in != NULL);
+    memset(rec, 0, sizeof(*rec));
+    flv_parser_init(&parser, in, &record_visitor, rec);
+    CHECK(flv_parser_set_chunk_size(&parser, chunk_size) == FLV_OK);
+    ret = flv_parser_run(&parser);
+    flv_parser_close(&parser);
+    fclose(in);
+    return ret;
+}
+
+/*
+ * @brief the whole file in memory
+ */
+static uint8_t *load_file(const char *path, size_t *size) {
+    FILE *in = fopen(path, "rb");
+    uint8_t *data;
+    long n;
+
+    CHECK(in != NULL);
+    CHECK(fseek(in, 0, SEEK_END) == 0 && (n = ftell(in)) >= 0);
+    rewind(in);
+    data = malloc(n ? (size_t) n : 1);
+    CHECK(data != NULL && fread(data, 1, (size_t) n, in) == (size_t) n);
+    fclose(in);
+    *size = (size_t) n;
+    return data;
+}
+
+/*
+ * @brief flv_parser_feed() of a buffer in pieces of the given size, then flv_parser_finish()
+ * @return the status of the finish, or of the feed that ended the parse
+ */
+static int parse_feed(const uint8_t *data, size_t size, size_t piece, uint32_t chunk_size, record_t *rec) {
+    flv_parser_t parser;
+    int ret = FLV_OK;
+
+    memset(rec, 0, sizeof(*rec));
+    flv_parser_init(&parser, NULL, &record_visitor, rec);
+    CHECK(flv_parser_set_chunk_size(&parser, chunk_size) == FLV_OK);
+    for (size_t done = 0; ret == FLV_OK && done < size; done += piece) {
+        ret = flv_parser_feed(&parser, data + done, size - done < piece ? size - done : piece);
+    }
+    if (ret == FLV_OK) {
+        ret = flv_parser_finish(&parser);
+    }
+    flv_parser_close(&parser);
+    return ret;
+}
+
+/*
+ * @brief flv_pipeline_run() over a file
+ * @return the status of the run
+ */
+static int parse_pipeline(const char *path, const flv_pipeline_opts_t *opts, uint32_t chunk_size, size_t stop_after, record_t *rec) {
+    flv_parser_t parser;
+    int fd = open(path, O_RDONLY);
+    int ret;
+
+    CHECK(fd >= 0);
+    memset(rec, 0, sizeof(*rec));
+    rec->stop_after = stop_after;
+    flv_parser_init(&parser, NULL, &record_visitor, rec);
+    CHECK(flv_parser_set_chunk_size(&parser, chunk_size) == FLV_OK);
+    ret = flv_pipeline_run(&parser, fd, opts);
+    flv_parser_close(&parser);
+    close(fd);
+    return ret;
+}
+
+static void check_same_tags(const record_t *a, const record_t *b) {
+    CHECK(a->headers == b->headers);
+    CHECK(a->count == b->count);
+    for (size_t i = 0; i < a->count; i++) {
+        CHECK(memcmp(&a->tags[i], &b->tags[i], sizeof(tag_record_t)) == 0);
+    }
+}
+
+static void record_free(record_t *rec) {
+    free(rec->tags);
+    memset(rec, 0, sizeof(*rec));
+}
+
+/*
+ * @brief the tags of res/barsandtone.flv reach the visitor with consistent offsets and payloads
+ */
+static void test_visitor(const char *sample) {
+    record_t rec;
+    size_t types[32] = {0};
+    uint64_t payload = 0;
+
+    CHECK(parse_file(sample, 0, &rec) == FLV_END);
+    CHECK(rec.headers == 1);
+    CHECK(rec.count == 236);
+    CHECK(rec.tags[0].offset == FLV_HEADER_SIZE + FLV_PREV_TAG_SIZE_SIZE);
+    for (size_t i = 0; i < rec.count; i++) {
+        const tag_record_t *t = &rec.tags[i];
+        types[t->type & 31]++;
+        payload += t->payload_bytes;
+        CHECK(t->payload_bytes == t->data_size);
+        if (i + 1 < rec.count) {
+            CHECK(rec.tags[i + 1].offset == t->offset + FLV_TAG_HEADER_SIZE + t->data_size + FLV_PREV_TAG_SIZE_SIZE);
+        }
+    }
+    CHECK(types[TAGTYPE_AUDIODATA] == 233);
+    CHECK(types[TAGTYPE_VIDEODATA] == 2);
+    CHECK(types[TAGTYPE_SCRIPTDATAOBJECT] == 1);
+    CHECK(payload == 85169);
+    record_free(&rec);
+}
+
+/*
+ * @brief pushing the sample in pieces of any size visits what the pull path does
+ */
+static void test_feed(const char *sample) {
+    static const size_t pieces[] = {1, 7, 4096, 1 << 20};
+    record_t pull;
+    record_t push;
+    size_t size;
+    uint8_t *data = load_file(sample, &size);
+
+    CHECK(parse_file(sample, 0, &pull) == FLV_END);
+    for (size_t i = 0; i < sizeof(pieces) / sizeof(pieces[0]); i++) {
+        CHECK(parse_feed(data, size, pieces[i], 0, &push) == FLV_END);
+        check_same_tags(&pull, &push);
+        record_free(&push);
+    }
+
+    // cut inside the last tag: the tags before it, then an error
+    CHECK(parse_feed(data, size - 10, 4096, 0, &push) == FLV_ERROR);
+    CHECK(push.count == pull.count);
+    record_free(&push);
+
+    record_free(&pull);
+    free(data);
+}
+
+/*
+ * @brief chunked payloads add up to the whole ones, no chunk larger than the chunk size
+ */
+static void test_chunks(const char *sample) {
+    static const uint32_t chunk_sizes[] = {FLV_MIN_CHUNK_SIZE, 1000, 4096};
+    record_t whole;
+    record_t chunked;
+    size_t size;
+    uint8_t *data = load_file(sample, &size);
+
+    CHECK(parse_file(sample, 0, &whole) == FLV_END);
+    CHECK(whole.chunks == whole.count);
+    for (size_t i = 0; i < sizeof(chunk_sizes) / sizeof(chunk_sizes[0]); i++) {
+        uint32_t chunk = chunk_sizes[i];
+
+        CHECK(parse_file(sample, chunk, &chunked) == FLV_END);
+        check_same_tags(&whole, &chunked);
+        CHECK(chunked.largest_chunk == chunk);
+        CHECK(chunked.chunks > whole.chunks);
+        record_free(&chunked);
+
+        CHECK(parse_feed(data, size, 7, chunk, &chunked) == FLV_END);
+        check_same_tags(&whole, &chunked);
+        CHECK(chunked.largest_chunk == chunk);
+        record_free(&chunked);
+    }
+
+    // below the minimum the first chunk could split a codec header
+    flv_parser_t parser;
+    flv_parser_init(&parser, NULL, &record_visitor, &chunked);
+    CHECK(flv_parser_set_chunk_size(&parser, FLV_MIN_CHUNK_SIZE - 1) == FLV_ERROR);
+    flv_parser_close(&parser);
+
+    record_free(&whole);
+    free(data);
+}
+
+/*
+ * @brief the pipeline visits what the pull path does, whatever its block and batch sizes
+ */
+static void test_pipeline(const char *sample) {
+    static const flv_pipeline_opts_t opts[] = {
+        {0, 0, 0, 0}, // defaults
+        {1, 1, 1, 2}, // a byte per block, every stage waits on the next
+        {100, 2, 16, 2},
+        {4096, 3, 1024, 3},
+    };
+    record_t direct;
+    record_t piped;
+
+    CHECK(parse_file(sample, 0, &direct) == FLV_END);
+    for (size_t i = 0; i < sizeof(opts) / sizeof(opts[0]); i++) {
+        CHECK(parse_pipeline(sample, &opts[i], 0, 0, &piped) == FLV_END);
+        check_same_tags(&direct, &piped);
+        record_free(&piped);
+
+        CHECK(parse_pipeline(sample, &opts[i], FLV_MIN_CHUNK_SIZE, 0, &piped) == FLV_END);
+        check_same_tags(&direct, &piped);
+        CHECK(piped.largest_chunk == FLV_MIN_CHUNK_SIZE);
+        record_free(&piped);
+
+        // the visitor stops it, the threads wind down without reading on
+        CHECK(parse_pipeline(sample, &opts[i], 0, 10, &piped) == FLV_STOP);
+        CHECK(piped.count == 10);
+        record_free(&piped);
+    }
+    record_free(&direct);
+}
+
+typedef struct timed_tag {
+    uint8_t type;
+    uint32_t timestamp; // as stored, timestamp_ext in the top byte
+    uint64_t time; // unwrapped, as expected
+} timed_tag_t;
+
+/*
+ * @brief an FLV stream of tiny tags with the given timestamps
+ */
+static uint8_t *build_stream(const timed_tag_t *tags, size_t count, size_t *size) {
+    static const uint8_t header[FLV_HEADER_SIZE] = {'F', 'L', 'V', 1, 5, 0, 0, 0, 9};
+    uint8_t *data = malloc(FLV_HEADER_SIZE + count * 17 + 4);
+    uint8_t *p = data;
+    uint32_t prev = 0;
+
+    CHECK(data != NULL);
+    memcpy(p, header, sizeof(header));
+    p += sizeof(header);
+    for (size_t i = 0; i < count; i++) {
+        uint32_t ts = tags[i].timestamp;
+        uint8_t tag[17] = {
+            prev >> 24, prev >> 16, prev >> 8, prev,
+            tags[i].type, 0, 0, 2,
+            ts >> 16, ts >> 8, ts, ts >> 24,
+            0, 0, 0,
+            tags[i].type == TAGTYPE_VIDEODATA ? 0x22 : 0x2f, 0,
+        };
+        memcpy(p, tag, sizeof(tag));
+        p += sizeof(tag);
+        prev = FLV_TAG_HEADER_SIZE + 2;
+    }
+    uint8_t last[4] = {prev >> 24, prev >> 16, prev >> 8, prev};
+    memcpy(p, last, sizeof(last));
+    p += sizeof(last);
+    *size = (size_t) (p - data);
+    return data;
+}
+
+/*
+ * @brief both input paths unwrap the timestamps to the expected times
+ */
+static void check_unwrap(const timed_tag_t *tags, size_t count) {
+    record_t pull;
+    record_t push;
+    size_t size;
+    uint8_t *data = build_stream(tags, count, &size);
+    FILE *file = tmpfile();
+    flv_parser_t parser;
+
+    CHECK(file != NULL && fwrite(data, 1, size, file) == size);
+    rewind(file);
+    memset(&pull, 0, sizeof(pull));
+    flv_parser_init(&parser, file, &record_visitor, &pull);
+    CHECK(flv_parser_run(&parser) == FLV_END);
+    flv_parser_close(&parser);
+    fclose(file);
+    CHECK(parse_feed(data, size, 5, 0, &push) == FLV_END);
+
+    CHECK(pull.count == count);
+    check_same_tags(&pull, &push);
+    for (size_t i = 0; i < count; i++) {
+        if (pull.tags[i].time != tags[i].time) {
+            fprintf(stderr, "tag %zu: timestamp 0x%08" PRIx32 " unwrapped to %" PRIu64 ", expected %" PRIu64 "\n",
+                    i, tags[i].timestamp, pull.tags[i].time, tags[i].time);
+            exit(1);
+        }
+    }
+    record_free(&pull);
+    record_free(&push);
+    free(data);
+}
+
+/*
+ * @brief wraps at 2^24 and 2^32 with audio stragglers from before the wrap
+ */
+static void test_unwrap(void) {
+    const uint8_t a = TAGTYPE_AUDIODATA;
+    const uint8_t v = TAGTYPE_VIDEODATA;
+    const uint64_t w24 = UINT64_C(1) << 24;
+    const uint64_t w32 = UINT64_C(1) << 32;
+    const timed_tag_t plain[] = {
+        {a, 1000, 1000},
+        {v, 900, 900}, // small steps back are no wrap
+        {v, 9000000, 9000000}, // neither is a large step forward before any wrap
+        {a, 8999000, 8999000},
+    };
+    const timed_tag_t wrap24[] = {
+        {a, 0xffff00, 0xffff00},
+        {v, 0xffff10, 0xffff10},
+        {a, 0xfffff0, 0xfffff0},
+        {v, 0x000005, w24 + 0x05},
+        {a, 0xfffff8, 0xfffff8}, // audio from before the wrap
+        {v, 0x000014, w24 + 0x14},
+        {a, 0x000002, w24 + 0x02},
+        {v, 0x00001e, w24 + 0x1e},
+        {a, 0x00001a, w24 + 0x1a},
+    };
+    const timed_tag_t wrap32[] = {
+        {a, 0xffffff00, 0xffffff00},
+        {v, 0xfffffff0, 0xfffffff0},
+        {a, 0x00000005, w32 + 0x05},
+        {v, 0xfffffff8, 0xfffffff8}, // video from before the wrap
+        {a, 0x00000010, w32 + 0x10},
+        {v, 0x00000020, w32 + 0x20},
+    };
+    const timed_tag_t ext[] = {
+        {a, 0x00fffff0, 0x00fffff0},
+        {v, 0x01000005, 0x01000005}, // timestamp_ext counts on, no wrap
+        {a, 0x00fffff8, 0x00fffff8},
+        {v, 0x01000014, 0x01000014},
+    };
+
+    check_unwrap(plain, sizeof(plain) / sizeof(plain[0]));
+    check_unwrap(wrap24, sizeof(wrap24) / sizeof(wrap24[0]));
+    check_unwrap(wrap32, sizeof(wrap32) / sizeof(wrap32[0]));
+    check_unwrap(ext, sizeof(ext) / sizeof(ext[0]));
+}
+
+/*
+ * @brief flv_writer_visitor over a stream, read from a file or fed in pieces
+ * @return what was written, *out_size bytes
+ */
+static uint8_t *rewrite_stream(const uint8_t *data, size_t size, int flags, int feed, size_t *out_size) {
+    flv_parser_t parser;
+    flv_writer_t writer;
+    FILE *in = tmpfile();
+    FILE *out = tmpfile();
+    int ret = FLV_OK;
+
+    CHECK(in != NULL && out != NULL);
+    CHECK(fwrite(data, 1, size, in) == size && fflush(in) == 0);
+    rewind(in);
+    CHECK(flv_writer_init(&writer, fileno(out)) == FLV_OK);
+    writer.visitor_flags = flags;
+    flv_parser_init(&parser, feed ? NULL : in, &flv_writer_visitor, &writer);
+    if (feed) {
+        for (size_t done = 0; ret == FLV_OK && done < size; done += 7) {
+            ret = flv_parser_feed(&parser, data + done, size - done < 7 ? size - done : 7);
+        }
+        CHECK(ret == FLV_OK && flv_parser_finish(&parser) == FLV_END);
+    } else {
+        CHECK(flv_parser_run(&parser) == FLV_END);
+    }
+    flv_parser_close(&parser);
+    CHECK(flv_writer_close(&writer) == FLV_OK);
+    fclose(in);
+
+    uint8_t *written = malloc(writer.offset);
+    CHECK(written != NULL);
+    CHECK(pread(fileno(out), written, writer.offset, 0) == (ssize_t) writer.offset);
+    fclose(out);
+    *out_size = writer.offset;
+    return written;
+}
+
+/*
+ * @brief FLV_WRITE_RAW copies a damaged stream byte for byte, the default mends it
+ */
+static void test_raw(void) {
+    const uint8_t a = TAGTYPE_AUDIODATA;
+    const uint8_t v = TAGTYPE_VIDEODATA;
+    const timed_tag_t tags[] = {
+        {a, 0xfffff0, 0xfffff0},
+        {v, 0x000005, (UINT64_C(1) << 24) + 0x05}, // wrapped, the default writes timestamp_ext 1
+        {a, 0x000010, (UINT64_C(1) << 24) + 0x10},
+        {v, 0x000020, (UINT64_C(1) << 24) + 0x20},
+    };
+    const size_t count = sizeof(tags) / sizeof(tags[0]);
+    size_t size;
+    uint8_t *data = build_stream(tags, count, &size);
+
+    // a PreviousTagSize that disagrees with the tag in front of it
+    data[FLV_HEADER_SIZE + 2 * 17 + 3] ^= 0x40;
+    for (int feed = 0; feed < 2; feed++) {
+        size_t raw_size;
+        size_t mended_size;
+        uint8_t *raw = rewrite_stream(data, size, FLV_WRITE_RAW, feed, &raw_size);
+        uint8_t *mended = rewrite_stream(data, size, 0, feed, &mended_size);
+
+        CHECK(raw_size == size && memcmp(raw, data, size) == 0);
+        CHECK(mended_size == size);
+        for (size_t i = 0; i < size; i++) {
+            // the PreviousTagSize and the timestamp_ext bytes of the wrapped tags
+            int mended_byte = i == FLV_HEADER_SIZE + 2 * 17 + 3 ||
+                              i == FLV_HEADER_SIZE + 1 * 17 + 11 ||
+                              i == FLV_HEADER_SIZE + 2 * 17 + 11 ||
+                              i == FLV_HEADER_SIZE + 3 * 17 + 11;
+            CHECK((mended[i] != data[i]) == mended_byte);
+        }
+        free(raw);
+        free(mended);
+    }
+    free(data);
+}
+
+int main(int argc, char **argv) {
+    const char *name = argc > 1 ? argv[1] : "";
+    const char *sample = argc > 2 ? argv[2] : NULL;
+
+    if (strcmp(name, "visitor") == 0 && sample) {
+        test_visitor(sample);
+    } else if (strcmp(name, "feed") == 0 && sample) {
+        test_feed(sample);
+    } else if (strcmp(name, "chunks") == 0 && sample) {
+        test_chunks(sample);
+    } else if (strcmp(name, "pipeline") == 0 && sample) {
+        test_pipeline(sample);
+    } else if (strcmp(name, "unwrap") == 0) {
+        test_unwrap();
+    } else if (strcmp(name, "raw") == 0) {
+        test_raw();
+    } else {
+        fprintf(stderr, "usage: %s visitor|feed|chunks|pipeline|unwrap|raw [sample.flv]\n", argv[0]);
+        return 2;
+    }
+    return 0;
+}